@@ -0,0 +1,163 @@
+#include "autotune.hpp"
+
+#include <algorithm>
+#include <stdio.h>
+
+int getRendererName(std::string &renderer)
+{
+    if (!glfwInit())
+        return -10;
+
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow *window = glfwCreateWindow(64, 64, "", NULL, NULL);
+    glfwDefaultWindowHints();
+    if (!window)
+    {
+        glfwTerminate();
+        return -11;
+    }
+
+    glfwMakeContextCurrent(window);
+    int errorCode = 0;
+    if (gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+        renderer = std::string((const char *)glGetString(GL_RENDERER)) + " / " + (const char *)glGetString(GL_VERSION);
+    else
+        errorCode = -12;
+
+    glfwDestroyWindow(window);
+    glfwTerminate();
+    return errorCode;
+}
+
+// One line of the cache, false if it is not one
+static bool parseTuning(const char *line, std::string &renderer, KernelTuning &tuning)
+{
+    int offset = 0;
+    if (sscanf(line, "%u %u %n", &tuning.local_size, &tuning.block_radius, &offset) != 2 || !offset)
+        return false;
+
+    renderer = line + offset;
+    while (!renderer.empty() && (renderer.back() == '\n' || renderer.back() == '\r'))
+        renderer.pop_back();
+    return true;
+}
+
+// Every line of the cache, empty if it does not exist yet
+static std::vector<std::string> readLines(const char *path)
+{
+    std::vector<std::string> lines;
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return lines;
+
+    char buffer[1024];
+    while (fgets(buffer, sizeof(buffer), file))
+        lines.push_back(buffer);
+    fclose(file);
+    return lines;
+}
+
+bool loadKernelTuning(const char *path, const std::string &renderer, KernelTuning &tuning)
+{
+    for (const std::string &line : readLines(path))
+    {
+        std::string name;
+        KernelTuning cached;
+        if (parseTuning(line.c_str(), name, cached) && name == renderer)
+        {
+            tuning = cached;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool saveKernelTuning(const char *path, const std::string &renderer, const KernelTuning &tuning)
+{
+    // Other renderers' lines, and anything that is not a tuning, stay as they were
+    std::vector<std::string> lines;
+    for (const std::string &line : readLines(path))
+    {
+        std::string name;
+        KernelTuning cached;
+        if (!parseTuning(line.c_str(), name, cached) || name != renderer)
+            lines.push_back(line);
+    }
+
+    FILE *file = fopen(path, "w");
+    if (!file)
+        return false;
+    for (const std::string &line : lines)
+        fputs(line.c_str(), file);
+    fprintf(file, "%u %u %s\n", tuning.local_size, tuning.block_radius, renderer.c_str());
+    return fclose(file) == 0;
+}
+
+int tuneKernels(const AutotuneConfig &config, KernelTuning &tuning)
+{
+    bool found = false;
+    for (unsigned block_radius : config.block_radii)
+    {
+        for (unsigned local_size : config.local_sizes)
+        {
+            SimulatorOptions options;
+            options.masses_x = options.masses_y = options.masses_z = config.lattice_size;
+            options.local_size = local_size;
+            options.block_radius = block_radius;
+
+            Simulator simulator(options);
+            int errorCode = simulator.init();
+            // Past the driver's workgroup size
+            if (errorCode == -13)
+                continue;
+            if (errorCode)
+                return errorCode;
+
+            // The first query also pays for compiling and uploading
+            simulator.timeSteps(config.steps);
+            double seconds = INFINITY;
+            for (int i = 0; i < 3; i++)
+                seconds = std::min(seconds, simulator.timeSteps(config.steps));
+
+            printf("  local size %3u  block radius %u  %9.3f ms/step\n", local_size, block_radius, seconds * 1e3);
+            if (!found || seconds < tuning.step_time)
+            {
+                tuning.local_size = local_size;
+                tuning.block_radius = block_radius;
+                tuning.step_time = seconds;
+                found = true;
+            }
+        }
+    }
+
+    // No variant the driver can run
+    return found ? 0 : -13;
+}
+
+int applyKernelTuning(const AutotuneConfig &config, SimulatorOptions &options)
+{
+    std::string renderer;
+    int errorCode = getRendererName(renderer);
+    if (errorCode)
+        return errorCode;
+
+    KernelTuning tuning;
+    if (loadKernelTuning(config.cache_path, renderer, tuning))
+        printf("Kernel tuning for %s from %s\n", renderer.c_str(), config.cache_path);
+    else
+    {
+        printf("Tuning kernels for %s on a %lu^3 lattice\n", renderer.c_str(), config.lattice_size);
+        errorCode = tuneKernels(config, tuning);
+        if (errorCode)
+            return errorCode;
+
+        // Tuned all the same, just again on the next launch
+        if (!saveKernelTuning(config.cache_path, renderer, tuning))
+            printf("Could not write %s\n", config.cache_path);
+    }
+
+    printf("Local size %u, block radius %u\n", tuning.local_size, tuning.block_radius);
+    options.local_size = tuning.local_size;
+    options.block_radius = tuning.block_radius;
+    return 0;
+}
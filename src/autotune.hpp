@@ -0,0 +1,46 @@
+#pragma once
+
+#include "simulator.hpp"
+
+#include <string>
+#include <vector>
+
+typedef struct
+{
+    // One line per renderer: local size, block radius, then GL_RENDERER and GL_VERSION
+    const char *cache_path = "kernel_tuning.txt";
+    // Edge of the cube every variant is timed on
+    size_t lattice_size = 64;
+    std::vector<unsigned> local_sizes{32, 64, 128, 256};
+    // Springs per invocation of the scatter and XPBD passes go with the block radius, block_radius^3 * 12 per color
+    std::vector<unsigned> block_radii{2, 3, 4};
+    // Steps per timer query, the fastest of three queries counts. All four fit in before the soft 64^3 cube, dropped
+    // onto the sphere, starts coming apart.
+    size_t steps = 25;
+} AutotuneConfig;
+
+// Kernel parameters of the fastest variant
+typedef struct
+{
+    unsigned local_size = 64;
+    unsigned block_radius = 2;
+    // Seconds per step it took
+    double step_time = 0;
+} KernelTuning;
+
+// GL_RENDERER and GL_VERSION, which names the driver, from a hidden window's context. Returns Simulator::initGL()'s
+// error codes.
+int getRendererName(std::string &renderer);
+
+// The tuning cached for renderer, false if there is none
+bool loadKernelTuning(const char *path, const std::string &renderer, KernelTuning &tuning);
+// Replaces renderer's line of the cache, or appends one
+bool saveKernelTuning(const char *path, const std::string &renderer, const KernelTuning &tuning);
+
+// Times every variant of config's grid with GL timer queries on the GPU backend and picks the fastest. Variants past the
+// driver's limits are skipped.
+int tuneKernels(const AutotuneConfig &config, KernelTuning &tuning);
+
+// Sets the kernel parameters of options to the ones cached for this renderer, tuning and caching them first if there
+// are none
+int applyKernelTuning(const AutotuneConfig &config, SimulatorOptions &options);
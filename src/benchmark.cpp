@@ -0,0 +1,1090 @@
+#include "benchmark.hpp"
+
+#include <chrono>
+#include <string.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+static double getTime()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Calls body until min_time has passed, returns the seconds taken by the fastest call,
+// which is far more stable than the mean on a shared machine
+template <typename Body>
+static double timeCalls(const Body &body, double min_time = 0.5)
+{
+    // Warm up caches and the thread pool
+    body();
+
+    double start = getTime(), fastest = INFINITY, now = start;
+    do
+    {
+        double call = now;
+        body();
+        now = getTime();
+        fastest = std::min(fastest, now - call);
+    } while (now - start < min_time);
+
+    return fastest;
+}
+
+// Seconds per step of an initialized simulator, over enough steps to take about min_time
+static double timeSimulator(Simulator &simulator, double min_time = 0.5)
+{
+    double seconds = simulator.timeSteps(1);
+    size_t steps = std::max(1.0, std::min(1000.0, min_time / seconds));
+    return simulator.timeSteps(steps);
+}
+
+// Disabled hardware cache miss counter for this thread and every thread it starts afterwards,
+// -1 where perf events are unavailable
+static int openCacheMissCounter()
+{
+#ifdef __linux__
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+static void enableCounter(int counter, bool enable)
+{
+#ifdef __linux__
+    if (counter >= 0)
+        ioctl(counter, enable ? PERF_EVENT_IOC_ENABLE : PERF_EVENT_IOC_DISABLE, 0);
+#endif
+}
+
+// Counts of threads started under the counter only arrive once they exit
+static long long closeCounter(int counter)
+{
+    long long count = -1;
+#ifdef __linux__
+    if (counter >= 0)
+    {
+        if (read(counter, &count, sizeof(count)) != sizeof(count))
+            count = -1;
+        close(counter);
+    }
+#endif
+    return count;
+}
+
+static const char *getBackendName(Backend backend)
+{
+    return backend == Backend::CPU ? "CPU" : "GPU";
+}
+
+static std::vector<size_t> getSizes(const BenchmarkConfig &config, const std::vector<size_t> &defaults)
+{
+    return config.sizes.empty() ? defaults : config.sizes;
+}
+
+static SimulatorOptions getLatticeOptions(const BenchmarkConfig &config, size_t size)
+{
+    SimulatorOptions options = config.options;
+    options.headless = options.backend == Backend::CPU;
+    options.masses_x = options.masses_y = options.masses_z = size;
+    return options;
+}
+
+static int benchmarkSpringKernels(const BenchmarkConfig &config)
+{
+    for (size_t size : getSizes(config, {16, 32, 64}))
+    {
+        Simulator simulator(getLatticeOptions(config, size));
+        int errorCode = simulator.build();
+        if (errorCode)
+            return errorCode;
+
+        SimulationData data = simulator.getSimulationData();
+        const PhysicsConfig &physics = simulator.getPhysicsConfig();
+
+        size_t live = 0;
+        for (size_t i = 0; i < data.spring_count; i++)
+            live += data.springs[i].type != 0;
+        printf("%lu^3 masses, %lu spring slots (%lu non-null), 1 thread\n", size, data.spring_count, live);
+
+        std::vector<glm::vec4> forces(data.position_count, glm::vec4(0.0f));
+        double reference = timeCalls([&]()
+        {
+            computeSpringForces(data.springs, 0, data.spring_count, physics, data.positions, forces.data());
+        });
+        printf("  %-10s %9.1f Msprings/s\n", getSpringISAName(SpringISA::Reference), data.spring_count / reference / 1e6);
+
+        SpringsSoA springs;
+        buildSpringsSoA(data.springs, data.spring_count, physics, springs);
+        std::vector<float> x(data.position_count), y(data.position_count), z(data.position_count);
+        for (size_t i = 0; i < data.position_count; i++)
+        {
+            x[i] = data.positions[i].x;
+            y[i] = data.positions[i].y;
+            z[i] = data.positions[i].z;
+        }
+
+        for (int isa = (int)SpringISA::Scalar; isa <= (int)detectSpringISA(); isa++)
+        {
+            double seconds = timeCalls([&]()
+            {
+                computeSpringForces((SpringISA)isa, springs, 0, data.spring_count, x.data(), y.data(), z.data(), forces.data());
+            });
+            printf("  %-10s %9.1f Msprings/s  %5.2fx\n", getSpringISAName((SpringISA)isa), data.spring_count / seconds / 1e6, reference / seconds);
+        }
+    }
+
+    return 0;
+}
+
+static int benchmarkAccumulation(const BenchmarkConfig &config)
+{
+    for (size_t size : getSizes(config, {32, 64, 128}))
+    {
+        Simulator simulator(getLatticeOptions(config, size));
+        int errorCode = simulator.build();
+        if (errorCode)
+            return errorCode;
+
+        SimulationData data = simulator.getSimulationData();
+        double colored = 0;
+        for (int accumulation = (int)SpringAccumulation::Colored; accumulation <= (int)SpringAccumulation::PerThread; accumulation++)
+        {
+            CPUBackendConfig backend_config;
+            backend_config.threads = config.options.threads;
+            backend_config.spring_isa = config.options.spring_isa;
+            backend_config.accumulation = (SpringAccumulation)accumulation;
+
+            CPUBackend backend;
+            errorCode = backend.init(data, simulator.getPhysicsConfig(), backend_config);
+            if (errorCode)
+                return errorCode;
+
+            if (accumulation == (int)SpringAccumulation::Colored)
+                printf("%lu^3 masses, %u threads, %s springs\n", size, backend.getThreadCount(), getSpringISAName(backend.getSpringISA()));
+
+            double seconds = timeCalls([&]()
+            {
+                backend.springs();
+            });
+            if (accumulation == (int)SpringAccumulation::Colored)
+                colored = seconds;
+            printf("  %-8s %9.3f ms/pass  %9.1f Msprings/s  %5.2fx\n", getSpringAccumulationName((SpringAccumulation)accumulation), seconds * 1e3, data.spring_count / seconds / 1e6, colored / seconds);
+        }
+    }
+
+    return 0;
+}
+
+// Bytes of spring data the spring pass reads besides positions
+static size_t getTopologyBytes(const SimulationData &data, SpringFormulation formulation)
+{
+    switch (formulation)
+    {
+    case SpringFormulation::Scatter:
+        return data.spring_count * sizeof(Spring) + (data.block_count * 8 + 1) * sizeof(GLuint);
+    case SpringFormulation::Gather:
+    {
+        size_t live = 0;
+        for (size_t i = 0; i < data.spring_count; i++)
+            live += data.springs[i].type != 0;
+        return (data.position_count + 1) * sizeof(GLuint) + live * 2 * sizeof(Spring);
+    }
+    default:
+        return 0;
+    }
+}
+
+static int benchmarkFormulation(const BenchmarkConfig &config)
+{
+    for (size_t size : getSizes(config, {16, 32, 64, 128}))
+    {
+        printf("%lu^3 masses, %s backend\n", size, getBackendName(config.options.backend));
+
+        double scatter = 0;
+        for (int formulation = (int)SpringFormulation::Scatter; formulation <= (int)SpringFormulation::Lattice; formulation++)
+        {
+            SimulatorOptions options = getLatticeOptions(config, size);
+            options.formulation = (SpringFormulation)formulation;
+
+            Simulator simulator(options);
+            int errorCode = simulator.init();
+            if (errorCode)
+                return errorCode;
+
+            double seconds = timeSimulator(simulator);
+            if (formulation == (int)SpringFormulation::Scatter)
+                scatter = seconds;
+            printf("  %-8s %9.3f ms/step  %5.2fx  %9.2f MB springs\n", getSpringFormulationName((SpringFormulation)formulation), seconds * 1e3, scatter / seconds,
+                   getTopologyBytes(simulator.getSimulationData(), (SpringFormulation)formulation) / 1e6);
+        }
+    }
+
+    return 0;
+}
+
+static int benchmarkCompaction(const BenchmarkConfig &config)
+{
+    for (size_t size : getSizes(config, {8, 16, 32, 64, 128}))
+    {
+        printf("%lu^3 masses, %s backend\n", size, getBackendName(config.options.backend));
+
+        double padded = 0;
+        size_t padded_bytes = 0;
+        for (bool compact : {false, true})
+        {
+            SimulatorOptions options = getLatticeOptions(config, size);
+            options.formulation = SpringFormulation::Scatter;
+            options.compact_springs = compact;
+
+            Simulator simulator(options);
+            int errorCode = simulator.init();
+            if (errorCode)
+                return errorCode;
+
+            size_t bytes = getTopologyBytes(simulator.getSimulationData(), SpringFormulation::Scatter);
+            double seconds = timeSimulator(simulator);
+            if (!compact)
+            {
+                padded = seconds;
+                padded_bytes = bytes;
+            }
+            printf("  %-8s %9.3f ms/step  %5.2fx  %9.2f MB springs (%.2f MB saved)\n", compact ? "compact" : "padded", seconds * 1e3, padded / seconds,
+                   bytes / 1e6, (padded_bytes - bytes) / 1e6);
+        }
+    }
+
+    return 0;
+}
+
+static int benchmarkOrdering(const BenchmarkConfig &config)
+{
+    for (size_t size : getSizes(config, {32, 64, 128}))
+    {
+        printf("%lu^3 masses, %s backend, %s springs\n", size, getBackendName(config.options.backend), getSpringFormulationName(config.options.formulation));
+
+        double linear = 0;
+        for (int order = (int)MassOrder::Linear; order <= (int)MassOrder::Hilbert; order++)
+        {
+            SimulatorOptions options = getLatticeOptions(config, size);
+            options.mass_order = (MassOrder)order;
+
+            // Opened first so the CPU backend's workers inherit it
+            int counter = options.backend == Backend::CPU ? openCacheMissCounter() : -1;
+            double seconds;
+            size_t steps;
+            {
+                Simulator simulator(options);
+                int errorCode = simulator.init();
+                if (errorCode)
+                {
+                    closeCounter(counter);
+                    return errorCode;
+                }
+
+                seconds = timeSimulator(simulator);
+                steps = std::max(1.0, std::min(100.0, 0.5 / seconds));
+                enableCounter(counter, true);
+                simulator.timeSteps(steps);
+                enableCounter(counter, false);
+            }
+            long long misses = closeCounter(counter);
+
+            if (order == (int)MassOrder::Linear)
+                linear = seconds;
+            if (misses >= 0)
+                printf("  %-8s %9.3f ms/step  %5.2fx  %12.0f cache misses/step\n", getMassOrderName((MassOrder)order), seconds * 1e3, linear / seconds, (double)misses / steps);
+            else
+                printf("  %-8s %9.3f ms/step  %5.2fx  cache misses n/a\n", getMassOrderName((MassOrder)order), seconds * 1e3, linear / seconds);
+        }
+    }
+
+    return 0;
+}
+
+// Whether any mass is NaN or has flown off beyond limit
+static bool hasBlownUp(const glm::vec4 *positions, size_t count, float limit = 1e3f)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!(glm::length(glm::vec3(positions[i])) < limit))
+            return true;
+    }
+    return false;
+}
+
+static int benchmarkTimestep(const BenchmarkConfig &config)
+{
+    const double duration = 10;
+    const struct
+    {
+        const char *name;
+        float step_rate;
+        bool adaptive;
+    } modes[]{
+        {"200 Hz", 200, false},
+        {"170 Hz", 170, false},
+        {"adaptive", 0, true},
+    };
+
+    for (size_t size : getSizes(config, {8, 16, 32}))
+    {
+        printf("%lu^3 masses, CPU backend, %g s simulated\n", size, duration);
+
+        for (const auto &mode : modes)
+        {
+            // Step counts do not depend on the backend, and the CPU one needs no window
+            SimulatorOptions options = getLatticeOptions(config, size);
+            options.backend = Backend::CPU;
+            options.headless = true;
+            options.substeps = 4;
+            options.step_rate = mode.step_rate;
+            options.adaptive_dt = mode.adaptive;
+
+            Simulator simulator(options);
+            int errorCode = simulator.init();
+            if (errorCode)
+                return errorCode;
+
+            double start = getTime();
+            bool blown_up = false;
+            while (simulator.getSimulatedTime() < duration && !blown_up)
+            {
+                simulator.run();
+                if (simulator.getFrameCount() % 16 == 0)
+                    blown_up = hasBlownUp(simulator.readPositions(), simulator.getSimulationData().position_count);
+            }
+            double seconds = getTime() - start;
+
+            if (blown_up)
+                printf("  %-8s blew up at %.2f s after %lu steps\n", mode.name, simulator.getSimulatedTime(), simulator.getStepCount());
+            else
+                printf("  %-8s %7.1f steps/simulated s  %8.3f s wall  %.2e s mean dt\n", mode.name, simulator.getStepCount() / simulator.getSimulatedTime(), seconds,
+                       simulator.getSimulatedTime() / simulator.getStepCount());
+        }
+    }
+
+    return 0;
+}
+
+static glm::vec3 getCentroid(const glm::vec4 *positions, size_t count)
+{
+    glm::dvec3 sum(0);
+    for (size_t i = 0; i < count; i++)
+        sum += glm::dvec3(positions[i]);
+    return glm::vec3(sum / (double)count);
+}
+
+// Mean |length - rest length| / rest length over every real spring, how far the springs give
+static double getMeanStretch(const SimulationData &data, const glm::vec4 *positions)
+{
+    double sum = 0;
+    size_t count = 0;
+    for (size_t i = 0; i < data.spring_count; i++)
+    {
+        const Spring &spring = data.springs[i];
+        if (spring.type == 0)
+            continue;
+        sum += std::abs(glm::length(positions[spring.point2] - positions[spring.point1]) - spring.len) / spring.len;
+        count++;
+    }
+    return count ? sum / count : 0;
+}
+
+static int benchmarkIntegrator(const BenchmarkConfig &config)
+{
+    const double duration = 5;
+    const struct
+    {
+        const char *name;
+        Integrator integrator;
+        float step_rate;
+        unsigned constraint_iterations;
+    } modes[]{
+        {"verlet 200 Hz", Integrator::Verlet, 200, 0},
+        {"verlet 40 Hz", Integrator::Verlet, 40, 0},
+        {"implicit 40 Hz", Integrator::Implicit, 40, 0},
+        {"implicit 20 Hz", Integrator::Implicit, 20, 0},
+        {"implicit 10 Hz", Integrator::Implicit, 10, 0},
+        {"xpbd 40 Hz x5", Integrator::XPBD, 40, 5},
+        {"xpbd 40 Hz x10", Integrator::XPBD, 40, 10},
+        {"xpbd 40 Hz x20", Integrator::XPBD, 40, 20},
+        {"xpbd 20 Hz x20", Integrator::XPBD, 20, 20},
+    };
+
+    for (size_t size : getSizes(config, {8, 16, 32}))
+    {
+        printf("%lu^3 masses, CPU backend, %g s simulated\n", size, duration);
+
+        glm::vec3 reference(0);
+        for (const auto &mode : modes)
+        {
+            SimulatorOptions options = getLatticeOptions(config, size);
+            options.backend = Backend::CPU;
+            options.headless = true;
+            if (!usesSpringBuffer(options.formulation))
+                options.formulation = SpringFormulation::Scatter;
+            options.integrator = mode.integrator;
+            options.step_rate = mode.step_rate;
+            options.constraint_iterations = mode.constraint_iterations;
+
+            Simulator simulator(options);
+            int errorCode = simulator.init();
+            if (errorCode)
+                return errorCode;
+
+            double start = getTime();
+            bool blown_up = false;
+            size_t iterations = 0;
+            while (simulator.getSimulatedTime() < duration && !blown_up)
+            {
+                simulator.run();
+                iterations += simulator.getSolverIterations();
+                if (simulator.getFrameCount() % 16 == 0)
+                    blown_up = hasBlownUp(simulator.readPositions(), simulator.getSimulationData().position_count);
+            }
+            double seconds = getTime() - start;
+
+            if (blown_up)
+            {
+                printf("  %-15s blew up at %.2f s after %lu steps\n", mode.name, simulator.getSimulatedTime(), simulator.getStepCount());
+                continue;
+            }
+
+            const glm::vec4 *positions = simulator.readPositions();
+            glm::vec3 centroid = getCentroid(positions, simulator.getSimulationData().position_count);
+            // Drift from the 200 Hz Verlet run, which comes first
+            if (&mode == modes)
+                reference = centroid;
+            printf("  %-15s %8.3f s wall per simulated s  %6.3f centroid drift  %6.4f mean stretch  %5.1f CG iterations per step\n", mode.name,
+                   seconds / simulator.getSimulatedTime(), glm::length(centroid - reference), getMeanStretch(simulator.getSimulationData(), positions),
+                   (double)iterations / simulator.getStepCount());
+        }
+    }
+
+    return 0;
+}
+
+static int benchmarkConstraints(const BenchmarkConfig &config)
+{
+    const double duration = 2;
+    const unsigned sweeps[]{10, 20, 40};
+    const struct
+    {
+        const char *name;
+        ConstraintSolver solver;
+        float spectral_radius;
+    } modes[]{
+        {"gauss-seidel", ConstraintSolver::GaussSeidel, 0},
+        {"jacobi", ConstraintSolver::Jacobi, 0},
+        {"chebyshev", ConstraintSolver::Jacobi, XPBDConfig().spectral_radius},
+    };
+
+    for (size_t size : getSizes(config, {8, 16}))
+    {
+        printf("%lu^3 masses, %s backend, XPBD at 40 Hz, %g s simulated\n", size, getBackendName(config.options.backend), duration);
+
+        // The stretch the explicit springs settle at is the stiffness to match
+        {
+            SimulatorOptions options = getLatticeOptions(config, size);
+            options.formulation = SpringFormulation::Scatter;
+            options.step_rate = 200;
+
+            Simulator simulator(options);
+            int errorCode = simulator.init();
+            if (errorCode)
+                return errorCode;
+            while (simulator.getSimulatedTime() < duration)
+                simulator.run();
+            printf("  verlet 200 Hz             %6.4f mean stretch\n", getMeanStretch(simulator.getSimulationData(), simulator.readPositions()));
+        }
+
+        for (const auto &mode : modes)
+        {
+            for (unsigned iterations : sweeps)
+            {
+                SimulatorOptions options = getLatticeOptions(config, size);
+                options.formulation = SpringFormulation::Scatter;
+                options.step_rate = 40;
+                options.integrator = Integrator::XPBD;
+                options.constraint_iterations = iterations;
+                options.constraint_solver = mode.solver;
+                options.spectral_radius = mode.spectral_radius;
+
+                Simulator simulator(options);
+                int errorCode = simulator.init();
+                if (errorCode)
+                    return errorCode;
+
+                double start = getTime();
+                while (simulator.getSimulatedTime() < duration)
+                    simulator.run();
+                double seconds = getTime() - start;
+
+                printf("  %-12s %2u sweeps  %6.4f mean stretch  %8.3f s wall per simulated s", mode.name, iterations,
+                       getMeanStretch(simulator.getSimulationData(), simulator.readPositions()), seconds / simulator.getSimulatedTime());
+
+                // Residual before sweeps 1, 2, 5, 10, 20 and 40 of the last step
+                std::vector<float> residuals = simulator.getConstraintResiduals();
+                if (!residuals.empty())
+                {
+                    printf("  residual");
+                    for (size_t sweep : {1, 2, 5, 10, 20, 40})
+                    {
+                        if (sweep <= residuals.size())
+                            printf(" %.1e", residuals[sweep - 1]);
+                    }
+                }
+                printf("\n");
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int benchmarkProjective(const BenchmarkConfig &config)
+{
+    const double duration = 1;
+    const struct
+    {
+        const char *name;
+        Integrator integrator;
+        float step_rate;
+        unsigned iterations;
+    } modes[]{
+        {"verlet 200 Hz", Integrator::Verlet, 200, 0},
+        {"projective 40 Hz x5", Integrator::Projective, 40, 5},
+        {"projective 40 Hz x10", Integrator::Projective, 40, 10},
+        {"projective 20 Hz x10", Integrator::Projective, 20, 10},
+    };
+
+    for (size_t size : getSizes(config, {16, 32, 64}))
+    {
+        printf("%lu^3 masses, CPU backend, same spring stiffness, %g s simulated\n", size, duration);
+
+        glm::vec3 reference(0);
+        for (const auto &mode : modes)
+        {
+            SimulatorOptions options = getLatticeOptions(config, size);
+            options.backend = Backend::CPU;
+            options.headless = true;
+            options.formulation = SpringFormulation::Scatter;
+            options.integrator = mode.integrator;
+            options.step_rate = mode.step_rate;
+            options.constraint_iterations = mode.iterations;
+
+            Simulator simulator(options);
+            int errorCode = simulator.init();
+            if (errorCode)
+                return errorCode;
+
+            double start = getTime();
+            bool blown_up = false;
+            while (simulator.getSimulatedTime() < duration && !blown_up)
+            {
+                simulator.run();
+                if (simulator.getFrameCount() % 16 == 0)
+                    blown_up = hasBlownUp(simulator.readPositions(), simulator.getSimulationData().position_count);
+            }
+            double seconds = getTime() - start;
+
+            if (blown_up)
+            {
+                printf("  %-21s blew up at %.2f s after %lu steps\n", mode.name, simulator.getSimulatedTime(), simulator.getStepCount());
+                continue;
+            }
+
+            const glm::vec4 *positions = simulator.readPositions();
+            glm::vec3 centroid = getCentroid(positions, simulator.getSimulationData().position_count);
+            if (&mode == modes)
+                reference = centroid;
+            printf("  %-21s %8.3f s wall per simulated s  %6.3f centroid drift  %6.4f mean stretch", mode.name, seconds / simulator.getSimulatedTime(),
+                   glm::length(centroid - reference), getMeanStretch(simulator.getSimulationData(), positions));
+
+            // The one-time cost the steps amortize
+            if (mode.integrator == Integrator::Projective)
+            {
+                const SparseCholesky &system = simulator.getCPUBackend().getProjectiveSystem();
+                printf("  factor %.3f s, %.1f MB", simulator.getCPUBackend().getFactorTime(), system.getFactorNonzeros() * sizeof(double) / 1e6);
+            }
+            printf("\n");
+        }
+    }
+
+    return 0;
+}
+
+static int benchmarkModal(const BenchmarkConfig &config)
+{
+    const unsigned mode_counts[]{6, 12, 24};
+
+    for (size_t size : getSizes(config, {8, 16}))
+    {
+        // Both after a second of simulated time, the jello resting on the sphere
+        SimulatorOptions options = getLatticeOptions(config, size);
+        options.formulation = SpringFormulation::Scatter;
+        double full;
+        {
+            Simulator simulator(options);
+            int errorCode = simulator.init();
+            if (errorCode)
+                return errorCode;
+            simulator.timeSteps(200);
+            full = timeSimulator(simulator);
+        }
+        printf("%lu^3 masses, verlet on the %s backend: %9.2f us per step\n", size, getBackendName(options.backend), full * 1e6);
+
+        for (unsigned modes : mode_counts)
+        {
+            options.integrator = Integrator::Modal;
+            options.modes = modes;
+            Simulator simulator(options);
+            int errorCode = simulator.init();
+            if (errorCode)
+                return errorCode;
+            simulator.timeSteps(200);
+            double reduced = timeSimulator(simulator);
+
+            const ModalBody &body = simulator.getModalBodies()[0];
+            printf("  modal %2lu modes  %9.2f us per step (%6.1f bodies per full one)  setup %.3f s in %u iterations, %.2f-%.2f Hz\n",
+                   body.getModeCount(), reduced * 1e6, full / reduced, body.getSetupTime(), body.getSetupIterations(),
+                   body.getFrequencies().front() / (2 * M_PI), body.getFrequencies().back() / (2 * M_PI));
+        }
+    }
+
+    return 0;
+}
+
+static int benchmarkShapeMatching(const BenchmarkConfig &config)
+{
+    for (size_t size : getSizes(config, {16, 32, 64}))
+    {
+        printf("%lu^3 masses, steps on the %s backend, force passes on the CPU\n", size, getBackendName(config.options.backend));
+
+        double scatter = 0;
+        for (int formulation = (int)SpringFormulation::Scatter; formulation <= (int)SpringFormulation::ShapeMatching; formulation++)
+        {
+            SimulatorOptions options = getLatticeOptions(config, size);
+            options.formulation = (SpringFormulation)formulation;
+
+            Simulator simulator(options);
+            int errorCode = simulator.init();
+            if (errorCode)
+                return errorCode;
+            double step = timeSimulator(simulator);
+
+            // The spring or shape matching pass alone
+            CPUBackendConfig backend_config;
+            backend_config.threads = config.options.threads;
+            backend_config.spring_isa = config.options.spring_isa;
+            backend_config.formulation = options.formulation;
+            CPUBackend backend;
+            errorCode = backend.init(simulator.getSimulationData(), simulator.getPhysicsConfig(), backend_config);
+            if (errorCode)
+                return errorCode;
+            double pass = timeCalls([&]()
+            {
+                backend.springs();
+            });
+
+            if (formulation == (int)SpringFormulation::Scatter)
+                scatter = pass;
+            double masses = size * size * size;
+            printf("  %-14s %8.2f ns/mass pass  %5.2fx  %8.2f ns/mass step  %9.2f MB springs\n", getSpringFormulationName((SpringFormulation)formulation),
+                   pass / masses * 1e9, scatter / pass, step / masses * 1e9, getTopologyBytes(simulator.getSimulationData(), (SpringFormulation)formulation) / 1e6);
+        }
+    }
+
+    return 0;
+}
+
+static int benchmarkBodies(const BenchmarkConfig &config)
+{
+    // The same masses as one cube or as many 4^3 bodies: with shared buffers and dispatches, only the mass count should matter
+    const size_t body_size = 4;
+    for (size_t size : getSizes(config, {20, 40}))
+    {
+        size_t masses = size * size * size;
+        size_t body_count = masses / (body_size * body_size * body_size);
+        printf("%lu masses on the %s backend\n", masses, getBackendName(config.options.backend));
+
+        for (size_t count : {(size_t)1, body_count})
+        {
+            SimulatorOptions options = getLatticeOptions(config, size);
+            options.mass_order = MassOrder::Linear;
+            if (count > 1)
+                options.bodies = arrangeBodies(count, body_size, body_size, body_size);
+
+            Simulator simulator(options);
+            int errorCode = simulator.init();
+            if (errorCode)
+                return errorCode;
+            double step = timeSimulator(simulator);
+            printf("  %5lu bodies  %9.2f us per step  %8.2f ns/mass\n", simulator.getBodies().size(), step * 1e6, step / masses * 1e9);
+        }
+    }
+
+    return 0;
+}
+
+static int benchmarkContacts(const BenchmarkConfig &config)
+{
+    // Sizes are body counts: 4^3 bodies have 56 surface masses, so the defaults give about 10K, 100K and 1M of them
+    const size_t body_size = 4;
+    for (size_t count : getSizes(config, {179, 1786, 17858}))
+    {
+        SimulatorOptions options = getLatticeOptions(config, body_size);
+        options.mass_order = MassOrder::Linear;
+        options.bodies = arrangeBodies(count, body_size, body_size, body_size);
+        options.body_contacts = true;
+
+        Simulator simulator(options);
+        int errorCode = simulator.init();
+        if (errorCode)
+            return errorCode;
+        // Long enough for the layers to land on each other
+        simulator.timeSteps(150);
+        double step = timeSimulator(simulator);
+
+        // The contact pass alone, from the state reached
+        CPUBackendConfig backend_config;
+        backend_config.threads = config.options.threads;
+        backend_config.body_contacts = true;
+        SimulationData data = simulator.getSimulationData();
+        data.positions = simulator.readPositions();
+        CPUBackend backend;
+        errorCode = backend.init(data, simulator.getPhysicsConfig(), backend_config);
+        if (errorCode)
+            return errorCode;
+        double pass = timeCalls([&]()
+        {
+            backend.collideBodies();
+        });
+
+        const ContactSurface &surface = backend.getContactSurface();
+        size_t points = surface.points.size();
+        printf("%6lu bodies  %8lu surface masses  %8lu triangles  %8.2f ns/point contacts  %6.2f pairs/point  %9.2f us per step on the %s backend\n",
+               count, points, surface.triangles.size(), pass / points * 1e9, (double)backend.getContactCandidates() / points, step * 1e6,
+               getBackendName(options.backend));
+    }
+
+    return 0;
+}
+
+static int benchmarkSweepAndPrune(const BenchmarkConfig &config)
+{
+    // Sizes are body counts, of 4^3 masses each, stepped on the CPU backend where the sweep runs
+    const size_t body_size = 4, steps = 50;
+    for (size_t count : getSizes(config, {10, 100, 1000, 10000}))
+    {
+        printf("%lu bodies:\n", count);
+        for (ContactBroadPhase broad_phase : {ContactBroadPhase::SpatialHash, ContactBroadPhase::SweepAndPrune})
+        {
+            SimulatorOptions options = config.options;
+            options.backend = Backend::CPU;
+            options.headless = true;
+            options.mass_order = MassOrder::Linear;
+            options.bodies = arrangeBodies(count, body_size, body_size, body_size);
+            options.body_contacts = true;
+            options.contact_broad_phase = broad_phase;
+
+            Simulator simulator(options);
+            int errorCode = simulator.init();
+            if (errorCode)
+                return errorCode;
+            // Long enough for the layers to land on each other
+            simulator.timeSteps(150);
+
+            const CPUBackend &backend = simulator.getCPUBackend();
+            double step = 0, broad = 0;
+            size_t swaps = 0, pairs = 0, candidates = 0;
+            for (size_t i = 0; i < steps; i++)
+            {
+                step += simulator.timeSteps(1);
+                broad += backend.getBroadPhaseTime();
+                swaps += backend.getSweepAndPrune().getSwapCount();
+                pairs += backend.getBodyPairs().size();
+                candidates += backend.getContactCandidates();
+            }
+
+            size_t points = backend.getContactSurface().points.size();
+            printf("  %-4s  %9.2f us broad phase  %8.2f ns/body  %8.2f body pairs  %8.2f swaps  %7.2f pairs/point  %9.2f us per step\n",
+                   getContactBroadPhaseName(broad_phase), broad / steps * 1e6, broad / steps / count * 1e9, (double)pairs / steps,
+                   (double)swaps / steps, (double)candidates / steps / points, step / steps * 1e6);
+        }
+    }
+
+    return 0;
+}
+
+static int benchmarkSelfCollisions(const BenchmarkConfig &config)
+{
+    // Dropped onto the sphere for long enough to drape over it, then stepped with and without self collisions. Any longer
+    // and the softest 64^3 lattice starts coming apart under explicit integration, self collisions or not.
+    const size_t settle = 150;
+    for (size_t size : getSizes(config, {16, 32, 64}))
+    {
+        SimulatorOptions options = getLatticeOptions(config, size);
+        Simulator plain(options);
+        int errorCode = plain.init();
+        if (errorCode)
+            return errorCode;
+        plain.timeSteps(settle);
+        double plain_step = timeSimulator(plain);
+
+        options.self_collisions = true;
+        Simulator simulator(options);
+        errorCode = simulator.init();
+        if (errorCode)
+            return errorCode;
+        simulator.timeSteps(settle);
+        double step = timeSimulator(simulator);
+
+        printf("%3lu^3  %8.2f ms per step  %8.2f ms without  %5.1f%% self collisions  %4u rebuilds", size, step * 1e3, plain_step * 1e3,
+               100 * (step - plain_step) / step, simulator.getBVHRebuilds());
+        if (options.backend == Backend::CPU)
+        {
+            const CPUBackend &backend = simulator.getCPUBackend();
+            SelfCollisionStats stats = backend.getSelfCollisionStats();
+            printf("  %6lu nodes  %2lu levels  %7.3f ms refit  %7.3f ms queries  %6.2f pairs/point", backend.getSurfaceBVH().nodes.size(),
+                   backend.getSurfaceBVH().level_offsets.size() - 1, stats.refit_time * 1e3, stats.query_time * 1e3,
+                   (double)stats.tested / backend.getContactSurface().points.size());
+        }
+        printf("\n");
+    }
+
+    return 0;
+}
+
+static int benchmarkFusedUpdate(const BenchmarkConfig &config)
+{
+    for (size_t size : getSizes(config, {32, 64, 128}))
+    {
+        printf("%lu^3 masses, %s backend, %s springs\n", size, getBackendName(config.options.backend), getSpringFormulationName(config.options.formulation));
+
+        double chained = 0;
+        for (bool fused : {false, true})
+        {
+            SimulatorOptions options = getLatticeOptions(config, size);
+            options.fused_update = fused;
+
+            Simulator simulator(options);
+            int errorCode = simulator.init();
+            if (errorCode)
+                return errorCode;
+
+            double seconds = timeSimulator(simulator);
+            if (!fused)
+                chained = seconds;
+            printf("  %-8s %9.3f ms/step  %5.2fx\n", fused ? "fused" : "chained", seconds * 1e3, chained / seconds);
+        }
+    }
+
+    return 0;
+}
+
+static int benchmarkTiledSprings(const BenchmarkConfig &config)
+{
+    const struct
+    {
+        const char *name;
+        SpringFormulation formulation;
+        bool tiled;
+        // Past this the spring buffers of the scatter pass take gigabytes
+        size_t max_size;
+    } variants[]{
+        {"scatter", SpringFormulation::Scatter, false, 128},
+        {"lattice", SpringFormulation::Lattice, false, SIZE_MAX},
+        {"tiled", SpringFormulation::Lattice, true, SIZE_MAX},
+    };
+
+    // Shared memory is for the GPU backend alone
+    BenchmarkConfig gpu_config = config;
+    gpu_config.options.backend = Backend::GPU;
+    for (size_t size : getSizes(config, {32, 64, 128, 256}))
+    {
+        printf("%lu^3 masses\n", size);
+
+        double lattice = 0;
+        for (const auto &variant : variants)
+        {
+            if (size > variant.max_size)
+                continue;
+
+            SimulatorOptions options = getLatticeOptions(gpu_config, size);
+            options.formulation = variant.formulation;
+            options.tiled_springs = variant.tiled;
+
+            Simulator simulator(options);
+            int errorCode = simulator.init();
+            if (errorCode)
+                return errorCode;
+
+            double seconds = timeSimulator(simulator);
+            if (variant.formulation == SpringFormulation::Lattice && !variant.tiled)
+                lattice = seconds;
+            printf("  %-8s %9.3f ms/step  %8.1f M masses/s", variant.name, seconds * 1e3, size * size * size / seconds * 1e-6);
+            if (variant.tiled)
+                printf("  %5.2fx lattice", lattice / seconds);
+            printf("\n");
+        }
+    }
+
+    return 0;
+}
+
+static int benchmarkPersistent(const BenchmarkConfig &config)
+{
+    // Sizes are body edges, every mass of which fits one workgroup's shared memory up to 16^3. Gathered springs for both,
+    // which the persistent pass reads.
+    BenchmarkConfig gpu_config = config;
+    gpu_config.options.backend = Backend::GPU;
+    gpu_config.options.formulation = SpringFormulation::Gather;
+    const size_t steps = 240;
+    for (size_t size : getSizes(config, {8, 12, 16}))
+    {
+        for (size_t count : {(size_t)1, (size_t)64})
+        {
+            printf("%lu bodies of %lu^3 masses\n", count, size);
+            for (unsigned substeps : {1u, 8u})
+            {
+                double chained = 0;
+                for (bool persistent : {false, true})
+                {
+                    SimulatorOptions options = getLatticeOptions(gpu_config, size);
+                    options.mass_order = MassOrder::Linear;
+                    if (count > 1)
+                        options.bodies = arrangeBodies(count, size, size, size);
+                    options.substeps = substeps;
+                    options.persistent = persistent;
+
+                    Simulator simulator(options);
+                    int errorCode = simulator.init();
+                    // Bodies past the driver's shared memory
+                    if (errorCode == -13)
+                        continue;
+                    if (errorCode)
+                        return errorCode;
+
+                    // The wall clock also counts the driver's cost of every dispatch, which the GPU timer does not
+                    simulator.timeSteps(substeps);
+                    auto start = std::chrono::steady_clock::now();
+                    double gpu = simulator.timeSteps(steps);
+                    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / steps;
+                    if (!persistent)
+                        chained = wall;
+                    printf("  %-10s %u substeps  %8.1f us/step GPU  %8.1f us/step wall  %5.2fx\n", persistent ? "persistent" : "chained",
+                           substeps, gpu * 1e6, wall * 1e6, chained / wall);
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int benchmarkLocalSize(const BenchmarkConfig &config)
+{
+    // The compute passes only exist on the GPU backend. 216^3 is 10M masses, past which the spring buffers of the
+    // scatter and gather passes would take gigabytes, so the default scatter springs give way to the lattice ones.
+    BenchmarkConfig gpu_config = config;
+    gpu_config.options.backend = Backend::GPU;
+    if (gpu_config.options.formulation == SpringFormulation::Scatter)
+        gpu_config.options.formulation = SpringFormulation::Lattice;
+    bool renderer_printed = false;
+    for (size_t size : getSizes(config, {64, 128, 216}))
+    {
+        if (usesSpringBuffer(gpu_config.options.formulation) && size > 128)
+        {
+            printf("%lu^3 masses skipped, %s springs take gigabytes\n", size, getSpringFormulationName(gpu_config.options.formulation));
+            continue;
+        }
+        printf("%lu^3 masses, %s springs\n", size, getSpringFormulationName(gpu_config.options.formulation));
+
+        double narrow = 0;
+        for (unsigned local_size : {1, 32, 64, 128, 256})
+        {
+            SimulatorOptions options = getLatticeOptions(gpu_config, size);
+            options.local_size = local_size;
+
+            Simulator simulator(options);
+            int errorCode = simulator.init();
+            if (errorCode)
+                return errorCode;
+            if (!renderer_printed)
+            {
+                printf("Renderer: %s\n", glGetString(GL_RENDERER));
+                renderer_printed = true;
+            }
+
+            double seconds = timeSimulator(simulator);
+            if (local_size == 1)
+                narrow = seconds;
+            printf("  local size %3u %9.3f ms/step  %5.2fx  %8.1f M masses/s\n", local_size, seconds * 1e3, narrow / seconds,
+                   size * size * size / seconds * 1e-6);
+        }
+    }
+
+    return 0;
+}
+
+static const struct
+{
+    const char *name;
+    const char *description;
+    int (*run)(const BenchmarkConfig &config);
+} benchmarks[]{
+    {"springs", "single-threaded spring force throughput per instruction set", benchmarkSpringKernels},
+    {"accumulation", "spring pass time for colored, atomic and per-thread force accumulation", benchmarkAccumulation},
+    {"compaction", "step time and spring memory of the scatter pass with and without null spring padding", benchmarkCompaction},
+    {"ordering", "step time and CPU cache misses with linear, Morton and Hilbert mass numbering", benchmarkOrdering},
+    {"timestep", "steps per simulated second and stability of fixed against adaptive dt", benchmarkTimestep},
+    {"formulation", "step time and spring memory of colored scatter, CSR gather and lattice stencil springs", benchmarkFormulation},
+    {"integrator", "wall time, stability, drift and spring stretch of Verlet against implicit and XPBD steps at 5-20x its dt", benchmarkIntegrator},
+    {"constraints", "spring stretch and residual per sweep of Gauss-Seidel, Jacobi and Chebyshev accelerated XPBD", benchmarkConstraints},
+    {"projective", "factor cost, wall time, drift and spring stretch of prefactored projective dynamics against Verlet", benchmarkProjective},
+    {"modal", "setup and step time of reduced order modal bodies against a full Verlet step", benchmarkModal},
+    {"shape", "cost per mass of lattice cluster shape matching against the scatter, gather and lattice spring passes", benchmarkShapeMatching},
+    {"bodies", "step time of one cube against the same masses split into many small bodies sharing buffers and dispatches", benchmarkBodies},
+    {"contacts", "cost per surface mass of the spatial hash contacts between bodies, from 10K to 1M surface masses", benchmarkContacts},
+    {"sap", "broad phase cost per step of the spatial hash against sweep and prune of the body bounds, from 10 to 10K bodies", benchmarkSweepAndPrune},
+    {"self", "step time of self collisions through a refit hierarchy of the surface triangles, from 16^3 to 64^3 masses", benchmarkSelfCollisions},
+    {"fused", "step time of the gravity, integrate, collide and correct passes chained against fused into one", benchmarkFusedUpdate},
+    {"tiled", "GPU step time of lattice springs summed from shared memory tiles against the scatter and lattice passes, 32^3 to 256^3", benchmarkTiledSprings},
+    {"persistent", "step time of chained passes against every substep of a frame in one dispatch, 1 and 64 bodies of 8^3 to 16^3", benchmarkPersistent},
+    {"local-size", "GPU step time and mass throughput per compute workgroup width, from 64^3 to 216^3 (10M) masses", benchmarkLocalSize},
+};
+
+int runBenchmark(const char *name, const BenchmarkConfig &config)
+{
+    for (const auto &benchmark : benchmarks)
+    {
+        if (!strcmp(benchmark.name, name))
+            return benchmark.run(config);
+    }
+
+    printf("Unknown benchmark: %s\n", name);
+    printBenchmarks();
+    return 1;
+}
+
+void printBenchmarks()
+{
+    printf("Benchmarks:\n");
+    for (const auto &benchmark : benchmarks)
+        printf("  %-12s %s\n", benchmark.name, benchmark.description);
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "simulator.hpp"
+
+#include <vector>
+
+typedef struct
+{
+    // Base options; the lattice size is replaced by each entry of sizes
+    SimulatorOptions options;
+    // Cube edge lengths to sweep, empty uses the benchmark's defaults
+    std::vector<size_t> sizes;
+} BenchmarkConfig;
+
+int runBenchmark(const char *name, const BenchmarkConfig &config);
+void printBenchmarks();
@@ -0,0 +1,214 @@
+#include "body_contacts.hpp"
+
+#include <algorithm>
+#include <atomic>
+
+const char *getContactBroadPhaseName(ContactBroadPhase broad_phase)
+{
+    switch (broad_phase)
+    {
+    case ContactBroadPhase::SpatialHash:
+        return "hash";
+    case ContactBroadPhase::SweepAndPrune:
+        return "sap";
+    default:
+        return "unknown";
+    }
+}
+
+int buildContactSurface(const SimulationData &data, const ContactConfig &config, ContactSurface &surface)
+{
+    if (!data.faces || !data.mass_bodies)
+        return -50;
+
+    surface.points.clear();
+    surface.triangles.clear();
+
+    // Center of every body at rest, to wind its triangles outwards
+    GLuint body_count = 0;
+    for (size_t i = 0; i < data.position_count; i++)
+        body_count = std::max(body_count, data.mass_bodies[i] + 1);
+    std::vector<glm::vec3> centers(body_count, glm::vec3(0.0f));
+    std::vector<size_t> counts(body_count, 0);
+    for (size_t i = 0; i < data.position_count; i++)
+    {
+        centers[data.mass_bodies[i]] += glm::vec3(data.positions[i]);
+        counts[data.mass_bodies[i]]++;
+    }
+    for (GLuint body = 0; body < body_count; body++)
+        centers[body] /= (float)std::max<size_t>(counts[body], 1);
+
+    std::vector<bool> on_surface(data.position_count, false);
+    float longest = 0;
+    for (size_t i = 0; i < data.face_count; i++)
+    {
+        Face face = data.faces[i];
+        GLuint body = data.mass_bodies[face.index1];
+        glm::vec3 a = data.positions[face.index1], b = data.positions[face.index2], c = data.positions[face.index3];
+        if (glm::dot(glm::cross(b - a, c - a), (a + b + c) / 3.0f - centers[body]) < 0)
+        {
+            std::swap(face.index2, face.index3);
+            std::swap(b, c);
+        }
+        surface.triangles.push_back(glm::uvec4(face.index1, face.index2, face.index3, body));
+
+        longest = std::max({longest, glm::distance(a, b), glm::distance(b, c), glm::distance(c, a)});
+        on_surface[face.index1] = on_surface[face.index2] = on_surface[face.index3] = true;
+    }
+
+    for (size_t i = 0; i < data.position_count; i++)
+    {
+        if (on_surface[i])
+            surface.points.push_back(glm::uvec2(i, data.mass_bodies[i]));
+    }
+
+    surface.point_offsets.assign(body_count + 1, 0);
+    surface.triangle_offsets.assign(body_count + 1, 0);
+    for (const glm::uvec2 &point : surface.points)
+        surface.point_offsets[point.y + 1]++;
+    for (const glm::uvec4 &triangle : surface.triangles)
+        surface.triangle_offsets[triangle.w + 1]++;
+    for (GLuint body = 0; body < body_count; body++)
+    {
+        surface.point_offsets[body + 1] += surface.point_offsets[body];
+        surface.triangle_offsets[body + 1] += surface.triangle_offsets[body];
+    }
+
+    surface.edge_length = longest;
+    surface.cell_size = config.cell_scale * longest;
+    surface.max_depth = config.max_depth * longest;
+    // Roughly one entry per cell, with every triangle in up to 8
+    surface.table_size = contact_scan_width;
+    while (surface.table_size < surface.triangles.size() * 8)
+        surface.table_size *= 2;
+    surface.capacity = surface.triangles.size() * 8;
+
+    return 0;
+}
+
+// Cells the triangle's bounds touch, at most 2 along each axis however far it has been stretched
+static void getTriangleCells(const ContactSurface &surface, const glm::uvec4 &triangle, const glm::vec4 *positions, glm::ivec3 &first, glm::ivec3 &last)
+{
+    glm::vec3 a = positions[triangle.x], b = positions[triangle.y], c = positions[triangle.z];
+    first = getContactCell(glm::min(glm::min(a, b), c) - surface.max_depth, surface.cell_size);
+    last = glm::min(getContactCell(glm::max(glm::max(a, b), c) + surface.max_depth, surface.cell_size), first + 1);
+}
+
+void countContactCells(const ContactSurface &surface, size_t begin, size_t end, const glm::vec4 *positions, GLuint *counts)
+{
+    for (size_t t = begin; t < end; t++)
+    {
+        glm::ivec3 first, last;
+        getTriangleCells(surface, surface.triangles[t], positions, first, last);
+        for (int z = first.z; z <= last.z; z++)
+            for (int y = first.y; y <= last.y; y++)
+                for (int x = first.x; x <= last.x; x++)
+                    std::atomic_ref<GLuint>(counts[hashContactCell(glm::ivec3(x, y, z), surface.table_size)]).fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void fillContactCells(const ContactSurface &surface, size_t begin, size_t end, const glm::vec4 *positions, const GLuint *starts,
+                      GLuint *counts, GLuint *entries)
+{
+    for (size_t t = begin; t < end; t++)
+    {
+        glm::ivec3 first, last;
+        getTriangleCells(surface, surface.triangles[t], positions, first, last);
+        for (int z = first.z; z <= last.z; z++)
+            for (int y = first.y; y <= last.y; y++)
+                for (int x = first.x; x <= last.x; x++)
+                {
+                    GLuint cell = hashContactCell(glm::ivec3(x, y, z), surface.table_size);
+                    entries[starts[cell] + std::atomic_ref<GLuint>(counts[cell]).fetch_add(1, std::memory_order_relaxed)] = t;
+                }
+    }
+}
+
+void testContactTriangle(const ContactSurface &surface, const PhysicsConfig &physics, const glm::vec3 &p, const glm::uvec4 &triangle,
+                         const glm::vec4 *positions, bool &found, float &best, glm::vec3 &best_normal)
+{
+    glm::vec3 a = positions[triangle.x], b = positions[triangle.y], c = positions[triangle.z];
+    glm::vec3 normal = glm::cross(b - a, c - a);
+    float area = glm::length(normal);
+    if (area == 0)
+        return;
+    normal /= area;
+
+    float dist = glm::dot(p - a, normal);
+    if (dist >= physics.collision_offset || dist < -surface.max_depth || (found && dist <= best))
+        return;
+
+    // Only through the triangle itself, not its plane
+    glm::vec3 q = p - normal * dist;
+    if (glm::dot(glm::cross(b - a, q - a), normal) < 0 || glm::dot(glm::cross(c - b, q - b), normal) < 0 ||
+        glm::dot(glm::cross(a - c, q - c), normal) < 0)
+        return;
+
+    found = true;
+    best = dist;
+    best_normal = normal;
+}
+
+size_t resolveContacts(const ContactSurface &surface, const PhysicsConfig &physics, size_t begin, size_t end, const glm::vec4 *positions,
+                       const GLuint *starts, const GLuint *entries, glm::vec4 *corrections)
+{
+    size_t tested = 0;
+    for (size_t i = begin; i < end; i++)
+    {
+        glm::uvec2 point = surface.points[i];
+        glm::vec3 p = positions[point.x];
+        GLuint cell = hashContactCell(getContactCell(p, surface.cell_size), surface.table_size);
+
+        // The triangle needing the smallest push, so a mass between two surfaces leaves through the nearer one
+        bool found = false;
+        float best = 0;
+        glm::vec3 best_normal(0.0f);
+        for (GLuint e = starts[cell]; e < starts[cell + 1]; e++)
+        {
+            glm::uvec4 triangle = surface.triangles[entries[e]];
+            if (triangle.w == point.y)
+                continue;
+            tested++;
+            testContactTriangle(surface, physics, p, triangle, positions, found, best, best_normal);
+        }
+
+        if (found)
+            corrections[point.x] += glm::vec4(best_normal * (physics.collision_offset - best), 0) * physics.collision_response;
+    }
+    return tested;
+}
+
+size_t resolveBodyContacts(const ContactSurface &surface, const PhysicsConfig &physics, size_t begin, size_t end, const GLuint *partner_offsets,
+                           const GLuint *partners, const glm::vec4 *bounds, const glm::vec4 *positions, glm::vec4 *corrections)
+{
+    size_t tested = 0;
+    for (size_t body = begin; body < end; body++)
+    {
+        if (partner_offsets[body] == partner_offsets[body + 1])
+            continue;
+
+        for (GLuint i = surface.point_offsets[body]; i < surface.point_offsets[body + 1]; i++)
+        {
+            GLuint mass = surface.points[i].x;
+            glm::vec3 p = positions[mass];
+
+            bool found = false;
+            float best = 0;
+            glm::vec3 best_normal(0.0f);
+            for (GLuint e = partner_offsets[body]; e < partner_offsets[body + 1]; e++)
+            {
+                GLuint other = partners[e];
+                if (glm::any(glm::lessThan(p, glm::vec3(bounds[other * 2]))) || glm::any(glm::greaterThan(p, glm::vec3(bounds[other * 2 + 1]))))
+                    continue;
+
+                tested += surface.triangle_offsets[other + 1] - surface.triangle_offsets[other];
+                for (GLuint t = surface.triangle_offsets[other]; t < surface.triangle_offsets[other + 1]; t++)
+                    testContactTriangle(surface, physics, p, surface.triangles[t], positions, found, best, best_normal);
+            }
+
+            if (found)
+                corrections[mass] += glm::vec4(best_normal * (physics.collision_offset - best), 0) * physics.collision_response;
+        }
+    }
+    return tested;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "includes.h"
+#include "constructs.h"
+
+#include <vector>
+
+// How the candidate triangles of every surface point are found
+enum class ContactBroadPhase
+{
+    // Triangles counted into a hashed uniform grid every step, on either backend
+    SpatialHash,
+    // Body bounds swept along x in the order of the last step, then every pair of overlapping bodies tested whole
+    // (CPU backend only)
+    SweepAndPrune
+};
+
+const char *getContactBroadPhaseName(ContactBroadPhase broad_phase);
+
+typedef struct
+{
+    // Grid cells are cell_scale times the longest surface edge at rest. At least 1 + 2 * max_depth, so that a triangle
+    // grown by max_depth covers at most 2 cells along each axis until it is stretched.
+    float cell_scale = 1.5f;
+    // Deepest a mass may sit behind another body's triangle and still be pushed back out through it, in longest edges
+    float max_depth = 0.25f;
+} ContactConfig;
+
+// Surface masses and triangles of every body, and the hashed uniform grid the triangles are sorted into every step
+typedef struct
+{
+    // x = mass, y = its body
+    std::vector<glm::uvec2> points;
+    // xyz = masses, wound so that their normal points out of the body at rest, w = their body
+    std::vector<glm::uvec4> triangles;
+    // Where the points and triangles of every body start, body count + 1 entries, as the bodies sit one after another
+    // in the shared buffers
+    std::vector<GLuint> point_offsets, triangle_offsets;
+    // Longest surface edge at rest
+    float edge_length = 0;
+    float cell_size = 0;
+    float max_depth = 0;
+    // Cells of the hash table, a power of two and a multiple of contact_scan_width
+    GLuint table_size = 0;
+    // Grid entries at most, 8 per triangle
+    size_t capacity = 0;
+} ContactSurface;
+
+// Workgroup size of contact_scan.comp, the prefix sum over the hash table
+const GLuint contact_scan_width = 256;
+
+// Returns -50 if data has no surface faces or body of every mass
+int buildContactSurface(const SimulationData &data, const ContactConfig &config, ContactSurface &surface);
+
+inline glm::ivec3 getContactCell(const glm::vec3 &position, float cell_size)
+{
+    return glm::ivec3(glm::floor(position / cell_size));
+}
+
+inline GLuint hashContactCell(const glm::ivec3 &cell, GLuint table_size)
+{
+    return ((GLuint)cell.x * 73856093u ^ (GLuint)cell.y * 19349663u ^ (GLuint)cell.z * 83492791u) & (table_size - 1);
+}
+
+// Broad phase, first pass: counts the triangles [begin, end) into every hashed cell their bounds, grown by max_depth,
+// touch. Atomic on counts, so any split of the triangles can run concurrently.
+void countContactCells(const ContactSurface &surface, size_t begin, size_t end, const glm::vec4 *positions, GLuint *counts);
+
+// Second pass, once starts holds the exclusive prefix sum of counts (table_size + 1 entries) and counts is zeroed again:
+// writes the triangles [begin, end) into entries, cell after cell
+void fillContactCells(const ContactSurface &surface, size_t begin, size_t end, const glm::vec4 *positions, const GLuint *starts,
+                      GLuint *counts, GLuint *entries);
+
+// Keeps triangle in best_normal and best if p sits behind it, less than max_depth deep, and shallower than the one found so far
+void testContactTriangle(const ContactSurface &surface, const PhysicsConfig &physics, const glm::vec3 &p, const glm::uvec4 &triangle,
+                         const glm::vec4 *positions, bool &found, float &best, glm::vec3 &best_normal);
+
+// Narrow phase: every surface point in [begin, end) looks through the triangles of its own cell, and is pushed out of
+// the nearest one of another body it sits behind, into corrections. Returns the point-triangle pairs tested.
+size_t resolveContacts(const ContactSurface &surface, const PhysicsConfig &physics, size_t begin, size_t end, const glm::vec4 *positions,
+                       const GLuint *starts, const GLuint *entries, glm::vec4 *corrections);
+
+// Narrow phase after a sweep and prune of the body bounds (2 per body, grown by max_depth): every surface point of the
+// bodies [begin, end) is tested against the triangles of each body in partners[partner_offsets[body]] onwards whose
+// bounds hold it, and pushed out as resolveContacts() does. Returns the point-triangle pairs tested.
+size_t resolveBodyContacts(const ContactSurface &surface, const PhysicsConfig &physics, size_t begin, size_t end, const GLuint *partner_offsets,
+                           const GLuint *partners, const glm::vec4 *bounds, const glm::vec4 *positions, glm::vec4 *corrections);
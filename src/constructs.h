@@ -21,3 +21,53 @@ typedef struct  {
     GLuint index2;
     GLuint index3;
 } Face;
+
+typedef struct
+{
+    // Shared by the compute shaders (through the loadShaders() prelude) and the CPU backend
+    float delta_t = 1 / 200.0f;
+    float mass = 1 / 8.0f;
+    float damping = 0.995f;
+    float gravity = -9.81f;
+    // Indexed by Spring::type
+    float stiffness[4]{0.0f, 800.0f * 1.5f, 800.0f * 1.5f, 200.0f * 1.5f};
+    float collision_offset = 0.001f;
+    float collision_response = 1.15f;
+    // Fraction of the way to its goal position every mass is pulled each step by SpringFormulation::ShapeMatching
+    float shape_stiffness = 0.5f;
+} PhysicsConfig;
+
+typedef struct
+{
+    // Masses along each axis, indexed x-major like Simulator::getPositionIndex()
+    GLuint masses_x = 0, masses_y = 0, masses_z = 0;
+    // Rest length of every lattice_stencil entry
+    GLfloat rest_lengths[12]{};
+    // Springs along each edge of a shape matching cluster, see getShapeClusterCounts()
+    GLuint cluster_length = 4;
+    // Rotation updates per cluster and step; starting from the last step's rotation, a few are enough to follow it
+    GLuint shape_iterations = 4;
+} LatticeConfig;
+
+typedef struct
+{
+    const glm::vec4 *positions;
+    size_t position_count;
+    const Spring *springs;
+    size_t spring_count;
+    // springs are grouped as block_count blocks * 8 colors: group g = block * 8 + color is
+    // springs[spring_groups[g]] to springs[spring_groups[g + 1]]
+    const GLuint *spring_groups;
+    size_t block_count;
+    const glm::vec4 *planes;
+    size_t planes_count;
+    const glm::vec4 *spheres;
+    size_t spheres_count;
+    // Cube topology for SpringFormulation::Lattice and ShapeMatching, which need no springs
+    LatticeConfig lattice;
+    // Surface triangles over the masses (not the rendered vertex copies) and the body every mass belongs to,
+    // for contacts between bodies
+    const Face *faces = nullptr;
+    size_t face_count = 0;
+    const GLuint *mass_bodies = nullptr;
+} SimulationData;
@@ -0,0 +1,1128 @@
+#include "cpu_backend.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <float.h>
+
+// Masses per parallelFor chunk, small enough to balance and large enough to amortize the dispatch
+static const size_t mass_grain = 1024;
+// Nodes per chunk of a refit level
+static const size_t bvh_grain = 256;
+// Packets of surface points per chunk of the queries walking the tree
+static const size_t packet_grain = 64;
+
+// Lower corners at +max and upper ones at -max, for the first position of every body to replace
+static void clearBodyBounds(std::vector<glm::vec4> &bounds)
+{
+    for (size_t i = 0; i < bounds.size(); i += 2)
+    {
+        bounds[i] = glm::vec4(FLT_MAX);
+        bounds[i + 1] = glm::vec4(-FLT_MAX);
+    }
+}
+
+// Bounds of the body a run of consecutive masses belongs to, merged into a thread's bounds whenever the body changes
+struct BodyBoundsRun
+{
+    GLuint body = ~0u;
+    glm::vec4 lower, upper;
+
+    void add(GLuint mass_body, const glm::vec4 &position, glm::vec4 *bounds)
+    {
+        if (mass_body == body)
+        {
+            lower = glm::min(lower, position);
+            upper = glm::max(upper, position);
+            return;
+        }
+        flush(bounds);
+        body = mass_body;
+        lower = upper = position;
+    }
+
+    void flush(glm::vec4 *bounds)
+    {
+        if (body == ~0u)
+            return;
+        bounds[body * 2] = glm::min(bounds[body * 2], lower);
+        bounds[body * 2 + 1] = glm::max(bounds[body * 2 + 1], upper);
+    }
+};
+
+const char *getSpringAccumulationName(SpringAccumulation accumulation)
+{
+    switch (accumulation)
+    {
+    case SpringAccumulation::Colored:
+        return "colored";
+    case SpringAccumulation::Atomic:
+        return "atomic";
+    case SpringAccumulation::PerThread:
+        return "reduce";
+    default:
+        return "unknown";
+    }
+}
+
+CPUBackend::CPUBackend() {}
+
+CPUBackend::~CPUBackend() {}
+
+int CPUBackend::init(const SimulationData &data, const PhysicsConfig &physics, const CPUBackendConfig &config)
+{
+    // The lattice formulations derive everything from the cube, the others need the spring buffer
+    if (!data.positions || (!data.springs && usesSpringBuffer(config.formulation)))
+        return -30;
+
+    if (config.integrator != Integrator::Verlet && !usesSpringBuffer(config.formulation))
+        return -33;
+
+    // The fused pass corrects each mass right after integrating it, before any contact pass could see it
+    if (config.fused_update && (config.integrator != Integrator::Verlet || config.body_contacts || config.self_collisions))
+        return -35;
+    fused_update = config.fused_update;
+
+    this->physics = physics;
+    delta_t = last_delta_t = physics.delta_t;
+    stats = StepStats{0, 0};
+    pool = std::make_unique<ThreadPool>(config.threads);
+    thread_stats.resize(pool->size());
+
+    positions.assign(data.positions, data.positions + data.position_count);
+    last_positions = positions;
+    forces.assign(data.position_count, glm::vec4(0.0f));
+    planes.assign(data.planes, data.planes + data.planes_count);
+    spheres.assign(data.spheres, data.spheres + data.spheres_count);
+
+    if (config.body_contacts || config.self_collisions)
+    {
+        int errorCode = buildContactSurface(data, ContactConfig(), contact_surface);
+        if (errorCode)
+            return errorCode;
+    }
+
+    self_collisions = config.self_collisions;
+    if (self_collisions)
+    {
+        self_collision = config.self_collision;
+        rest_positions = positions;
+        buildSurfaceBVH(contact_surface, physics, rest_positions.data(), positions.data(), self_collision.leaf_size,
+                        self_collision.exclusion * contact_surface.edge_length, surface_bvh);
+        self_stats = SelfCollisionStats();
+        thread_costs.resize(pool->size());
+    }
+
+    body_contacts = config.body_contacts;
+    if (body_contacts)
+    {
+        broad_phase = config.broad_phase;
+        if (broad_phase == ContactBroadPhase::SweepAndPrune)
+        {
+            size_t body_count = contact_surface.point_offsets.size() - 1;
+            mass_bodies.assign(data.mass_bodies, data.mass_bodies + data.position_count);
+            body_bounds.resize(body_count * 2);
+            thread_bounds.assign(pool->size(), std::vector<glm::vec4>(body_count * 2));
+            for (std::vector<glm::vec4> &bounds : thread_bounds)
+                clearBodyBounds(bounds);
+            sweep_prune.setISA(config.spring_isa);
+        }
+        else
+        {
+            contact_counts.assign(contact_surface.table_size, 0);
+            contact_starts.assign(contact_surface.table_size + 1, 0);
+            contact_entries.resize(contact_surface.capacity);
+        }
+    }
+
+    formulation = config.formulation;
+    if (!usesSpringBuffer(formulation))
+    {
+        lattice = data.lattice;
+        if ((size_t)lattice.masses_x * lattice.masses_y * lattice.masses_z != data.position_count)
+            return -32;
+
+        if (formulation == SpringFormulation::ShapeMatching)
+        {
+            GLuint counts[3];
+            shape_clusters.resize(getShapeClusterCounts(lattice, counts) * 2);
+            for (size_t c = 0; c < shape_clusters.size(); c += 2)
+            {
+                shape_clusters[c] = glm::vec4(0.0f);
+                shape_clusters[c + 1] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+            }
+        }
+        return 0;
+    }
+
+    spring_data.assign(data.springs, data.springs + data.spring_count);
+    block_count = data.block_count;
+    if (!data.spring_groups || data.spring_groups[block_count * 8] > spring_data.size())
+        return -31;
+
+    spring_groups.assign(data.spring_groups, data.spring_groups + block_count * 8 + 1);
+    // One block color's worth of springs per chunk in the uncolored passes
+    spring_grain = std::max<size_t>(spring_data.size() / (block_count * 8), 1);
+
+    // The gather pass, the implicit solve and Jacobi constraint sweeps all work on the incident springs of each mass
+    bool jacobi = config.integrator == Integrator::XPBD && config.xpbd.solver == ConstraintSolver::Jacobi;
+    if (formulation == SpringFormulation::Gather || config.integrator == Integrator::Implicit || jacobi)
+        buildSpringAdjacency(data.springs, data.spring_count, data.position_count, adjacency_offsets, adjacency);
+
+    integrator = config.integrator;
+    implicit = config.implicit;
+    if (integrator == Integrator::Implicit)
+    {
+        for (std::vector<glm::vec4> *vector : {&velocities, &delta_v, &residual, &preconditioned, &direction, &product, &inverse_diagonal})
+            vector->assign(data.position_count, glm::vec4(0.0f));
+        jacobian_aniso.resize(adjacency.size());
+        jacobian_iso.resize(adjacency.size());
+        thread_sums.resize(pool->size());
+    }
+
+    // XPBD projects the springs in the same colored layout whatever the formulation
+    xpbd = config.xpbd;
+    if (jacobi)
+    {
+        for (std::vector<float> *vector : {&lambdas, &next_lambdas, &previous_lambdas})
+            vector->assign(adjacency.size(), 0.0f);
+        next_positions.assign(data.position_count, glm::vec4(0.0f));
+        previous_positions.assign(data.position_count, glm::vec4(0.0f));
+        thread_sums.resize(pool->size());
+    }
+    else if (integrator == Integrator::XPBD)
+        lambdas.assign(spring_data.size(), 0.0f);
+
+    projective = config.projective;
+    if (integrator == Integrator::Projective)
+    {
+        predictions.resize(data.position_count);
+        projections.resize(data.position_count);
+        int errorCode = factorProjective(delta_t);
+        if (errorCode)
+            return errorCode;
+    }
+
+    if (formulation == SpringFormulation::Gather)
+        return 0;
+
+    spring_isa = resolveSpringISA(config.spring_isa);
+    if (spring_isa != SpringISA::Reference)
+    {
+        buildSpringsSoA(data.springs, data.spring_count, physics, springs_soa);
+        x.resize(data.position_count);
+        y.resize(data.position_count);
+        z.resize(data.position_count);
+    }
+
+    accumulation = config.accumulation;
+    if (accumulation == SpringAccumulation::PerThread)
+        thread_forces.assign(pool->size(), std::vector<glm::vec4>(data.position_count, glm::vec4(0.0f)));
+
+    return 0;
+}
+
+void CPUBackend::step()
+{
+    if (fused_update)
+    {
+        springs();
+        updateMasses();
+        return;
+    }
+
+    gravity();
+    if (integrator == Integrator::XPBD || integrator == Integrator::Projective)
+    {
+        // Predict from gravity alone, then pull the prediction back onto the springs
+        integrate();
+        if (integrator == Integrator::Projective)
+            projectiveDynamics();
+        else
+            constrain();
+    }
+    else
+    {
+        springs();
+        if (integrator == Integrator::Implicit)
+            integrateImplicit();
+        else
+            integrate();
+    }
+    collide();
+    if (body_contacts)
+        collideBodies();
+    if (self_collisions)
+        collideSelf();
+    correct();
+}
+
+void CPUBackend::setDeltaT(float delta_t)
+{
+    this->delta_t = delta_t;
+}
+
+void CPUBackend::collectStepStats()
+{
+    collect_stats = true;
+}
+
+StepStats CPUBackend::getStepStats() const
+{
+    return stats;
+}
+
+unsigned CPUBackend::getSolverIterations() const
+{
+    return solver_iterations;
+}
+
+void CPUBackend::setConstraintIterations(unsigned iterations)
+{
+    xpbd.iterations = iterations;
+    projective.iterations = iterations;
+}
+
+const std::vector<float> &CPUBackend::getConstraintResiduals() const
+{
+    return constraint_residuals;
+}
+
+const SparseCholesky &CPUBackend::getProjectiveSystem() const
+{
+    return projective_system;
+}
+
+double CPUBackend::getFactorTime() const
+{
+    return factor_time;
+}
+
+const glm::vec4 *CPUBackend::getPositions() const
+{
+    return positions.data();
+}
+
+const glm::vec4 *CPUBackend::getLastPositions() const
+{
+    return last_positions.data();
+}
+
+size_t CPUBackend::getPositionCount() const
+{
+    return positions.size();
+}
+
+unsigned CPUBackend::getThreadCount() const
+{
+    return pool ? pool->size() : 0;
+}
+
+SpringISA CPUBackend::getSpringISA() const
+{
+    return spring_isa;
+}
+
+SpringAccumulation CPUBackend::getSpringAccumulation() const
+{
+    return accumulation;
+}
+
+SpringFormulation CPUBackend::getSpringFormulation() const
+{
+    return formulation;
+}
+
+void CPUBackend::gravity()
+{
+    glm::vec4 weight = glm::vec4(0, physics.gravity, 0, 0) * physics.mass;
+    pool->parallelFor(positions.size(), [&](size_t begin, size_t end, unsigned)
+    {
+        for (size_t i = begin; i < end; i++)
+            forces[i] += weight;
+    }, mass_grain);
+}
+
+void CPUBackend::springs()
+{
+    if (formulation == SpringFormulation::Gather)
+    {
+        springsGather();
+        return;
+    }
+    if (formulation == SpringFormulation::Lattice)
+    {
+        springsLattice();
+        return;
+    }
+    if (formulation == SpringFormulation::ShapeMatching)
+    {
+        springsShapeMatching();
+        return;
+    }
+
+    switch (accumulation)
+    {
+    case SpringAccumulation::Atomic:
+        springsAtomic();
+        break;
+    case SpringAccumulation::PerThread:
+        springsPerThread();
+        break;
+    default:
+        springsColored();
+        break;
+    }
+}
+
+void CPUBackend::springsColored()
+{
+    if (spring_isa != SpringISA::Reference)
+        loadPositionsSoA();
+
+    // Same coloring as the 8 springs.comp dispatches: no two blocks touch the same mass within a color,
+    // so threads add straight into forces
+    for (size_t block_id = 0; block_id < 8; block_id++)
+    {
+        pool->parallelFor(block_count, [&](size_t begin, size_t end, unsigned)
+        {
+            for (size_t block = begin; block < end; block++)
+                addSpringForces(spring_groups[block * 8 + block_id], spring_groups[block * 8 + block_id + 1], forces.data());
+        });
+    }
+}
+
+void CPUBackend::springsAtomic()
+{
+    // Scalar only, the SIMD kernels have no atomic scatter
+    pool->parallelFor(spring_data.size(), [&](size_t begin, size_t end, unsigned)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            const Spring &spring = spring_data[i];
+            if (spring.type == 0)
+                continue;
+
+            glm::vec4 force = positions[spring.point2] - positions[spring.point1];
+            force *= (1 - spring.len / glm::length(force)) * physics.stiffness[spring.type];
+
+            for (int j = 0; j < 3; j++)
+            {
+                std::atomic_ref<float>(forces[spring.point1][j]).fetch_add(force[j], std::memory_order_relaxed);
+                std::atomic_ref<float>(forces[spring.point2][j]).fetch_sub(force[j], std::memory_order_relaxed);
+            }
+        }
+    }, spring_grain);
+}
+
+void CPUBackend::springsPerThread()
+{
+    if (spring_isa != SpringISA::Reference)
+        loadPositionsSoA();
+
+    pool->parallelFor(spring_data.size(), [&](size_t begin, size_t end, unsigned thread)
+    {
+        addSpringForces(begin, end, thread_forces[thread].data());
+    }, spring_grain);
+
+    pool->parallelFor(positions.size(), [&](size_t begin, size_t end, unsigned)
+    {
+        for (std::vector<glm::vec4> &buffer : thread_forces)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                forces[i] += buffer[i];
+                buffer[i] = glm::vec4(0.0f);
+            }
+        }
+    }, mass_grain);
+}
+
+void CPUBackend::springsGather()
+{
+    // Every mass writes only its own force, so one pass with no coloring
+    pool->parallelFor(positions.size(), [&](size_t begin, size_t end, unsigned)
+    {
+        computeSpringForcesGather(adjacency_offsets.data(), adjacency.data(), begin, end, physics, positions.data(), forces.data());
+    }, mass_grain);
+}
+
+void CPUBackend::springsLattice()
+{
+    pool->parallelFor(positions.size(), [&](size_t begin, size_t end, unsigned)
+    {
+        computeSpringForcesLattice(lattice, begin, end, physics, positions.data(), forces.data());
+    }, mass_grain);
+}
+
+void CPUBackend::springsShapeMatching()
+{
+    // Clusters share masses, so their rotations are found first and every mass then gathers its own goals
+    pool->parallelFor(shape_clusters.size() / 2, [&](size_t begin, size_t end, unsigned)
+    {
+        matchShapeClusters(lattice, begin, end, positions.data(), shape_clusters.data());
+    });
+
+    // Pulled towards the goal through the same integrate() as the spring forces, under its force scale
+    float velocity_scale, force_scale;
+    getVerletScales(physics, delta_t, last_delta_t, velocity_scale, force_scale);
+    pool->parallelFor(positions.size(), [&](size_t begin, size_t end, unsigned)
+    {
+        computeShapeMatchingForces(lattice, begin, end, physics, force_scale, positions.data(), shape_clusters.data(), forces.data());
+    }, mass_grain);
+}
+
+void CPUBackend::loadPositionsSoA()
+{
+    pool->parallelFor(positions.size(), [&](size_t begin, size_t end, unsigned)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            x[i] = positions[i].x;
+            y[i] = positions[i].y;
+            z[i] = positions[i].z;
+        }
+    }, mass_grain);
+}
+
+void CPUBackend::addSpringForces(size_t begin, size_t end, glm::vec4 *target)
+{
+    if (spring_isa == SpringISA::Reference)
+        computeSpringForces(spring_data.data(), begin, end, physics, positions.data(), target);
+    else
+        computeSpringForces(spring_isa, springs_soa, begin, end, x.data(), y.data(), z.data(), target);
+}
+
+void CPUBackend::integrate()
+{
+    float velocity_scale, force_scale;
+    getVerletScales(physics, delta_t, last_delta_t, velocity_scale, force_scale);
+    float scale = force_scale / physics.mass;
+
+    if (collect_stats)
+        std::fill(thread_stats.begin(), thread_stats.end(), StepStats{0, 0});
+
+    // The contacts between bodies need their bounds, which come almost for free with the final positions of the step
+    bool gather_bounds = !thread_bounds.empty() && integrator == Integrator::Verlet;
+
+    pool->parallelFor(positions.size(), [&](size_t begin, size_t end, unsigned thread)
+    {
+        BodyBoundsRun run;
+        for (size_t i = begin; i < end; i++)
+        {
+            glm::vec4 pos = positions[i];
+            if (collect_stats)
+            {
+                thread_stats[thread].max_speed = std::max(thread_stats[thread].max_speed, glm::length(pos - last_positions[i]) / last_delta_t);
+                thread_stats[thread].max_acceleration = std::max(thread_stats[thread].max_acceleration, glm::length(forces[i]) / physics.mass);
+            }
+            positions[i] += velocity_scale * (pos - last_positions[i]) + forces[i] * scale;
+            last_positions[i] = pos;
+            forces[i] = glm::vec4(0.0f);
+            if (gather_bounds)
+                run.add(mass_bodies[i], positions[i], thread_bounds[thread].data());
+        }
+        if (gather_bounds)
+            run.flush(thread_bounds[thread].data());
+    }, mass_grain);
+    bounds_gathered = gather_bounds;
+
+    reduceStepStats();
+    last_delta_t = delta_t;
+}
+
+void CPUBackend::reduceStepStats()
+{
+    if (!collect_stats)
+        return;
+
+    stats = StepStats{0, 0};
+    for (const StepStats &thread : thread_stats)
+    {
+        stats.max_speed = std::max(stats.max_speed, thread.max_speed);
+        stats.max_acceleration = std::max(stats.max_acceleration, thread.max_acceleration);
+    }
+    collect_stats = false;
+}
+
+void CPUBackend::integrateImplicit()
+{
+    // Backward Euler linearized at the current state:
+    // (M - h^2 J) dv = h f + h^2 J v, v' = v + dv, x' = x + h v'
+    // with J the spring force Jacobian and M = mass * I. With A = M - h^2 J the right hand side is h f + M v - A v.
+    float h = delta_t;
+    float mass = physics.mass;
+
+    pool->parallelFor(positions.size(), [&](size_t begin, size_t end, unsigned)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            velocities[i] = (positions[i] - last_positions[i]) / last_delta_t;
+
+            glm::vec4 diagonal = glm::vec4(mass, mass, mass, 1.0f);
+            for (GLuint j = adjacency_offsets[i]; j < adjacency_offsets[i + 1]; j++)
+            {
+                glm::vec3 d = glm::vec3(positions[adjacency[j].point2] - positions[i]);
+                float length = std::max(glm::length(d), 1e-12f);
+                float k = physics.stiffness[adjacency[j].type];
+                // Compressed springs would make the transverse stiffness negative and the system indefinite
+                float iso = k * std::max(1 - adjacency[j].len / length, 0.0f);
+                jacobian_iso[j] = iso;
+                jacobian_aniso[j] = glm::vec4(d, (k - iso) / (length * length));
+                diagonal += h * h * glm::vec4(iso + jacobian_aniso[j].w * d * d, 0.0f);
+            }
+            inverse_diagonal[i] = 1.0f / diagonal;
+        }
+    }, mass_grain);
+
+    applySystem(velocities.data(), product.data(), h);
+    pool->parallelFor(positions.size(), [&](size_t begin, size_t end, unsigned)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            residual[i] = h * forces[i] + mass * velocities[i] - product[i];
+            residual[i].w = 0;
+            delta_v[i] = glm::vec4(0.0f);
+            preconditioned[i] = residual[i] * inverse_diagonal[i];
+            direction[i] = preconditioned[i];
+        }
+    }, mass_grain);
+
+    double rhs = dot(residual.data(), residual.data());
+    double rz = dot(residual.data(), preconditioned.data());
+    double threshold = (double)implicit.tolerance * implicit.tolerance * rhs;
+    for (solver_iterations = 0; solver_iterations < implicit.max_iterations; solver_iterations++)
+    {
+        if (dot(residual.data(), residual.data()) <= threshold)
+            break;
+
+        applySystem(direction.data(), product.data(), h);
+        double curvature = dot(direction.data(), product.data());
+        if (curvature <= 0)
+            break;
+        float alpha = rz / curvature;
+
+        pool->parallelFor(positions.size(), [&](size_t begin, size_t end, unsigned)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                delta_v[i] += alpha * direction[i];
+                residual[i] -= alpha * product[i];
+                preconditioned[i] = residual[i] * inverse_diagonal[i];
+            }
+        }, mass_grain);
+
+        double next_rz = dot(residual.data(), preconditioned.data());
+        float beta = next_rz / rz;
+        rz = next_rz;
+
+        pool->parallelFor(positions.size(), [&](size_t begin, size_t end, unsigned)
+        {
+            for (size_t i = begin; i < end; i++)
+                direction[i] = preconditioned[i] + beta * direction[i];
+        }, mass_grain);
+    }
+
+    float damping = getDamping(physics, h);
+    pool->parallelFor(positions.size(), [&](size_t begin, size_t end, unsigned)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            glm::vec4 pos = positions[i];
+            positions[i] += h * damping * (velocities[i] + delta_v[i]);
+            last_positions[i] = pos;
+            forces[i] = glm::vec4(0.0f);
+        }
+    }, mass_grain);
+    last_delta_t = delta_t;
+}
+
+void CPUBackend::applySystem(const glm::vec4 *p, glm::vec4 *result, float h)
+{
+    // (M - h^2 J) p, the Jacobian applied spring by spring without ever assembling it
+    float mass = physics.mass;
+    pool->parallelFor(positions.size(), [&](size_t begin, size_t end, unsigned)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            glm::vec3 sum = glm::vec3(0.0f);
+            for (GLuint j = adjacency_offsets[i]; j < adjacency_offsets[i + 1]; j++)
+            {
+                glm::vec3 difference = glm::vec3(p[i] - p[adjacency[j].point2]);
+                glm::vec3 axis = glm::vec3(jacobian_aniso[j]);
+                sum += jacobian_iso[j] * difference + jacobian_aniso[j].w * glm::dot(axis, difference) * axis;
+            }
+            result[i] = glm::vec4(mass * glm::vec3(p[i]) + h * h * sum, 0.0f);
+        }
+    }, mass_grain);
+}
+
+double CPUBackend::dot(const glm::vec4 *a, const glm::vec4 *b)
+{
+    std::fill(thread_sums.begin(), thread_sums.end(), 0.0);
+    pool->parallelFor(positions.size(), [&](size_t begin, size_t end, unsigned thread)
+    {
+        double sum = 0;
+        for (size_t i = begin; i < end; i++)
+            sum += glm::dot(glm::vec3(a[i]), glm::vec3(b[i]));
+        thread_sums[thread] += sum;
+    }, mass_grain);
+
+    double total = 0;
+    for (double sum : thread_sums)
+        total += sum;
+    return total;
+}
+
+void CPUBackend::constrain()
+{
+    if (xpbd.solver == ConstraintSolver::Jacobi)
+    {
+        constrainJacobi();
+        return;
+    }
+
+    // integrate() has set last_delta_t to the dt of this step
+    float h = last_delta_t;
+    std::fill(lambdas.begin(), lambdas.end(), 0.0f);
+
+    // Gauss-Seidel within a block, Jacobi between the blocks of a color, which share no masses
+    for (unsigned iteration = 0; iteration < xpbd.iterations; iteration++)
+    {
+        for (size_t block_id = 0; block_id < 8; block_id++)
+        {
+            pool->parallelFor(block_count, [&](size_t begin, size_t end, unsigned)
+            {
+                for (size_t block = begin; block < end; block++)
+                    projectSpringConstraints(spring_data.data(), spring_groups[block * 8 + block_id], spring_groups[block * 8 + block_id + 1], physics, h,
+                                             lambdas.data(), positions.data());
+            });
+        }
+    }
+}
+
+void CPUBackend::constrainJacobi()
+{
+    float h = last_delta_t;
+    float omega = 1;
+    constraint_residuals.assign(xpbd.iterations, 0.0f);
+    size_t spring_count = adjacency.size() / 2;
+
+    for (unsigned iteration = 0; iteration < xpbd.iterations; iteration++)
+    {
+        omega = getChebyshevOmega(xpbd, iteration, omega);
+
+        std::fill(thread_sums.begin(), thread_sums.end(), 0.0);
+        pool->parallelFor(positions.size(), [&](size_t begin, size_t end, unsigned thread)
+        {
+            thread_sums[thread] += projectSpringConstraintsJacobi(adjacency_offsets.data(), adjacency.data(), begin, end, physics, h, xpbd.relaxation,
+                                                                  iteration == 0, lambdas.data(), positions.data(), next_lambdas.data(), next_positions.data());
+
+            // x = omega * (x_jacobi - x_previous) + x_previous, for the multipliers too. Each mass owns its adjacency entries.
+            if (omega == 1)
+                return;
+            for (size_t i = begin; i < end; i++)
+            {
+                next_positions[i] = omega * (next_positions[i] - previous_positions[i]) + previous_positions[i];
+                for (GLuint j = adjacency_offsets[i]; j < adjacency_offsets[i + 1]; j++)
+                    next_lambdas[j] = omega * (next_lambdas[j] - previous_lambdas[j]) + previous_lambdas[j];
+            }
+        }, mass_grain);
+
+        double residual = 0;
+        for (double sum : thread_sums)
+            residual += sum;
+        constraint_residuals[iteration] = spring_count ? sqrt(residual / spring_count) : 0;
+
+        // previous <- current <- next
+        std::swap(previous_positions, positions);
+        std::swap(positions, next_positions);
+        std::swap(previous_lambdas, lambdas);
+        std::swap(lambdas, next_lambdas);
+    }
+}
+
+int CPUBackend::factorProjective(float h)
+{
+    auto start = std::chrono::steady_clock::now();
+    size_t n = positions.size();
+
+    // Lower triangle by column: the diagonal, then one entry per spring in the column of its lower mass.
+    // Springs between the same two masses simply repeat, the factorization sums them.
+    std::vector<GLuint> offsets(n + 1, 0);
+    for (size_t j = 0; j < n; j++)
+        offsets[j + 1] = 1;
+    for (const Spring &spring : spring_data)
+    {
+        if (spring.type != 0 && spring.point1 != spring.point2)
+            offsets[std::min(spring.point1, spring.point2) + 1]++;
+    }
+    for (size_t j = 0; j < n; j++)
+        offsets[j + 1] += offsets[j];
+
+    std::vector<GLuint> rows(offsets[n]), next(offsets.begin(), offsets.end() - 1);
+    std::vector<double> values(offsets[n], 0.0);
+    for (size_t j = 0; j < n; j++)
+    {
+        rows[next[j]] = j;
+        values[next[j]++] = physics.mass / ((double)h * h);
+    }
+    for (const Spring &spring : spring_data)
+    {
+        if (spring.type == 0 || spring.point1 == spring.point2)
+            continue;
+
+        double k = physics.stiffness[spring.type];
+        values[offsets[spring.point1]] += k;
+        values[offsets[spring.point2]] += k;
+        GLuint q = next[std::min(spring.point1, spring.point2)]++;
+        rows[q] = std::max(spring.point1, spring.point2);
+        values[q] = -k;
+    }
+
+    // Nested dissection on where the masses start out, the matrix itself never changes shape
+    std::vector<glm::vec3> coordinates(n);
+    for (size_t i = 0; i < n; i++)
+        coordinates[i] = glm::vec3(positions[i]);
+
+    if (projective_system.factor(n, offsets.data(), rows.data(), values.data(), coordinates.data()))
+        return -34;
+
+    factored_delta_t = h;
+    factor_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return 0;
+}
+
+void CPUBackend::projectiveDynamics()
+{
+    // integrate() has set last_delta_t to the dt of this step, which only changes the matrix's mass term
+    float h = last_delta_t;
+    if (h != factored_delta_t && factorProjective(h))
+        return;
+
+    double inertia = physics.mass / ((double)h * h);
+    std::copy(positions.begin(), positions.end(), predictions.begin());
+
+    for (unsigned iteration = 0; iteration < projective.iterations; iteration++)
+    {
+        pool->parallelFor(positions.size(), [&](size_t begin, size_t end, unsigned)
+        {
+            for (size_t i = begin; i < end; i++)
+                projections[i] = inertia * glm::dvec3(predictions[i]);
+        }, mass_grain);
+
+        // Local step, the blocks of a color share no masses
+        for (size_t block_id = 0; block_id < 8; block_id++)
+        {
+            pool->parallelFor(block_count, [&](size_t begin, size_t end, unsigned)
+            {
+                for (size_t block = begin; block < end; block++)
+                    projectSprings(spring_data.data(), spring_groups[block * 8 + block_id], spring_groups[block * 8 + block_id + 1], physics,
+                                   positions.data(), projections.data());
+            });
+        }
+
+        // Global step
+        projective_system.solve(projections.data());
+        pool->parallelFor(positions.size(), [&](size_t begin, size_t end, unsigned)
+        {
+            for (size_t i = begin; i < end; i++)
+                positions[i] = glm::vec4(glm::vec3(projections[i]), positions[i].w);
+        }, mass_grain);
+    }
+}
+
+void CPUBackend::collide()
+{
+    pool->parallelFor(positions.size(), [&](size_t begin, size_t end, unsigned)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            for (const glm::vec4 &plane : planes)
+            {
+                glm::vec3 normal = glm::vec3(plane);
+                glm::vec3 point = normal * plane.w;
+                float dist = glm::dot(normal, glm::vec3(positions[i]) - point);
+                dist += glm::sign(dist) * physics.collision_offset;
+                if (dist * glm::dot(normal, glm::vec3(last_positions[i]) - point) < 0.0f)
+                    forces[i] -= glm::vec4(normal * dist, 0) * physics.collision_response;
+            }
+
+            for (const glm::vec4 &sphere : spheres)
+            {
+                glm::vec3 pos = glm::vec3(positions[i]);
+                float dist = glm::distance(pos, glm::vec3(sphere));
+                if (dist < sphere.w)
+                    forces[i] += glm::vec4((sphere.w / dist - 1) * (pos - glm::vec3(sphere)), 0) * physics.collision_response;
+            }
+        }
+    }, mass_grain);
+}
+
+void CPUBackend::collideBodies()
+{
+    if (broad_phase == ContactBroadPhase::SweepAndPrune)
+        collideBodiesSwept();
+    else
+        collideBodiesHashed();
+}
+
+void CPUBackend::collideBodiesHashed()
+{
+    // Counting sort of the triangles into the hashed cells, as the contact_*.comp passes do it
+    auto start = std::chrono::steady_clock::now();
+    std::fill(contact_counts.begin(), contact_counts.end(), 0);
+    pool->parallelFor(contact_surface.triangles.size(), [&](size_t begin, size_t end, unsigned)
+    {
+        countContactCells(contact_surface, begin, end, positions.data(), contact_counts.data());
+    }, mass_grain);
+
+    GLuint sum = 0;
+    for (size_t cell = 0; cell < contact_counts.size(); cell++)
+    {
+        contact_starts[cell] = sum;
+        sum += contact_counts[cell];
+        contact_counts[cell] = 0;
+    }
+    contact_starts[contact_counts.size()] = sum;
+
+    pool->parallelFor(contact_surface.triangles.size(), [&](size_t begin, size_t end, unsigned)
+    {
+        fillContactCells(contact_surface, begin, end, positions.data(), contact_starts.data(), contact_counts.data(), contact_entries.data());
+    }, mass_grain);
+    broad_phase_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<size_t> tested(pool->size(), 0);
+    pool->parallelFor(contact_surface.points.size(), [&](size_t begin, size_t end, unsigned thread)
+    {
+        tested[thread] += resolveContacts(contact_surface, physics, begin, end, positions.data(), contact_starts.data(), contact_entries.data(), forces.data());
+    }, mass_grain);
+
+    contact_candidates = 0;
+    for (size_t count : tested)
+        contact_candidates += count;
+}
+
+void CPUBackend::gatherBodyBounds()
+{
+    pool->parallelFor(positions.size(), [&](size_t begin, size_t end, unsigned thread)
+    {
+        BodyBoundsRun run;
+        for (size_t i = begin; i < end; i++)
+            run.add(mass_bodies[i], positions[i], thread_bounds[thread].data());
+        run.flush(thread_bounds[thread].data());
+    }, mass_grain);
+}
+
+void CPUBackend::reduceBodyBounds()
+{
+    glm::vec4 margin(contact_surface.max_depth, contact_surface.max_depth, contact_surface.max_depth, 0);
+    pool->parallelFor(body_bounds.size() / 2, [&](size_t begin, size_t end, unsigned)
+    {
+        for (size_t body = begin; body < end; body++)
+        {
+            glm::vec4 lower(FLT_MAX), upper(-FLT_MAX);
+            for (std::vector<glm::vec4> &bounds : thread_bounds)
+            {
+                lower = glm::min(lower, bounds[body * 2]);
+                upper = glm::max(upper, bounds[body * 2 + 1]);
+                bounds[body * 2] = glm::vec4(FLT_MAX);
+                bounds[body * 2 + 1] = glm::vec4(-FLT_MAX);
+            }
+            body_bounds[body * 2] = lower - margin;
+            body_bounds[body * 2 + 1] = upper + margin;
+        }
+    }, mass_grain);
+}
+
+void CPUBackend::collideBodiesSwept()
+{
+    if (!bounds_gathered)
+        gatherBodyBounds();
+    bounds_gathered = false;
+
+    auto start = std::chrono::steady_clock::now();
+    reduceBodyBounds();
+    size_t body_count = body_bounds.size() / 2;
+    sweep_prune.update(body_bounds.data(), body_count, body_pairs);
+
+    partner_offsets.assign(body_count + 1, 0);
+    for (const glm::uvec2 &pair : body_pairs)
+    {
+        partner_offsets[pair.x + 1]++;
+        partner_offsets[pair.y + 1]++;
+    }
+    for (size_t body = 0; body < body_count; body++)
+        partner_offsets[body + 1] += partner_offsets[body];
+    partners.resize(partner_offsets[body_count]);
+    std::vector<GLuint> cursors(partner_offsets.begin(), partner_offsets.end() - 1);
+    for (const glm::uvec2 &pair : body_pairs)
+    {
+        partners[cursors[pair.x]++] = pair.y;
+        partners[cursors[pair.y]++] = pair.x;
+    }
+    broad_phase_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<size_t> tested(pool->size(), 0);
+    pool->parallelFor(body_count, [&](size_t begin, size_t end, unsigned thread)
+    {
+        tested[thread] += resolveBodyContacts(contact_surface, physics, begin, end, partner_offsets.data(), partners.data(), body_bounds.data(),
+                                              positions.data(), forces.data());
+    });
+
+    contact_candidates = 0;
+    for (size_t count : tested)
+        contact_candidates += count;
+}
+
+const ContactSurface &CPUBackend::getContactSurface() const
+{
+    return contact_surface;
+}
+
+size_t CPUBackend::getContactCandidates() const
+{
+    return contact_candidates;
+}
+
+ContactBroadPhase CPUBackend::getContactBroadPhase() const
+{
+    return broad_phase;
+}
+
+double CPUBackend::getBroadPhaseTime() const
+{
+    return broad_phase_time;
+}
+
+const std::vector<glm::uvec2> &CPUBackend::getBodyPairs() const
+{
+    return body_pairs;
+}
+
+const SweepAndPrune &CPUBackend::getSweepAndPrune() const
+{
+    return sweep_prune;
+}
+
+void CPUBackend::refitSurface()
+{
+    // Every level from its children below, deepest first
+    double cost = 0;
+    for (size_t level = surface_bvh.level_offsets.size() - 1; level-- > 0;)
+    {
+        std::fill(thread_costs.begin(), thread_costs.end(), 0.0);
+        size_t first = surface_bvh.level_offsets[level];
+        pool->parallelFor(surface_bvh.level_offsets[level + 1] - first, [&](size_t begin, size_t end, unsigned thread)
+        {
+            thread_costs[thread] += refitSurfaceBVH(contact_surface, first + begin, first + end, positions.data(), surface_bvh);
+        }, bvh_grain);
+        for (double partial : thread_costs)
+            cost += partial;
+    }
+
+    // Boxes that have grown loose overlap and make every query walk more of the tree
+    if (cost > self_collision.rebuild_ratio * surface_bvh.build_cost)
+    {
+        buildSurfaceBVH(contact_surface, physics, rest_positions.data(), positions.data(), self_collision.leaf_size,
+                        self_collision.exclusion * contact_surface.edge_length, surface_bvh);
+        self_stats.rebuilds++;
+    }
+}
+
+void CPUBackend::collideSelf()
+{
+    auto start = std::chrono::steady_clock::now();
+    refitSurface();
+    auto refit = std::chrono::steady_clock::now();
+
+    std::vector<size_t> tested(pool->size(), 0);
+    float exclusion = self_collision.exclusion * contact_surface.edge_length;
+    pool->parallelFor(getSurfaceBVHPackets(surface_bvh), [&](size_t begin, size_t end, unsigned thread)
+    {
+        tested[thread] += resolveSelfContacts(contact_surface, surface_bvh, physics, exclusion, begin, end, last_positions.data(), positions.data(),
+                                              forces.data());
+    }, packet_grain);
+
+    self_stats.refit_time = std::chrono::duration<double>(refit - start).count();
+    self_stats.query_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - refit).count();
+    self_stats.tested = 0;
+    for (size_t count : tested)
+        self_stats.tested += count;
+}
+
+const SurfaceBVH &CPUBackend::getSurfaceBVH() const
+{
+    return surface_bvh;
+}
+
+SelfCollisionStats CPUBackend::getSelfCollisionStats() const
+{
+    return self_stats;
+}
+
+void CPUBackend::updateMasses()
+{
+    // gravity(), integrate(), collide() and correct() with every mass loaded and stored once, as update_masses.comp does
+    float velocity_scale, force_scale;
+    getVerletScales(physics, delta_t, last_delta_t, velocity_scale, force_scale);
+    float scale = force_scale / physics.mass;
+    glm::vec4 weight = glm::vec4(0, physics.gravity, 0, 0) * physics.mass;
+
+    if (collect_stats)
+        std::fill(thread_stats.begin(), thread_stats.end(), StepStats{0, 0});
+
+    pool->parallelFor(positions.size(), [&](size_t begin, size_t end, unsigned thread)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            glm::vec4 pos = positions[i];
+            glm::vec4 last = last_positions[i];
+            glm::vec4 force = forces[i] + weight;
+            if (collect_stats)
+            {
+                thread_stats[thread].max_speed = std::max(thread_stats[thread].max_speed, glm::length(pos - last) / last_delta_t);
+                thread_stats[thread].max_acceleration = std::max(thread_stats[thread].max_acceleration, glm::length(force) / physics.mass);
+            }
+            glm::vec4 next = pos + velocity_scale * (pos - last) + force * scale;
+
+            glm::vec4 correction(0.0f);
+            for (const glm::vec4 &plane : planes)
+            {
+                glm::vec3 normal = glm::vec3(plane);
+                glm::vec3 point = normal * plane.w;
+                float dist = glm::dot(normal, glm::vec3(next) - point);
+                dist += glm::sign(dist) * physics.collision_offset;
+                if (dist * glm::dot(normal, glm::vec3(pos) - point) < 0.0f)
+                    correction -= glm::vec4(normal * dist, 0) * physics.collision_response;
+            }
+
+            for (const glm::vec4 &sphere : spheres)
+            {
+                float dist = glm::distance(glm::vec3(next), glm::vec3(sphere));
+                if (dist < sphere.w)
+                    correction += glm::vec4((sphere.w / dist - 1) * (glm::vec3(next) - glm::vec3(sphere)), 0) * physics.collision_response;
+            }
+
+            positions[i] = next + correction;
+            last_positions[i] = pos;
+            forces[i] = glm::vec4(0.0f);
+        }
+    }, mass_grain);
+
+    bounds_gathered = false;
+    reduceStepStats();
+    last_delta_t = delta_t;
+}
+
+void CPUBackend::correct()
+{
+    pool->parallelFor(positions.size(), [&](size_t begin, size_t end, unsigned)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            positions[i] += forces[i];
+            forces[i] = glm::vec4(0.0f);
+        }
+    }, mass_grain);
+}
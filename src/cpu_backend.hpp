@@ -0,0 +1,234 @@
+#pragma once
+
+#include "includes.h"
+#include "constructs.h"
+#include "body_contacts.hpp"
+#include "spring_kernels.hpp"
+#include "spring_layout.hpp"
+#include "sweep_prune.hpp"
+#include "sparse_cholesky.hpp"
+#include "surface_bvh.hpp"
+#include "thread_pool.hpp"
+#include "timestep.hpp"
+
+#include <memory>
+#include <vector>
+
+// How threads combine spring forces that land on the same mass
+enum class SpringAccumulation
+{
+    // The 8 block colors of springs.comp, one parallel pass each, plain adds
+    Colored,
+    // One pass over every spring with atomic float adds
+    Atomic,
+    // One pass into per-thread force buffers, summed afterwards
+    PerThread
+};
+
+const char *getSpringAccumulationName(SpringAccumulation accumulation);
+
+typedef struct
+{
+    // 0 uses every core
+    unsigned threads = 0;
+    SpringISA spring_isa = SpringISA::Auto;
+    SpringAccumulation accumulation = SpringAccumulation::Colored;
+    // Gather, Lattice and ShapeMatching ignore spring_isa and accumulation
+    SpringFormulation formulation = SpringFormulation::Scatter;
+    // Implicit, XPBD and Projective need the spring buffer, so not Lattice or ShapeMatching
+    Integrator integrator = Integrator::Verlet;
+    ImplicitConfig implicit;
+    XPBDConfig xpbd;
+    ProjectiveConfig projective;
+    // Push the surface masses of every body out of the others after collide()
+    bool body_contacts = false;
+    // SweepAndPrune tests the body bounds with spring_isa
+    ContactBroadPhase broad_phase = ContactBroadPhase::SpatialHash;
+    // Push the surface masses of every body out of its own surface where it folds over, after the contacts between bodies
+    bool self_collisions = false;
+    SelfCollisionConfig self_collision;
+    // gravity(), integrate(), collide() and correct() in one pass over the masses, for Verlet steps without contacts
+    bool fused_update = false;
+} CPUBackendConfig;
+
+// Runs the same passes as the compute shaders (gravity, springs x8, integrate, collide, contacts, self collisions, correct)
+// on the CPU, so a scene can be stepped without a GL context.
+class CPUBackend
+{
+public:
+    CPUBackend();
+    ~CPUBackend();
+
+    int init(const SimulationData &data, const PhysicsConfig &physics, const CPUBackendConfig &config);
+    void step();
+    // The spring pass alone, for benchmarks
+    void springs();
+    // The contacts between bodies alone, for benchmarks
+    void collideBodies();
+    const ContactSurface &getContactSurface() const;
+    // Point-triangle pairs the last contact pass tested
+    size_t getContactCandidates() const;
+    ContactBroadPhase getContactBroadPhase() const;
+    // Seconds the broad phase of the last contact pass took
+    double getBroadPhaseTime() const;
+    // Bodies whose bounds overlapped in the last sweep and prune, lower index first
+    const std::vector<glm::uvec2> &getBodyPairs() const;
+    const SweepAndPrune &getSweepAndPrune() const;
+    // Self collisions alone, for benchmarks
+    void collideSelf();
+    const SurfaceBVH &getSurfaceBVH() const;
+    SelfCollisionStats getSelfCollisionStats() const;
+    // dt of the following steps, PhysicsConfig::delta_t until set
+    void setDeltaT(float delta_t);
+    // Have the next step record its StepStats
+    void collectStepStats();
+    StepStats getStepStats() const;
+    // Conjugate gradient iterations of the last implicit step
+    unsigned getSolverIterations() const;
+    // Constraint sweeps of the following XPBD steps, or local/global iterations of projective ones
+    void setConstraintIterations(unsigned iterations);
+    // Root mean square constraint residual before every Jacobi sweep of the last XPBD step
+    const std::vector<float> &getConstraintResiduals() const;
+    // The projective dynamics system matrix and its factor, empty for the other integrators
+    const SparseCholesky &getProjectiveSystem() const;
+    // Seconds the last factorization of it took
+    double getFactorTime() const;
+
+    const glm::vec4 *getPositions() const;
+    // Positions before the last step
+    const glm::vec4 *getLastPositions() const;
+    size_t getPositionCount() const;
+    unsigned getThreadCount() const;
+    SpringISA getSpringISA() const;
+    SpringAccumulation getSpringAccumulation() const;
+    SpringFormulation getSpringFormulation() const;
+
+private:
+    void gravity();
+    void springsColored();
+    void springsAtomic();
+    void springsPerThread();
+    void springsGather();
+    void springsLattice();
+    void springsShapeMatching();
+    void loadPositionsSoA();
+    void addSpringForces(size_t begin, size_t end, glm::vec4 *target);
+    void integrate();
+    void integrateImplicit();
+    void applySystem(const glm::vec4 *p, glm::vec4 *result, float h);
+    double dot(const glm::vec4 *a, const glm::vec4 *b);
+    void constrain();
+    void constrainJacobi();
+    int factorProjective(float h);
+    void projectiveDynamics();
+    void collide();
+    void collideBodiesHashed();
+    void collideBodiesSwept();
+    void gatherBodyBounds();
+    void reduceBodyBounds();
+    void refitSurface();
+    void correct();
+    void updateMasses();
+    void reduceStepStats();
+
+    std::unique_ptr<ThreadPool> pool;
+    PhysicsConfig physics;
+    float delta_t = 0;
+    float last_delta_t = 0;
+    bool collect_stats = false;
+    bool fused_update = false;
+    StepStats stats;
+    // Per-thread maxima while collecting
+    std::vector<StepStats> thread_stats;
+
+    std::vector<glm::vec4> positions;
+    std::vector<glm::vec4> last_positions;
+    // Doubles as the corrections buffer, like binding 3 in the shaders
+    std::vector<glm::vec4> forces;
+    std::vector<Spring> spring_data;
+    std::vector<glm::vec4> planes;
+    std::vector<glm::vec4> spheres;
+
+    // Surface of every body and its hashed grid: cell counts, their prefix sums, and the triangles cell after cell
+    bool body_contacts = false;
+    ContactSurface contact_surface;
+    std::vector<GLuint> contact_counts, contact_starts, contact_entries;
+    size_t contact_candidates = 0;
+    ContactBroadPhase broad_phase = ContactBroadPhase::SpatialHash;
+    double broad_phase_time = 0;
+
+    // ContactBroadPhase::SweepAndPrune: body of every mass, the bounds of every body (lower and upper corner, grown by
+    // max_depth), and of the bodies each thread has seen so far. A Verlet integrate() gathers them from the positions
+    // it writes, the other integrators in a pass of their own.
+    std::vector<GLuint> mass_bodies;
+    std::vector<glm::vec4> body_bounds;
+    std::vector<std::vector<glm::vec4>> thread_bounds;
+    bool bounds_gathered = false;
+    SweepAndPrune sweep_prune;
+    std::vector<glm::uvec2> body_pairs;
+    // CSR lists of the bodies overlapping each one, both ways round
+    std::vector<GLuint> partner_offsets, partners;
+
+    // Self collisions: the hierarchy over the surface triangles, refit every step, and where every mass sat at rest
+    bool self_collisions = false;
+    SelfCollisionConfig self_collision;
+    SurfaceBVH surface_bvh;
+    std::vector<glm::vec4> rest_positions;
+    SelfCollisionStats self_stats;
+    // Partial box areas per thread while refitting
+    std::vector<double> thread_costs;
+
+    // SoA mirror of the spring pass for the SIMD kernels
+    SpringISA spring_isa = SpringISA::Reference;
+    SpringsSoA springs_soa;
+    std::vector<float> x, y, z;
+
+    SpringAccumulation accumulation = SpringAccumulation::Colored;
+    // One force buffer per thread for SpringAccumulation::PerThread
+    std::vector<std::vector<glm::vec4>> thread_forces;
+
+    SpringFormulation formulation = SpringFormulation::Scatter;
+    // CSR adjacency for SpringFormulation::Gather
+    std::vector<GLuint> adjacency_offsets;
+    std::vector<Spring> adjacency;
+    // Cube dimensions and rest lengths for SpringFormulation::Lattice and ShapeMatching
+    LatticeConfig lattice;
+    // Center and rotation of every shape matching cluster, see matchShapeClusters()
+    std::vector<glm::vec4> shape_clusters;
+
+    Integrator integrator = Integrator::Verlet;
+    ImplicitConfig implicit;
+    unsigned solver_iterations = 0;
+    // Conjugate gradient state, all per mass
+    std::vector<glm::vec4> velocities, delta_v, residual, preconditioned, direction, product;
+    // 1 / diagonal of the system matrix
+    std::vector<glm::vec4> inverse_diagonal;
+    // Force Jacobian of every adjacency entry, K = iso * I + aniso.w * aniso.xyz * aniso.xyz^T
+    std::vector<glm::vec4> jacobian_aniso;
+    std::vector<float> jacobian_iso;
+    // Partial dot products per thread
+    std::vector<double> thread_sums;
+
+    XPBDConfig xpbd;
+    // Lagrange multiplier of every spring over the current step
+    std::vector<float> lambdas;
+    // ConstraintSolver::Jacobi keeps them per adjacency entry instead, and the iterates
+    // before and after the current sweep for the Chebyshev update
+    std::vector<float> next_lambdas, previous_lambdas;
+    std::vector<glm::vec4> next_positions, previous_positions;
+    std::vector<float> constraint_residuals;
+
+    ProjectiveConfig projective;
+    // mass / h^2 * I + sum over springs of k (e_1 - e_2)(e_1 - e_2)^T, factored for the h it was built with
+    SparseCholesky projective_system;
+    float factored_delta_t = 0;
+    double factor_time = 0;
+    // The inertial prediction of the step, and the right hand side of the global step that becomes its solution
+    std::vector<glm::vec4> predictions;
+    std::vector<glm::dvec3> projections;
+
+    // Where every block color starts in spring_data
+    std::vector<GLuint> spring_groups;
+    size_t block_count = 0;
+    size_t spring_grain = 1;
+};
@@ -1,10 +1,313 @@
-#include "simulator.hpp"
+#include "autotune.hpp"
+#include "benchmark.hpp"
+
+#include <chrono>
+#include <string.h>
+
+static void printUsage(const char *name)
+{
+    printf("Usage: %s [options]\n"
+           "  --cpu             step on the multithreaded CPU backend\n"
+           "  --headless        no window or GL context (implies --cpu)\n"
+           "  --validate        step the CPU backend next to the GPU and report drift\n"
+           "  --steps N         exit after N steps\n"
+           "  --substeps N      simulation steps per rendered frame (default: 1)\n"
+           "  --real-time       step as often as keeps up with the wall clock, rendering between steps\n"
+           "  --rate HZ         simulation steps per simulated second (default: 200)\n"
+           "  --integrator NAME verlet (explicit), implicit (backward Euler, conjugate gradient)\n"
+           "                    xpbd (springs as compliant constraints)\n"
+           "                    projective (prefactored local/global projective dynamics, --cpu only)\n"
+           "                    or modal (rigid motion plus the lowest vibration modes) (default: verlet)\n"
+           "  --iterations N    constraint sweeps per xpbd step, local/global iterations per projective step (default: 10)\n"
+           "  --solver NAME     xpbd sweeps: gauss-seidel (8 colored passes) or jacobi (one pass) (default: gauss-seidel)\n"
+           "  --rho R           spectral radius estimate for Chebyshev accelerated jacobi sweeps, 0 for none (default: 0.95)\n"
+           "  --modes K         vibration modes of a modal body, at least 1 (default: 12)\n"
+           "  --adaptive        pick dt every frame from spring stiffness and mass motion\n"
+           "  --fused           gravity, integration, collisions and corrections in one pass over the masses (verlet, no contacts)\n"
+           "  --persistent      every substep of a frame in one dispatch, a workgroup per body (GPU verlet, fixed dt, no contacts)\n"
+           "  --sleep           stop stepping blocks of masses that have come to rest (GPU verlet only)\n"
+           "  --telemetry FILE  write dt and step statistics per frame as CSV (with --adaptive)\n"
+           "  --threads N       CPU worker threads (default: all cores)\n"
+           "  --local-size N    invocations per workgroup of the GPU compute passes (default: 64)\n"
+           "  --block-radius N  spring blocks of 2N masses on a side, N^3 * 12 springs per invocation and color (default: 2)\n"
+           "  --autotune        take the local size and block radius cached for this GPU, timing every pair first if there are none\n"
+           "  --size X Y Z      masses along each axis of the jello\n"
+           "  --bodies N        N smaller jellies of that size in one set of buffers (scatter or gather springs, linear order)\n"
+           "  --contacts        keep the jellies from passing through each other\n"
+           "  --self-collide    keep each jelly from passing through itself where it folds over\n"
+           "  --broad-phase NAME contact candidates: hash (grid of the triangles) or sap (sweep and prune of the bodies, --cpu only)\n"
+           "                    (default: hash)\n"
+           "  --isa NAME        CPU spring kernel: reference, scalar, sse4, avx2, avx512 (default: best available)\n"
+           "  --accumulate NAME how CPU threads combine spring forces: colored, atomic, reduce (default: colored)\n"
+           "  --springs NAME    spring pass: scatter (8 colored passes), gather (one pass per mass)\n"
+           "                    lattice (gather with springs derived from the cube, no spring buffers)\n"
+           "                    or shape-matching (no springs, blocks of the cube pulled back to their rest shape) (default: scatter)\n"
+           "  --order NAME      mass numbering: linear, morton, hilbert (default: linear)\n"
+           "  --tiled-springs   lattice springs summed from spring blocks of masses loaded into shared memory (GPU only)\n"
+           "  --padded-springs  keep the null springs padding every block color of the scatter pass\n"
+           "  --benchmark NAME  run a benchmark instead of the simulator\n"
+           "  --sizes N,N,...   cube sizes for --benchmark\n",
+           name);
+    printBenchmarks();
+}
+
+static int parseISA(const char *name, SpringISA &isa)
+{
+    for (int i = 0; i <= (int)SpringISA::Auto; i++)
+    {
+        if (!strcmp(name, getSpringISAName((SpringISA)i)))
+        {
+            isa = (SpringISA)i;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int parseAccumulation(const char *name, SpringAccumulation &accumulation)
+{
+    for (int i = 0; i <= (int)SpringAccumulation::PerThread; i++)
+    {
+        if (!strcmp(name, getSpringAccumulationName((SpringAccumulation)i)))
+        {
+            accumulation = (SpringAccumulation)i;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int parseFormulation(const char *name, SpringFormulation &formulation)
+{
+    for (int i = 0; i <= (int)SpringFormulation::ShapeMatching; i++)
+    {
+        if (!strcmp(name, getSpringFormulationName((SpringFormulation)i)))
+        {
+            formulation = (SpringFormulation)i;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int parseMassOrder(const char *name, MassOrder &order)
+{
+    for (int i = 0; i <= (int)MassOrder::Hilbert; i++)
+    {
+        if (!strcmp(name, getMassOrderName((MassOrder)i)))
+        {
+            order = (MassOrder)i;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int parseBroadPhase(const char *name, ContactBroadPhase &broad_phase)
+{
+    for (int i = 0; i <= (int)ContactBroadPhase::SweepAndPrune; i++)
+    {
+        if (!strcmp(name, getContactBroadPhaseName((ContactBroadPhase)i)))
+        {
+            broad_phase = (ContactBroadPhase)i;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int parseIntegrator(const char *name, Integrator &integrator)
+{
+    for (int i = 0; i <= (int)Integrator::Modal; i++)
+    {
+        if (!strcmp(name, getIntegratorName((Integrator)i)))
+        {
+            integrator = (Integrator)i;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int parseConstraintSolver(const char *name, ConstraintSolver &solver)
+{
+    for (int i = 0; i <= (int)ConstraintSolver::Jacobi; i++)
+    {
+        if (!strcmp(name, getConstraintSolverName((ConstraintSolver)i)))
+        {
+            solver = (ConstraintSolver)i;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void parseSizes(const char *list, std::vector<size_t> &sizes)
+{
+    char *end;
+    for (size_t size = strtoul(list, &end, 10); end != list; size = strtoul(list, &end, 10))
+    {
+        sizes.push_back(size);
+        list = *end == ',' ? end + 1 : end;
+    }
+}
+
+static int parseOptions(int argc, const char **argv, SimulatorOptions &options, const char *&benchmark, std::vector<size_t> &sizes, bool &autotune)
+{
+    size_t body_count = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--cpu"))
+            options.backend = Backend::CPU;
+        else if (!strcmp(argv[i], "--headless"))
+        {
+            options.headless = true;
+            options.backend = Backend::CPU;
+        }
+        else if (!strcmp(argv[i], "--validate"))
+            options.validate = true;
+        else if (!strcmp(argv[i], "--fused"))
+            options.fused_update = true;
+        else if (!strcmp(argv[i], "--persistent"))
+            options.persistent = true;
+        else if (!strcmp(argv[i], "--sleep"))
+            options.sleeping = true;
+        else if (!strcmp(argv[i], "--steps") && i + 1 < argc)
+            options.steps = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+            options.threads = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--local-size") && i + 1 < argc)
+            options.local_size = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--block-radius") && i + 1 < argc)
+            options.block_radius = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--autotune"))
+            autotune = true;
+        else if (!strcmp(argv[i], "--size") && i + 3 < argc)
+        {
+            options.masses_x = strtoul(argv[++i], NULL, 10);
+            options.masses_y = strtoul(argv[++i], NULL, 10);
+            options.masses_z = strtoul(argv[++i], NULL, 10);
+        }
+        else if (!strcmp(argv[i], "--bodies") && i + 1 < argc)
+            body_count = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--contacts"))
+            options.body_contacts = true;
+        else if (!strcmp(argv[i], "--self-collide"))
+            options.self_collisions = true;
+        else if (!strcmp(argv[i], "--broad-phase") && i + 1 < argc)
+        {
+            if (parseBroadPhase(argv[++i], options.contact_broad_phase))
+                return 1;
+        }
+        else if (!strcmp(argv[i], "--substeps") && i + 1 < argc)
+            options.substeps = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--real-time"))
+            options.real_time = true;
+        else if (!strcmp(argv[i], "--rate") && i + 1 < argc)
+            options.step_rate = strtof(argv[++i], NULL);
+        else if (!strcmp(argv[i], "--integrator") && i + 1 < argc)
+        {
+            if (parseIntegrator(argv[++i], options.integrator))
+                return 1;
+        }
+        else if (!strcmp(argv[i], "--iterations") && i + 1 < argc)
+            options.constraint_iterations = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--solver") && i + 1 < argc)
+        {
+            if (parseConstraintSolver(argv[++i], options.constraint_solver))
+                return 1;
+        }
+        else if (!strcmp(argv[i], "--rho") && i + 1 < argc)
+            options.spectral_radius = strtof(argv[++i], NULL);
+        else if (!strcmp(argv[i], "--modes") && i + 1 < argc)
+            options.modes = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--adaptive"))
+            options.adaptive_dt = true;
+        else if (!strcmp(argv[i], "--telemetry") && i + 1 < argc)
+            options.telemetry_path = argv[++i];
+        else if (!strcmp(argv[i], "--isa") && i + 1 < argc)
+        {
+            if (parseISA(argv[++i], options.spring_isa))
+                return 1;
+        }
+        else if (!strcmp(argv[i], "--accumulate") && i + 1 < argc)
+        {
+            if (parseAccumulation(argv[++i], options.accumulation))
+                return 1;
+        }
+        else if (!strcmp(argv[i], "--springs") && i + 1 < argc)
+        {
+            if (parseFormulation(argv[++i], options.formulation))
+                return 1;
+        }
+        else if (!strcmp(argv[i], "--order") && i + 1 < argc)
+        {
+            if (parseMassOrder(argv[++i], options.mass_order))
+                return 1;
+        }
+        else if (!strcmp(argv[i], "--tiled-springs"))
+            options.tiled_springs = true;
+        else if (!strcmp(argv[i], "--padded-springs"))
+            options.compact_springs = false;
+        else if (!strcmp(argv[i], "--benchmark") && i + 1 < argc)
+            benchmark = argv[++i];
+        else if (!strcmp(argv[i], "--sizes") && i + 1 < argc)
+            parseSizes(argv[++i], sizes);
+        else
+            return 1;
+    }
+
+    if (options.masses_x < 3 || options.masses_y < 3 || options.masses_z < 3)
+        return 1;
+
+    // After every option, --size may follow --bodies
+    if (body_count)
+        options.bodies = arrangeBodies(body_count, options.masses_x, options.masses_y, options.masses_z);
+
+    if (!options.substeps || options.step_rate < 0)
+        return 1;
+
+    // Chebyshev weights diverge for a spectral radius of 1 or more
+    if (options.spectral_radius < 0 || options.spectral_radius >= 1)
+        return 1;
+
+    return 0;
+}
 
 int main(int argc, const char **argv)
 {
-    Simulator simulator;
+    SimulatorOptions options;
+    const char *benchmark = nullptr;
+    std::vector<size_t> sizes;
+    bool autotune = false;
+    if (parseOptions(argc, argv, options, benchmark, sizes, autotune))
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    if (benchmark)
+    {
+        BenchmarkConfig config;
+        config.options = options;
+        config.sizes = sizes;
+        return runBenchmark(benchmark, config);
+    }
 
     int errorCode;
+    // The kernel parameters only shape the GPU passes
+    if (autotune && options.backend == Backend::GPU)
+    {
+        errorCode = applyKernelTuning(AutotuneConfig(), options);
+        if (errorCode)
+        {
+            printf("Autotuning errored with code: %i\n", errorCode);
+            return errorCode;
+        }
+    }
+
+    Simulator simulator(options);
+
     errorCode = simulator.init();
     if (errorCode)
     {
@@ -12,6 +315,7 @@ int main(int argc, const char **argv)
         return errorCode;
     }
 
+    auto start = std::chrono::steady_clock::now();
     while (simulator.running())
     {
         errorCode = simulator.run();
@@ -21,6 +325,8 @@ int main(int argc, const char **argv)
             return errorCode;
         }
     }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 
+    printf("%lu steps in %.3fs (%.1f steps/s, %.1f frames/s)\n", simulator.getStepCount(), seconds, simulator.getStepCount() / seconds, simulator.getFrameCount() / seconds);
     printf("Exited normally\n");
-}
\ No newline at end of file
+}
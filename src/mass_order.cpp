@@ -0,0 +1,101 @@
+#include "mass_order.hpp"
+
+#include <algorithm>
+#include <numeric>
+#include <stdint.h>
+
+const char *getMassOrderName(MassOrder order)
+{
+    switch (order)
+    {
+    case MassOrder::Linear:
+        return "linear";
+    case MassOrder::Morton:
+        return "morton";
+    case MassOrder::Hilbert:
+        return "hilbert";
+    default:
+        return "unknown";
+    }
+}
+
+// Interleaves the low bits of each coordinate, most significant first, x highest within each triple
+static uint64_t interleave(const uint32_t coordinates[3], unsigned bits)
+{
+    uint64_t index = 0;
+    for (int bit = bits - 1; bit >= 0; bit--)
+    {
+        for (int axis = 0; axis < 3; axis++)
+            index = (index << 1) | ((coordinates[axis] >> bit) & 1);
+    }
+    return index;
+}
+
+// Skilling's transform ("Programming the Hilbert curve", 2004) from axes to the transposed Hilbert index
+static uint64_t getHilbertIndex(uint32_t x, uint32_t y, uint32_t z, unsigned bits)
+{
+    uint32_t axes[3]{x, y, z};
+
+    for (uint32_t q = 1u << (bits - 1); q > 1; q >>= 1)
+    {
+        uint32_t p = q - 1;
+        for (int i = 0; i < 3; i++)
+        {
+            if (axes[i] & q)
+            {
+                axes[0] ^= p;
+            }
+            else
+            {
+                uint32_t t = (axes[0] ^ axes[i]) & p;
+                axes[0] ^= t;
+                axes[i] ^= t;
+            }
+        }
+    }
+
+    // Gray encode
+    for (int i = 1; i < 3; i++)
+        axes[i] ^= axes[i - 1];
+    uint32_t t = 0;
+    for (uint32_t q = 1u << (bits - 1); q > 1; q >>= 1)
+    {
+        if (axes[2] & q)
+            t ^= q - 1;
+    }
+    for (int i = 0; i < 3; i++)
+        axes[i] ^= t;
+
+    return interleave(axes, bits);
+}
+
+void buildMassOrder(MassOrder order, size_t masses_x, size_t masses_y, size_t masses_z, std::vector<GLuint> &ranks)
+{
+    size_t count = masses_x * masses_y * masses_z;
+    ranks.resize(count);
+    std::iota(ranks.begin(), ranks.end(), 0);
+    if (order == MassOrder::Linear)
+        return;
+
+    // The curves are defined over a power of two cube, lattices of other sizes keep the curve's order of their masses
+    unsigned bits = 1;
+    while ((size_t)1 << bits < std::max(std::max(masses_x, masses_y), masses_z))
+        bits++;
+
+    std::vector<uint64_t> keys(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        uint32_t coordinates[3]{(uint32_t)(i % masses_x), (uint32_t)(i / masses_x % masses_y), (uint32_t)(i / masses_x / masses_y)};
+        keys[i] = order == MassOrder::Morton ? interleave(coordinates, bits) : getHilbertIndex(coordinates[0], coordinates[1], coordinates[2], bits);
+    }
+
+    std::vector<GLuint> masses(count);
+    std::iota(masses.begin(), masses.end(), 0);
+    std::sort(masses.begin(), masses.end(), [&](GLuint a, GLuint b)
+    {
+        return keys[a] < keys[b];
+    });
+
+    for (size_t i = 0; i < count; i++)
+        ranks[masses[i]] = i;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "includes.h"
+
+#include <vector>
+
+// Order the masses are numbered in, and so laid out in every per-mass buffer
+enum class MassOrder
+{
+    // x-major, as Simulator::getPositionIndex() builds them
+    Linear,
+    // Z-order curve over the lattice coordinates
+    Morton,
+    // Hilbert curve over the lattice coordinates, neighbours stay closer than with Morton
+    Hilbert
+};
+
+const char *getMassOrderName(MassOrder order);
+
+// ranks[i] is the new index of the mass at x-major index i of a masses_x * masses_y * masses_z lattice
+// (also used for the blocks of the spring layout)
+void buildMassOrder(MassOrder order, size_t masses_x, size_t masses_y, size_t masses_z, std::vector<GLuint> &ranks);
@@ -0,0 +1,647 @@
+#include "modal_body.hpp"
+#include "sparse_cholesky.hpp"
+#include "timestep.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <numeric>
+
+// Cyclic Jacobi eigen decomposition of the symmetric p x p column-major matrix a (destroyed):
+// values ascending, with the matching unit vectors as the columns of vectors
+static void decomposeSymmetric(std::vector<double> &a, size_t p, std::vector<double> &values, std::vector<double> &vectors)
+{
+    std::vector<double> rotated(p * p, 0.0);
+    for (size_t i = 0; i < p; i++)
+        rotated[i * p + i] = 1;
+
+    for (int sweep = 0; sweep < 64; sweep++)
+    {
+        double off_diagonal = 0, total = 0;
+        for (size_t j = 0; j < p; j++)
+        {
+            for (size_t i = 0; i < p; i++)
+            {
+                total += a[j * p + i] * a[j * p + i];
+                if (i != j)
+                    off_diagonal += a[j * p + i] * a[j * p + i];
+            }
+        }
+        if (off_diagonal <= 1e-28 * total)
+            break;
+
+        for (size_t i = 0; i < p; i++)
+        {
+            for (size_t j = i + 1; j < p; j++)
+            {
+                double aij = a[j * p + i];
+                if (aij == 0)
+                    continue;
+
+                // Rotate columns and rows i and j so that a_ij vanishes
+                double theta = (a[j * p + j] - a[i * p + i]) / (2 * aij);
+                double t = (theta >= 0 ? 1 : -1) / (fabs(theta) + sqrt(theta * theta + 1));
+                double c = 1 / sqrt(t * t + 1), s = t * c;
+                for (size_t k = 0; k < p; k++)
+                {
+                    double ki = a[i * p + k], kj = a[j * p + k];
+                    a[i * p + k] = c * ki - s * kj;
+                    a[j * p + k] = s * ki + c * kj;
+                }
+                for (size_t k = 0; k < p; k++)
+                {
+                    double ik = a[k * p + i], jk = a[k * p + j];
+                    a[k * p + i] = c * ik - s * jk;
+                    a[k * p + j] = s * ik + c * jk;
+                }
+                for (size_t k = 0; k < p; k++)
+                {
+                    double ki = rotated[i * p + k], kj = rotated[j * p + k];
+                    rotated[i * p + k] = c * ki - s * kj;
+                    rotated[j * p + k] = s * ki + c * kj;
+                }
+            }
+        }
+    }
+
+    std::vector<size_t> order(p);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](size_t x, size_t y)
+    {
+        return a[x * p + x] < a[y * p + y];
+    });
+
+    values.resize(p);
+    vectors.resize(p * p);
+    for (size_t i = 0; i < p; i++)
+    {
+        values[i] = a[order[i] * p + order[i]];
+        std::copy(rotated.begin() + order[i] * p, rotated.begin() + (order[i] + 1) * p, vectors.begin() + i * p);
+    }
+}
+
+int ModalBody::init(const SimulationData &data, const PhysicsConfig &physics, const ModalConfig &config)
+{
+    if (!data.positions || !data.springs || !data.position_count)
+        return -40;
+
+    auto start = std::chrono::steady_clock::now();
+    this->physics = physics;
+    position_count = data.position_count;
+    planes.assign(data.planes, data.planes + data.planes_count);
+    spheres.assign(data.spheres, data.spheres + data.spheres_count);
+
+    // Only the outermost masses are missing springs
+    std::vector<GLuint> degree(position_count, 0);
+    for (size_t i = 0; i < data.spring_count; i++)
+    {
+        if (data.springs[i].type == 0)
+            continue;
+        degree[data.springs[i].point1]++;
+        degree[data.springs[i].point2]++;
+    }
+    GLuint max_degree = *std::max_element(degree.begin(), degree.end());
+    surface.clear();
+    for (size_t i = 0; i < position_count; i++)
+    {
+        if (degree[i] < max_degree)
+            surface.push_back(i);
+    }
+    if (surface.empty())
+    {
+        surface.resize(position_count);
+        std::iota(surface.begin(), surface.end(), 0);
+    }
+
+    glm::dvec3 centroid(0.0);
+    for (size_t i = 0; i < position_count; i++)
+        centroid += glm::dvec3(data.positions[i]);
+    centroid /= (double)position_count;
+
+    // The rest shape, and its inertia about the centroid
+    basis.assign(position_count, glm::vec4(0.0f));
+    glm::dmat3 inertia(0.0);
+    for (size_t i = 0; i < position_count; i++)
+    {
+        glm::dvec3 arm = glm::dvec3(data.positions[i]) - centroid;
+        basis[i] = glm::vec4(glm::vec3(arm), 1.0f);
+        inertia += (double)physics.mass * (glm::dot(arm, arm) * glm::dmat3(1.0) - glm::outerProduct(arm, arm));
+    }
+    total_mass = physics.mass * position_count;
+    inverse_inertia = glm::determinant(inertia) > 0 ? glm::mat3(glm::inverse(inertia)) : glm::mat3(0.0f);
+
+    int errorCode = computeModes(data, config);
+    if (errorCode)
+        return errorCode;
+
+    // The contact tests read the surface masses only, so keep theirs together
+    size_t stride = mode_count + 1;
+    surface_basis.resize(surface.size() * stride);
+    for (size_t s = 0; s < surface.size(); s++)
+    {
+        for (size_t k = 0; k < stride; k++)
+            surface_basis[s * stride + k] = glm::vec3(basis[k * position_count + surface[s]]);
+    }
+    surface_arms.resize(surface.size());
+
+    rest_reach = 0;
+    mode_reach.assign(mode_count, 0.0f);
+    for (size_t i = 0; i < position_count; i++)
+    {
+        rest_reach = std::max(rest_reach, glm::length(glm::vec3(basis[i])));
+        for (size_t k = 0; k < mode_count; k++)
+            mode_reach[k] = std::max(mode_reach[k], glm::length(glm::vec3(basis[(k + 1) * position_count + i])));
+    }
+
+    state.center = glm::vec3(centroid);
+    state.orientation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+    state.coordinates.assign(mode_count, 0.0f);
+    last_state = state;
+    velocity = angular_velocity = glm::vec3(0.0f);
+    modal_velocities.assign(mode_count, 0.0f);
+    weights.resize(mode_count);
+
+    setup_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return 0;
+}
+
+int ModalBody::computeModes(const SimulationData &data, const ModalConfig &config)
+{
+    size_t n = position_count, dofs = 3 * n;
+
+    // Stiffness of the springs about the rest shape: k d d^T coupling both ends along the rest direction d.
+    // Lower triangle by column, three columns per mass, each mass's own block summed and the coupling blocks
+    // one per spring in the columns of its lower mass.
+    std::vector<glm::dmat3> blocks(n, glm::dmat3(0.0));
+    std::vector<GLuint> offsets(dofs + 1, 0);
+    auto getBlock = [&](const Spring &spring, glm::dmat3 &block)
+    {
+        glm::dvec3 d = glm::dvec3(data.positions[spring.point2] - data.positions[spring.point1]);
+        double length = glm::length(d);
+        if (spring.type == 0 || spring.point1 == spring.point2 || length < 1e-12)
+            return false;
+        d /= length;
+        block = (double)physics.stiffness[spring.type] * glm::outerProduct(d, d);
+        return true;
+    };
+
+    glm::dmat3 block;
+    for (size_t s = 0; s < data.spring_count; s++)
+    {
+        const Spring &spring = data.springs[s];
+        if (!getBlock(spring, block))
+            continue;
+        blocks[spring.point1] += block;
+        blocks[spring.point2] += block;
+        for (int b = 0; b < 3; b++)
+            offsets[3 * std::min(spring.point1, spring.point2) + b + 1] += 3;
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        for (int b = 0; b < 3; b++)
+            offsets[3 * i + b + 1] += 3 - b;
+    }
+    for (size_t j = 0; j < dofs; j++)
+        offsets[j + 1] += offsets[j];
+
+    std::vector<GLuint> rows(offsets[dofs]), next(offsets.begin(), offsets.end() - 1);
+    std::vector<double> values(offsets[dofs]);
+    double largest = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        for (int b = 0; b < 3; b++)
+        {
+            for (int a = b; a < 3; a++)
+            {
+                GLuint q = next[3 * i + b]++;
+                rows[q] = 3 * i + a;
+                values[q] = blocks[i][b][a];
+            }
+            largest = std::max(largest, blocks[i][b][b]);
+        }
+    }
+    for (size_t s = 0; s < data.spring_count; s++)
+    {
+        const Spring &spring = data.springs[s];
+        if (!getBlock(spring, block))
+            continue;
+        GLuint low = std::min(spring.point1, spring.point2), high = std::max(spring.point1, spring.point2);
+        for (int b = 0; b < 3; b++)
+        {
+            for (int a = 0; a < 3; a++)
+            {
+                GLuint q = next[3 * low + b]++;
+                rows[q] = 3 * high + a;
+                values[q] = -block[b][a];
+            }
+        }
+    }
+
+    // K is singular along the rigid motions, so factor K + shift * I. Its inverse weights every mode by
+    // 1 / (omega^2 * mass + shift), the lowest most, once the rigid ones are projected out.
+    double shift = 1e-4 * largest;
+    std::vector<double> shifted = values;
+    for (size_t j = 0; j < dofs; j++)
+        shifted[offsets[j]] += shift;
+
+    std::vector<glm::vec3> coordinates(dofs);
+    for (size_t j = 0; j < dofs; j++)
+        coordinates[j] = glm::vec3(data.positions[j / 3]);
+
+    SparseCholesky system;
+    if (system.factor(dofs, offsets.data(), rows.data(), shifted.data(), coordinates.data()))
+        return -41;
+
+    auto dot = [&](const double *a, const double *b)
+    {
+        double sum = 0;
+        for (size_t d = 0; d < dofs; d++)
+            sum += a[d] * b[d];
+        return sum;
+    };
+
+    // Orthonormalizes vector against the count vectors in front of it, twice over for the round-off.
+    // Returns false if nothing independent was left of it.
+    auto orthonormalize = [&](double *vectors, size_t count, double *vector)
+    {
+        double before = sqrt(dot(vector, vector));
+        for (int pass = 0; pass < 2; pass++)
+        {
+            for (size_t v = 0; v < count; v++)
+            {
+                double projection = dot(vectors + v * dofs, vector);
+                for (size_t d = 0; d < dofs; d++)
+                    vector[d] -= projection * vectors[v * dofs + d];
+            }
+        }
+        double norm = sqrt(dot(vector, vector));
+        if (!(norm > 1e-10 * before))
+            return false;
+        for (size_t d = 0; d < dofs; d++)
+            vector[d] /= norm;
+        return true;
+    };
+
+    // The rigid motions, three translations and three rotations about the centroid
+    glm::dvec3 centroid(0.0);
+    for (size_t i = 0; i < n; i++)
+        centroid += glm::dvec3(data.positions[i]);
+    centroid /= (double)n;
+
+    std::vector<double> rigid(6 * dofs, 0.0);
+    size_t rigid_count = 0;
+    for (int axis = 0; axis < 6; axis++)
+    {
+        double *vector = &rigid[rigid_count * dofs];
+        for (size_t i = 0; i < n; i++)
+        {
+            glm::dvec3 motion(0.0);
+            if (axis < 3)
+                motion[axis] = 1;
+            else
+                motion = glm::cross(glm::dvec3(axis == 3, axis == 4, axis == 5), glm::dvec3(data.positions[i]) - centroid);
+            for (int a = 0; a < 3; a++)
+                vector[3 * i + a] = motion[a];
+        }
+        if (orthonormalize(rigid.data(), rigid_count, vector))
+            rigid_count++;
+    }
+
+    // A few more vectors than modes wanted speed up the convergence of the last ones
+    mode_count = std::min<size_t>(config.modes, dofs - rigid_count);
+    size_t p = std::min<size_t>(mode_count + std::min<size_t>(mode_count, 8), dofs - rigid_count);
+
+    // The subspace, orthonormal and orthogonal to the rigid motions (all masses weigh the same, so M = mass * I
+    // and M-orthogonal is plain orthogonal)
+    std::vector<double> subspace(p * dofs), scratch(dofs);
+    uint32_t seed = 12345;
+    auto fill = [&](double *vector)
+    {
+        for (size_t d = 0; d < dofs; d++)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            vector[d] = (double)(seed >> 8) / (1 << 24) - 0.5;
+        }
+    };
+    auto project = [&](size_t v)
+    {
+        double *vector = &subspace[v * dofs];
+        for (int attempt = 0; attempt < 4; attempt++)
+        {
+            std::copy(vector, vector + dofs, scratch.begin());
+            if (orthonormalize(rigid.data(), rigid_count, scratch.data()) && orthonormalize(subspace.data(), v, scratch.data()))
+            {
+                std::copy(scratch.begin(), scratch.end(), vector);
+                return;
+            }
+            fill(vector);
+        }
+    };
+    for (size_t v = 0; v < p; v++)
+    {
+        fill(&subspace[v * dofs]);
+        project(v);
+    }
+
+    std::vector<glm::dvec3> solve(dofs);
+    std::vector<double> products(p * dofs), reduced(p * p), ritz_values, ritz_vectors, rotated(p * dofs);
+    std::vector<double> last_values(mode_count, 0.0);
+    for (setup_iterations = 0; setup_iterations < config.max_iterations; setup_iterations++)
+    {
+        // subspace = (K + shift)^-1 subspace, three vectors per solve
+        for (size_t v = 0; v < p; v += 3)
+        {
+            for (size_t d = 0; d < dofs; d++)
+            {
+                for (size_t c = 0; c < 3; c++)
+                    solve[d][c] = v + c < p ? subspace[(v + c) * dofs + d] : 0.0;
+            }
+            system.solve(solve.data());
+            for (size_t d = 0; d < dofs; d++)
+            {
+                for (size_t c = 0; c < 3 && v + c < p; c++)
+                    subspace[(v + c) * dofs + d] = solve[d][c];
+            }
+        }
+        for (size_t v = 0; v < p; v++)
+            project(v);
+
+        // Rayleigh-Ritz: the modes of K within the subspace
+        std::fill(products.begin(), products.end(), 0.0);
+        for (size_t v = 0; v < p; v++)
+        {
+            const double *x = &subspace[v * dofs];
+            double *y = &products[v * dofs];
+            for (size_t j = 0; j < dofs; j++)
+            {
+                for (GLuint q = offsets[j]; q < offsets[j + 1]; q++)
+                {
+                    y[rows[q]] += values[q] * x[j];
+                    if (rows[q] != j)
+                        y[j] += values[q] * x[rows[q]];
+                }
+            }
+        }
+        for (size_t v = 0; v < p; v++)
+        {
+            for (size_t u = 0; u < p; u++)
+                reduced[v * p + u] = dot(&subspace[u * dofs], &products[v * dofs]);
+        }
+        decomposeSymmetric(reduced, p, ritz_values, ritz_vectors);
+
+        std::fill(rotated.begin(), rotated.end(), 0.0);
+        for (size_t v = 0; v < p; v++)
+        {
+            for (size_t u = 0; u < p; u++)
+            {
+                double weight = ritz_vectors[v * p + u];
+                for (size_t d = 0; d < dofs; d++)
+                    rotated[v * dofs + d] += weight * subspace[u * dofs + d];
+            }
+        }
+        std::swap(subspace, rotated);
+
+        bool converged = true;
+        for (size_t k = 0; k < mode_count; k++)
+        {
+            converged &= fabs(ritz_values[k] - last_values[k]) <= config.tolerance * fabs(ritz_values[k]);
+            last_values[k] = ritz_values[k];
+        }
+        if (converged)
+            break;
+    }
+
+    // Unit modes in K x = omega^2 M x with M = mass * I are mass normalized once divided by sqrt(mass)
+    double scale = 1 / sqrt((double)physics.mass);
+    frequencies.resize(mode_count);
+    basis.resize(position_count * (mode_count + 1));
+    for (size_t k = 0; k < mode_count; k++)
+    {
+        frequencies[k] = sqrt(std::max(last_values[k], 0.0) / physics.mass);
+        for (size_t i = 0; i < n; i++)
+        {
+            const double *mode = &subspace[k * dofs + 3 * i];
+            basis[(k + 1) * n + i] = glm::vec4(mode[0] * scale, mode[1] * scale, mode[2] * scale, 0.0f);
+        }
+    }
+
+    return 0;
+}
+
+void ModalBody::step(float delta_t)
+{
+    last_state = state;
+    float h = delta_t;
+    float damping = getDamping(physics, h);
+
+    // Rigid motion, with gravity along y as gravity.comp applies it. Uniform gravity does no work on any mode.
+    velocity.y += physics.gravity * h;
+    velocity *= damping;
+    angular_velocity *= damping;
+    state.center += velocity * h;
+    float spin = glm::length(angular_velocity);
+    if (spin > 0)
+        state.orientation = glm::normalize(glm::angleAxis(spin * h, angular_velocity / spin) * state.orientation);
+
+    // Every mode is an undamped oscillator stepped exactly, stable at any dt, then damped like the masses
+    for (size_t k = 0; k < mode_count; k++)
+    {
+        float q = state.coordinates[k], v = modal_velocities[k];
+        float omega = frequencies[k];
+        if (omega > 0)
+        {
+            float c = cosf(omega * h), s = sinf(omega * h);
+            state.coordinates[k] = q * c + v * s / omega;
+            v = v * c - q * omega * s;
+        }
+        else
+            state.coordinates[k] = q + v * h;
+        modal_velocities[k] = v * damping;
+    }
+
+    collide();
+}
+
+void ModalBody::translate(const glm::vec3 &offset)
+{
+    state.center += offset;
+    last_state.center += offset;
+}
+
+void ModalBody::collide()
+{
+    // Nothing is touched beyond reach of the center, which most steps of a body in flight never get past
+    float reach = rest_reach + physics.collision_offset;
+    for (size_t k = 0; k < mode_count; k++)
+        reach += fabsf(state.coordinates[k]) * mode_reach[k];
+
+    bool built = false;
+    size_t stride = mode_count + 1;
+    auto buildArms = [&]()
+    {
+        if (built)
+            return;
+        glm::mat3 rotation = glm::mat3_cast(state.orientation);
+        for (size_t s = 0; s < surface.size(); s++)
+        {
+            const glm::vec3 *vectors = &surface_basis[s * stride];
+            glm::vec3 local = vectors[0];
+            for (size_t k = 0; k < mode_count; k++)
+                local += state.coordinates[k] * vectors[k + 1];
+            surface_arms[s] = rotation * local;
+        }
+        built = true;
+    };
+
+    // The same contacts as collide.comp, tested at the surface masses only: planes from the side the body is on
+    for (const glm::vec4 &plane : planes)
+    {
+        glm::vec3 normal = glm::vec3(plane);
+        glm::vec3 point = normal * plane.w;
+        float distance = glm::dot(normal, state.center - point);
+        if (fabsf(distance) > reach)
+            continue;
+        if (distance < 0)
+            normal = -normal;
+
+        buildArms();
+        arms.clear();
+        normals.clear();
+        depths.clear();
+        touching.clear();
+        for (size_t s = 0; s < surface.size(); s++)
+        {
+            float depth = physics.collision_offset - glm::dot(normal, state.center + surface_arms[s] - point);
+            if (depth <= 0)
+                continue;
+            arms.push_back(surface_arms[s]);
+            normals.push_back(normal);
+            depths.push_back(depth);
+            touching.push_back(s);
+        }
+        resolveContacts();
+    }
+
+    for (const glm::vec4 &sphere : spheres)
+    {
+        if (glm::distance(state.center, glm::vec3(sphere)) > reach + sphere.w)
+            continue;
+
+        buildArms();
+        arms.clear();
+        normals.clear();
+        depths.clear();
+        touching.clear();
+        for (size_t s = 0; s < surface.size(); s++)
+        {
+            glm::vec3 away = state.center + surface_arms[s] - glm::vec3(sphere);
+            float distance = glm::length(away);
+            if (distance >= sphere.w || distance < 1e-12f)
+                continue;
+            arms.push_back(surface_arms[s]);
+            normals.push_back(away / distance);
+            depths.push_back(sphere.w - distance);
+            touching.push_back(s);
+        }
+        resolveContacts();
+    }
+}
+
+void ModalBody::resolveContacts()
+{
+    if (touching.empty())
+        return;
+
+    glm::mat3 rotation = glm::mat3_cast(state.orientation);
+    glm::mat3 world_inverse_inertia = rotation * inverse_inertia * glm::transpose(rotation);
+    size_t stride = mode_count + 1;
+
+    // Sequential inelastic impulses, each against the velocity the ones before it left at its mass
+    for (size_t c = 0; c < touching.size(); c++)
+    {
+        glm::vec3 normal = normals[c];
+        glm::vec3 body_normal = glm::transpose(rotation) * normal;
+        const glm::vec3 *modes = &surface_basis[touching[c] * stride + 1];
+        float modal_speed = 0, modal_weight = 0;
+        for (size_t k = 0; k < mode_count; k++)
+        {
+            weights[k] = glm::dot(modes[k], body_normal);
+            modal_speed += weights[k] * modal_velocities[k];
+            modal_weight += weights[k] * weights[k];
+        }
+
+        float speed = glm::dot(normal, velocity + glm::cross(angular_velocity, arms[c])) + modal_speed;
+        if (speed >= 0)
+            continue;
+
+        glm::vec3 torque_arm = glm::cross(arms[c], normal);
+        float inverse_mass = 1 / total_mass + glm::dot(torque_arm, world_inverse_inertia * torque_arm) + modal_weight;
+        float impulse = -speed / inverse_mass;
+        velocity += normal * (impulse / total_mass);
+        angular_velocity += world_inverse_inertia * torque_arm * impulse;
+        for (size_t k = 0; k < mode_count; k++)
+            modal_velocities[k] += weights[k] * impulse;
+    }
+
+    // And out of the obstacle, rigidly
+    size_t deepest = std::max_element(depths.begin(), depths.end()) - depths.begin();
+    state.center += normals[deepest] * depths[deepest];
+}
+
+void ModalBody::reconstruct(glm::vec4 *positions, bool last) const
+{
+    const State &from = last ? last_state : state;
+    glm::mat3 rotation = glm::mat3_cast(from.orientation);
+    for (size_t i = 0; i < position_count; i++)
+    {
+        glm::vec3 local = glm::vec3(basis[i]);
+        for (size_t k = 0; k < mode_count; k++)
+            local += from.coordinates[k] * glm::vec3(basis[(k + 1) * position_count + i]);
+        positions[i] = glm::vec4(from.center + rotation * local, 1.0f);
+    }
+}
+
+size_t ModalBody::getPositionCount() const
+{
+    return position_count;
+}
+
+size_t ModalBody::getModeCount() const
+{
+    return mode_count;
+}
+
+const std::vector<float> &ModalBody::getFrequencies() const
+{
+    return frequencies;
+}
+
+const std::vector<glm::vec4> &ModalBody::getBasis() const
+{
+    return basis;
+}
+
+glm::vec3 ModalBody::getCenter(bool last) const
+{
+    return last ? last_state.center : state.center;
+}
+
+glm::mat3 ModalBody::getRotation(bool last) const
+{
+    return glm::mat3_cast(last ? last_state.orientation : state.orientation);
+}
+
+const std::vector<float> &ModalBody::getCoordinates(bool last) const
+{
+    return last ? last_state.coordinates : state.coordinates;
+}
+
+double ModalBody::getSetupTime() const
+{
+    return setup_time;
+}
+
+unsigned ModalBody::getSetupIterations() const
+{
+    return setup_iterations;
+}
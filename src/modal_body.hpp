@@ -0,0 +1,92 @@
+#pragma once
+
+#include "includes.h"
+#include "constructs.h"
+
+#include "glm/gtc/quaternion.hpp"
+
+#include <vector>
+
+typedef struct
+{
+    // Vibration modes kept on top of the rigid motion
+    unsigned modes = 12;
+    // Subspace iterations at most while finding them, stopping once no kept frequency moves by tolerance
+    unsigned max_iterations = 100;
+    float tolerance = 1e-5f;
+} ModalConfig;
+
+// Reduced order body: the rest shape moving rigidly, deformed by the lowest vibration modes of its spring
+// network linearized at rest, x_i = center + rotation * (rest_i + sum_k q_k phi_k[i]).
+// The modes are found once at init, by shift-invert subspace iteration against a SparseCholesky factor of
+// the stiffness matrix. A step then costs O(modes) for the dynamics, plus contacts at the surface masses,
+// and the masses themselves are only rebuilt when someone wants to see them.
+class ModalBody
+{
+public:
+    int init(const SimulationData &data, const PhysicsConfig &physics, const ModalConfig &config);
+    void step(float delta_t);
+    // Moves the body rigidly, so a copy of one set up elsewhere stands in for another body of the same rest shape
+    void translate(const glm::vec3 &offset);
+    // Every position, of the current state or of the one before the last step
+    void reconstruct(glm::vec4 *positions, bool last = false) const;
+
+    size_t getPositionCount() const;
+    size_t getModeCount() const;
+    // Angular frequency of every mode in rad/s, lowest first
+    const std::vector<float> &getFrequencies() const;
+    // The rest shape about the center, then every mode, getPositionCount() entries apiece
+    const std::vector<glm::vec4> &getBasis() const;
+    glm::vec3 getCenter(bool last = false) const;
+    glm::mat3 getRotation(bool last = false) const;
+    const std::vector<float> &getCoordinates(bool last = false) const;
+    // Seconds init() spent finding the modes, and the subspace iterations it took
+    double getSetupTime() const;
+    unsigned getSetupIterations() const;
+
+private:
+    int computeModes(const SimulationData &data, const ModalConfig &config);
+    void collide();
+    // Pushes the body out of the deepest gathered contact and stops every mass in contact from moving further in
+    void resolveContacts();
+
+    PhysicsConfig physics;
+    size_t position_count = 0;
+    size_t mode_count = 0;
+    std::vector<glm::vec4> basis;
+    std::vector<float> frequencies;
+    // Masses with fewer springs than the best connected one, the only ones that can touch anything first,
+    // and their rest offset and mode vectors side by side (mode_count + 1 apiece) for the contact tests
+    std::vector<GLuint> surface;
+    std::vector<glm::vec3> surface_basis;
+    // How far any mass sits from the center at rest, and moves per unit of each modal coordinate
+    float rest_reach = 0;
+    std::vector<float> mode_reach;
+    std::vector<glm::vec4> planes;
+    std::vector<glm::vec4> spheres;
+    float total_mass = 0;
+    // Inverse inertia tensor of the rest shape, in the body frame
+    glm::mat3 inverse_inertia = glm::mat3(0.0f);
+    double setup_time = 0;
+    unsigned setup_iterations = 0;
+
+    struct State
+    {
+        glm::vec3 center = glm::vec3(0.0f);
+        glm::quat orientation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+        std::vector<float> coordinates;
+    } state, last_state;
+    glm::vec3 velocity = glm::vec3(0.0f);
+    glm::vec3 angular_velocity = glm::vec3(0.0f);
+    std::vector<float> modal_velocities;
+
+    // World space offset of every surface mass from the center, rebuilt once per step if anything is in reach
+    std::vector<glm::vec3> surface_arms;
+    // Contacts with one obstacle at a time: world space arm, normal, depth and surface index of every mass in
+    // contact, and the mode weights of the one being resolved
+    std::vector<glm::vec3> arms;
+    std::vector<glm::vec3> normals;
+    std::vector<float> depths;
+    std::vector<GLuint> touching;
+    std::vector<float> weights;
+};
@@ -1,12 +1,98 @@
 #include "simulator.hpp"
 
-Simulator::Simulator() {}
+// Leading uints of buffers.active: the dispatches over the active masses, over the active blocks an invocation each and
+// a workgroup each, then the lengths of both lists
+static const size_t active_header = 11;
+
+// vec4s of the state reconstruct.comp rebuilds one modal body from: center, rotation columns, then the modal coordinates
+static size_t getModalStateSize(size_t modes)
+{
+    return 4 + (modes + 3) / 4;
+}
+
+// glMultiDrawElementsIndirect() arguments
+typedef struct
+{
+    GLuint count;
+    GLuint instance_count;
+    GLuint first_index;
+    GLint base_vertex;
+    GLuint base_instance;
+} DrawCommand;
+
+static PhysicsConfig makePhysicsConfig(const SimulatorOptions &options)
+{
+    PhysicsConfig physics;
+    if (options.step_rate > 0)
+        physics.delta_t = 1 / options.step_rate;
+    return physics;
+}
+
+Simulator::Simulator(const SimulatorOptions &options) : physics_config(makePhysicsConfig(options)), options(options)
+{
+    delta_t = last_delta_t = physics_config.delta_t;
+    scene_config.jello.block_radius = options.block_radius;
+    scene_config.jello.block_length = options.block_radius * 2;
+
+    body_configs = options.bodies;
+    if (body_configs.empty())
+    {
+        BodyConfig body;
+        body.x = scene_config.jello.x;
+        body.y = scene_config.jello.y;
+        body.z = scene_config.jello.z;
+        body.masses_x = options.masses_x;
+        body.masses_y = options.masses_y;
+        body.masses_z = options.masses_z;
+        body.width = scene_config.jello.width;
+        body.height = scene_config.jello.height;
+        body.depth = scene_config.jello.depth;
+        body_configs.push_back(body);
+    }
+    setJello(body_configs[0]);
+}
+
+std::vector<BodyConfig> arrangeBodies(size_t count, size_t masses_x, size_t masses_y, size_t masses_z)
+{
+    // Unit cubes 1.5 apart, side by side in square layers stacked up against gravity from the single jello's place
+    size_t side = std::ceil(std::cbrt((double)count) - 1e-9);
+    std::vector<BodyConfig> bodies(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        BodyConfig &body = bodies[i];
+        body.masses_x = masses_x;
+        body.masses_y = masses_y;
+        body.masses_z = masses_z;
+        body.width = body.height = body.depth = 1;
+        body.x = ((i % side) - (side - 1) / 2.0f) * 1.5f;
+        body.y = (i / (side * side)) * 1.5f;
+        body.z = 10 + ((i / side % side) - (side - 1) / 2.0f) * 1.5f;
+    }
+    return bodies;
+}
 
 Simulator::~Simulator()
 {
-    delete light;
-    if (GPU_data.springs)
-        free(GPU_data.springs);
+    if (telemetry)
+        fclose(telemetry);
+
+    if (GPU_data.jello.positions)
+        free(GPU_data.jello.positions);
+
+    if (GPU_data.jello.normals)
+        free(GPU_data.jello.normals);
+
+    if (GPU_data.jello.colors)
+        free(GPU_data.jello.colors);
+
+    if (GPU_data.jello.springs)
+        free(GPU_data.jello.springs);
+
+    if (GPU_data.jello.spring_groups)
+        free(GPU_data.jello.spring_groups);
+
+    if (GPU_data.jello.faces)
+        free(GPU_data.jello.faces);
 
     if (GPU_data.planes.faces)
         free(GPU_data.planes.faces);
@@ -32,8 +118,11 @@ Simulator::~Simulator()
     if (GPU_data.spheres.colors)
         free(GPU_data.spheres.colors);
 
+    if (options.headless)
+        return;
+
     // Release buffers
-    glDeleteBuffers(10, (GLuint *)&buffers);
+    glDeleteBuffers(sizeof(buffers) / sizeof(GLuint), (GLuint *)&buffers);
 
     glfwTerminate();
 }
@@ -42,98 +131,981 @@ int Simulator::init()
 {
     int errorCode;
 
+    // Only the CPU backend can step without a GL context
+    if (options.headless && (options.backend != Backend::CPU || options.validate))
+        return -20;
+
+    // The lattice stencil and shape matching clusters assume the evenly spaced cube, sphere springs have per-spring rest lengths
+    if (!usesSpringBuffer(options.formulation) && scene_config.jello.sphere)
+        return -21;
+
+    // ... and x-major mass indices
+    if (!usesSpringBuffer(options.formulation) && options.mass_order != MassOrder::Linear)
+        return -22;
+
+    // The implicit solve runs over the spring adjacency and XPBD over the colored spring buffer ...
+    if (options.integrator != Integrator::Verlet && !usesSpringBuffer(options.formulation))
+        return -24;
+
+    // ... and their steps are not bound by the explicit stability limit adaptive dt is picked from
+    if (options.integrator != Integrator::Verlet && options.adaptive_dt)
+        return -25;
+
+    // The projective global step is a sparse triangular solve, which the CPU backend alone runs
+    if (options.integrator == Integrator::Projective && (options.backend != Backend::CPU || options.validate))
+        return -26;
+
+    // A modal body moves nothing like the full springs it would be validated against
+    if (options.integrator == Integrator::Modal && options.validate)
+        return -27;
+
+    // Only the Verlet passes on the GPU are dispatched from the active lists, and a CPU step run alongside would not sleep
+    if (options.sleeping && (options.backend != Backend::GPU || options.integrator != Integrator::Verlet || options.validate))
+        return -28;
+
+    // Bodies are packed one after another into the spring buffers: the lattice formulations and mass orders both assume one
+    // cube
+    if (body_configs.size() > 1 && (!usesSpringBuffer(options.formulation) || options.mass_order != MassOrder::Linear || scene_config.jello.sphere))
+        return -29;
+
+    // The GPU sorts the triangles into its hashed grid whatever the broad phase
+    if (options.body_contacts && options.contact_broad_phase != ContactBroadPhase::SpatialHash && (options.backend != Backend::CPU || options.validate))
+        return -51;
+
+    // A modal body bends only through its lowest modes, never far enough to fold over, and steps apart from the other
+    // bodies against the planes and spheres alone
+    if ((options.self_collisions || options.body_contacts) && options.integrator == Integrator::Modal)
+        return -52;
+
+    // The fused pass corrects each mass right after integrating it, with no contact passes in between
+    if (options.fused_update && (options.integrator != Integrator::Verlet || options.body_contacts || options.self_collisions))
+        return -54;
+
+    // Tiles are the blocks of the lattice the springs are derived from, and only the GPU has shared memory to hold them
+    if (options.tiled_springs && (options.formulation != SpringFormulation::Lattice || options.backend != Backend::GPU))
+        return -55;
+
+    // The persistent pass keeps each body to one workgroup for a whole frame of fixed steps, so no pass of the other
+    // workgroups' masses (contacts, sleeping blocks) or of the step statistics can run between its substeps
+    if (options.persistent && (options.backend != Backend::GPU || options.integrator != Integrator::Verlet || !usesSpringBuffer(options.formulation) ||
+                               options.adaptive_dt || options.sleeping || options.body_contacts || options.self_collisions))
+        return -56;
+
+    // Blocks of one color must not share the masses of a bending spring
+    if (options.block_radius < 2)
+        return -53;
+
     // Initialize glfw
-    errorCode = initGL();
+    if (!options.headless)
+    {
+        errorCode = initGL();
+        if (errorCode)
+            return errorCode;
+    }
+
+    errorCode = build();
     if (errorCode)
         return errorCode;
 
-    // Construct cube
-    errorCode = constructCube();
+    // Before the shaders, which are built for its mode count
+    errorCode = initModal();
     if (errorCode)
         return errorCode;
 
-    // Construct scene
-    errorCode = constructScene();
+    if (!options.headless)
+    {
+        // Load Shaders
+        errorCode = loadShaders();
+        if (errorCode)
+            return errorCode;
+
+        // Load Data onto GPU
+        errorCode = makeBuffers();
+        if (errorCode)
+            return errorCode;
+    }
+
+    // Set up the CPU backend
+    errorCode = initBackend();
+    if (errorCode)
+        return errorCode;
+
+    errorCode = initTimestep();
     if (errorCode)
         return errorCode;
 
-    // Load Shaders
-    errorCode = loadShaders();
+    return 0;
+}
+
+int Simulator::build()
+{
+    int errorCode;
+
+    // Construct every body
+    errorCode = constructBodies();
     if (errorCode)
         return errorCode;
 
-    // Load Data onto GPU
-    errorCode = makeBuffers();
+    errorCode = reorderMasses();
+    if (errorCode)
+        return errorCode;
+
+    // Construct scene
+    errorCode = constructScene();
     if (errorCode)
         return errorCode;
 
+    // Before the shaders, which are built for its grid and the depth of the hierarchy
+    if (options.body_contacts || options.self_collisions)
+    {
+        errorCode = buildContactSurface(getSimulationData(), ContactConfig(), contact_surface);
+        if (errorCode)
+            return errorCode;
+    }
+
+    if (options.self_collisions)
+    {
+        rest_positions.assign(GPU_data.jello.positions, GPU_data.jello.positions + GPU_data.jello.position_count);
+        buildSurfaceBVH(contact_surface, physics_config, rest_positions.data(), rest_positions.data(), self_collision_config.leaf_size,
+                        self_collision_config.exclusion * contact_surface.edge_length, surface_bvh);
+    }
+
+    return 0;
+}
+
+int Simulator::run()
+{
+    // Step
+    size_t substeps = scheduleSubsteps();
+    cpu_backend.setDeltaT(delta_t);
+    if (options.integrator == Integrator::Modal)
+    {
+        stepModal(substeps);
+    }
+    else if (options.backend == Backend::CPU)
+    {
+        stepCPU(substeps);
+    }
+    else if (options.persistent)
+    {
+        // One dispatch however many substeps the frame takes
+        if (substeps)
+            stepPersistentGPU(substeps);
+    }
+    else
+    {
+        // Queued back to back, nothing waits on the GPU until the frame is drawn
+        for (size_t i = 0; i < substeps; i++)
+            stepGPU(options.adaptive_dt && i + 1 == substeps);
+    }
+    step_count += substeps;
+    frame_count++;
+    simulated_time += substeps * delta_t;
+
+    if (options.adaptive_dt && substeps)
+        updateTimestep();
+
+    if (options.headless)
+        return 0;
+
+    // Clear screen
+    glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    // Render
+    updateNormals();
+
+    if (options.validate)
+        validateStep(substeps);
+
+    if (options.real_time)
+    {
+        // Blend the last two states into the three vertex copies of the jello
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, buffers.vertices);
+        glUseProgram(programIDs.interpolate);
+        glUniform1f(0, render_alpha);
+        dispatchItems(GPU_data.jello.position_count);
+        glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+    }
+    else
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.positions);
+        glBindBuffer(GL_ARRAY_BUFFER, buffers.vertices);
+        glCopyBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_ARRAY_BUFFER, 0, 0, sizeof(glm::vec4) * GPU_data.jello.position_count);
+        glCopyBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_ARRAY_BUFFER, 0, sizeof(glm::vec4) * GPU_data.jello.position_count, sizeof(glm::vec4) * GPU_data.jello.position_count);
+        glCopyBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_ARRAY_BUFFER, 0, 2 * sizeof(glm::vec4) * GPU_data.jello.position_count, sizeof(glm::vec4) * GPU_data.jello.position_count);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    glUseProgram(programIDs.render);
+
+    glUniform1f(0, scene_config.light_position.x);
+    glUniform1f(1, scene_config.light_position.y);
+    glUniform1f(2, scene_config.light_position.z);
+    glUniform1f(3, scene_config.light_position.w);
+
+    // Every body and the scene in one call
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.faces);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffers.draw_commands);
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, draw_count, 0);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+    // Update window
+    glfwSwapBuffers(window);
+    glfwPollEvents();
+
+    getErrors("Run");
+
+    return 0;
+}
+
+void Simulator::stepGPU(bool collect_stats)
+{
+    // Add gravity, unless the fused pass adds it along with the rest
+    if (!options.fused_update)
+    {
+        glUseProgram(programIDs.gravity);
+        dispatchMasses();
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+
+    // Apply springs
+    if (options.integrator == Integrator::XPBD)
+    {
+        // Projected as constraints after the gravity-only prediction instead
+    }
+    else if (options.formulation == SpringFormulation::Gather)
+    {
+        glUseProgram(programIDs.springs_gather);
+        dispatchMasses();
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+    else if (options.formulation == SpringFormulation::Lattice && options.tiled_springs)
+    {
+        // A workgroup per block, the awake ones' after the other two dispatches
+        glUseProgram(programIDs.springs_tiled);
+        if (options.sleeping)
+            glDispatchComputeIndirect(6 * sizeof(GLuint));
+        else
+            glDispatchCompute(std::min<GLuint>(scene_config.jello.block_width * scene_config.jello.block_height * scene_config.jello.block_depth,
+                                               max_work_groups[0]), 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+    else if (options.formulation == SpringFormulation::Lattice)
+    {
+        glUseProgram(programIDs.springs_lattice);
+        dispatchMasses();
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+    else if (options.formulation == SpringFormulation::ShapeMatching)
+    {
+        glUseProgram(programIDs.shape_clusters);
+        dispatchItems(shape_cluster_count);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        float velocity_scale, force_scale;
+        getVerletScales(physics_config, delta_t, last_delta_t, velocity_scale, force_scale);
+        glUseProgram(programIDs.shape_match);
+        glUniform1f(0, force_scale);
+        dispatchMasses();
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+    else
+    {
+        glUseProgram(programIDs.springs);
+        for (GLuint i = 0; i < 8; i++)
+        {
+            glUniform1ui(0, i);
+            // The blocks next to an awake one, after the masses' dispatch arguments
+            if (options.sleeping)
+                glDispatchComputeIndirect(3 * sizeof(GLuint));
+            else
+                dispatchItems(getBlockCount());
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        }
+    }
+
+    // Apply forces
+    if (options.fused_update)
+    {
+        // Gravity, integration, collisions and corrections, reading and writing every mass once
+        float velocity_scale, force_scale;
+        getVerletScales(physics_config, delta_t, last_delta_t, velocity_scale, force_scale);
+        glUseProgram(programIDs.update_masses);
+        glUniform1f(0, velocity_scale);
+        glUniform1f(1, force_scale);
+        glUniform1f(2, last_delta_t);
+        glUniform1ui(3, collect_stats);
+        dispatchMasses();
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        last_delta_t = delta_t;
+
+        if (options.sleeping)
+            sleepGPU();
+        return;
+    }
+    else if (options.integrator == Integrator::Implicit)
+    {
+        integrateImplicitGPU();
+    }
+    else
+    {
+        float velocity_scale, force_scale;
+        getVerletScales(physics_config, delta_t, last_delta_t, velocity_scale, force_scale);
+        glUseProgram(programIDs.integrate);
+        glUniform1f(0, velocity_scale);
+        glUniform1f(1, force_scale);
+        glUniform1f(2, last_delta_t);
+        glUniform1ui(3, collect_stats);
+        dispatchMasses();
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+    last_delta_t = delta_t;
+
+    if (options.integrator == Integrator::XPBD)
+        constrainGPU();
+
+    // Collide
+    glUseProgram(programIDs.collide);
+    dispatchMasses();
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    if (options.body_contacts)
+        collideBodiesGPU();
+
+    if (options.self_collisions)
+        collideSelfGPU();
+
+    // Apply corrections
+    glUseProgram(programIDs.correct);
+    dispatchMasses();
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    if (options.sleeping)
+        sleepGPU();
+}
+
+void Simulator::stepPersistentGPU(size_t steps)
+{
+    // dt is fixed, so every substep takes the same scales
+    float velocity_scale, force_scale;
+    getVerletScales(physics_config, delta_t, last_delta_t, velocity_scale, force_scale);
+    glUseProgram(programIDs.persistent_step);
+    glUniform1f(0, velocity_scale);
+    glUniform1f(1, force_scale);
+    glUniform1ui(2, steps);
+    glDispatchCompute(std::min<GLuint>(bodies.size(), max_work_groups[0]), 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    last_delta_t = delta_t;
+}
+
+void Simulator::dispatchItems(size_t count)
+{
+    // The shaders walk every invocation of the dispatch in grid-stride loops, so whatever does not fit is looped over
+    size_t groups = std::max<size_t>((count + options.local_size - 1) / options.local_size, 1);
+    GLuint x = std::min<size_t>(groups, max_work_groups[0]);
+    GLuint y = std::min<size_t>((groups + x - 1) / x, max_work_groups[1]);
+    GLuint z = std::min<size_t>((groups + (size_t)x * y - 1) / ((size_t)x * y), max_work_groups[2]);
+    glDispatchCompute(x, y, z);
+}
+
+void Simulator::dispatchMasses()
+{
+    if (options.sleeping)
+        glDispatchComputeIndirect(0);
+    else
+        dispatchItems(GPU_data.jello.position_count);
+}
+
+void Simulator::sleepGPU()
+{
+    GLuint block_count = getBlockCount();
+
+    // Bodies the contacts touched wake, and those the last update left without an awake block fall asleep, before the
+    // block passes skip over their blocks
+    glUseProgram(programIDs.sleep_bodies);
+    dispatchItems(bodies.size());
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    glUseProgram(programIDs.sleep_energy);
+    glUniform1f(0, delta_t);
+    dispatchItems(block_count);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    glUseProgram(programIDs.sleep_update);
+    dispatchItems(block_count);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    // Empty lists for sleep_compact.comp to append to, which grows the three dispatches with them
+    GLuint dispatch[active_header]{0, 1, 1, 0, 1, 1, 0, 1, 1, 0, 0};
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.active);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(dispatch), dispatch);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    glUseProgram(programIDs.sleep_compact);
+    dispatchItems(block_count);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+}
+
+void Simulator::collideBodiesGPU()
+{
+    GLuint table_size = contact_surface.table_size;
+    GLuint zero = 0;
+
+    // Count the triangles of every cell, sum the counts into where each cell starts, then count again while filling them in
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.contact_cells);
+    glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, sizeof(GLuint) * table_size, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+
+    glUseProgram(programIDs.contact_count);
+    dispatchItems(contact_surface.triangles.size());
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    // Within every workgroup's cells, across the workgroups' totals, then adding those back in
+    glUseProgram(programIDs.contact_scan);
+    for (GLuint pass = 0; pass < 3; pass++)
+    {
+        glUniform1ui(0, pass);
+        glDispatchCompute(pass == 1 ? 1 : table_size / contact_scan_width, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+    }
+
+    glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, sizeof(GLuint) * table_size, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    // The counts are cleared again by the next step
+    glUseProgram(programIDs.contact_fill);
+    dispatchItems(contact_surface.triangles.size());
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    glUseProgram(programIDs.contact_resolve);
+    dispatchItems(contact_surface.points.size());
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void Simulator::collideSelfGPU()
+{
+    // Every level from its children below, deepest first
+    glUseProgram(programIDs.bvh_refit);
+    for (size_t level = surface_bvh.level_offsets.size() - 1; level-- > 0;)
+    {
+        glUniform1ui(0, surface_bvh.level_offsets[level]);
+        glUniform1ui(1, surface_bvh.level_offsets[level + 1]);
+        dispatchItems(surface_bvh.level_offsets[level + 1] - surface_bvh.level_offsets[level]);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+
+    // Reading the boxes back stalls on the steps in flight, so only every few steps. A looser tree than the build left
+    // is rebuilt on the CPU from the current positions.
+    if (++bvh_check_steps >= self_collision_config.check_interval)
+    {
+        bvh_check_steps = 0;
+        std::vector<BVHNode> nodes(surface_bvh.nodes.size());
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.bvh_nodes);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(BVHNode) * nodes.size(), nodes.data());
+        if (getSurfaceBVHCost(nodes.data(), nodes.size()) > self_collision_config.rebuild_ratio * surface_bvh.build_cost)
+        {
+            std::vector<glm::vec4> positions(GPU_data.jello.position_count);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.positions);
+            glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(glm::vec4) * positions.size(), positions.data());
+            buildSurfaceBVH(contact_surface, physics_config, rest_positions.data(), positions.data(), self_collision_config.leaf_size,
+                            self_collision_config.exclusion * contact_surface.edge_length, surface_bvh);
+            bvh_rebuilds++;
+
+            // The same number of nodes and levels for the same triangles, only their order and boxes change
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.bvh_nodes);
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(BVHNode) * surface_bvh.nodes.size(), surface_bvh.nodes.data());
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.bvh_triangles);
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint) * surface_bvh.triangles.size(), surface_bvh.triangles.data());
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.bvh_rest_spheres);
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(glm::vec4) * surface_bvh.rest_spheres.size(), surface_bvh.rest_spheres.data());
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.bvh_planes);
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(glm::vec4) * surface_bvh.planes.size(), surface_bvh.planes.data());
+            glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    glUseProgram(programIDs.self_collide);
+    dispatchItems(contact_surface.points.size());
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void Simulator::resetSleep()
+{
+    size_t block_count = getBlockCount();
+
+    // energy, quiet steps, asleep, padding
+    std::vector<GLuint> states(block_count * 4, 0);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.block_states);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint) * states.size(), states.data());
+
+    // asleep, wake, woken, awake blocks: every body awake with all of its blocks
+    std::vector<GLuint> body_states(bodies.size() * 4, 0);
+    for (size_t body = 0; body < bodies.size(); body++)
+        body_states[body * 4 + 3] = bodies[body].block_count;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.body_states);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint) * body_states.size(), body_states.data());
+
+    // Every mass and every spring block, in buffer order, and enough workgroups for them up to the driver's limit
+    auto getGroups = [&](size_t count, size_t per_group)
+    {
+        return (GLuint)std::min<size_t>(std::max<size_t>((count + per_group - 1) / per_group, 1), max_work_groups[0]);
+    };
+    std::vector<GLuint> active(active_header + GPU_data.jello.position_count + block_count);
+    GLuint dispatch[active_header]{getGroups(GPU_data.jello.position_count, options.local_size), 1, 1, getGroups(block_count, options.local_size), 1, 1,
+                                   getGroups(block_count, 1), 1, 1, (GLuint)GPU_data.jello.position_count, (GLuint)block_count};
+    std::copy(dispatch, dispatch + active_header, active.begin());
+    for (size_t i = 0; i < GPU_data.jello.position_count; i++)
+        active[active_header + i] = i;
+    for (size_t i = 0; i < block_count; i++)
+        active[active_header + GPU_data.jello.position_count + i] = i;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.active);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint) * active.size(), active.data());
+
+    // Sleeping masses may hold forces from the springs of awake neighbours
+    std::vector<glm::vec4> forces(GPU_data.jello.position_count, glm::vec4(0.0f));
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.forces);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(glm::vec4) * forces.size(), forces.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void Simulator::integrateImplicitGPU()
+{
+    // Same solve as CPUBackend::integrateImplicit(), for a fixed number of iterations so nothing is read back.
+    // Solver vectors: 1 dv, 2 residual, 3 preconditioned residual, 4 direction, 5 product.
+    glUseProgram(programIDs.implicit_setup);
+    glUniform1f(0, delta_t);
+    glUniform1f(1, last_delta_t);
+    dispatchItems(GPU_data.jello.position_count);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    glUseProgram(programIDs.implicit_dot);
+    glUniform1ui(0, 2);
+    glUniform1ui(1, 3);
+    glUniform1ui(2, 1);
+    glDispatchCompute(1, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    for (GLuint iteration = 0; iteration < implicit_config.max_iterations; iteration++)
+    {
+        glUseProgram(programIDs.implicit_apply);
+        glUniform1f(0, delta_t);
+        dispatchItems(GPU_data.jello.position_count);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        glUseProgram(programIDs.implicit_dot);
+        glUniform1ui(0, 4);
+        glUniform1ui(1, 5);
+        glUniform1ui(2, 0);
+        glDispatchCompute(1, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        glUseProgram(programIDs.implicit_update);
+        glUniform1ui(0, iteration);
+        dispatchItems(GPU_data.jello.position_count);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        glUseProgram(programIDs.implicit_dot);
+        glUniform1ui(0, 2);
+        glUniform1ui(1, 3);
+        glUniform1ui(2, 1 + (iteration + 1) % 2);
+        glDispatchCompute(1, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        glUseProgram(programIDs.implicit_direction);
+        glUniform1ui(0, iteration);
+        dispatchItems(GPU_data.jello.position_count);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+
+    glUseProgram(programIDs.implicit_finish);
+    glUniform1f(0, delta_t);
+    glUniform1f(1, getDamping(physics_config, delta_t));
+    dispatchItems(GPU_data.jello.position_count);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void Simulator::constrainGPU()
+{
+    if (options.constraint_solver == ConstraintSolver::Jacobi)
+    {
+        constrainJacobiGPU();
+        return;
+    }
+
+    // Same sweeps as CPUBackend::constrain(), one invocation per block, one pass per color
+    glUseProgram(programIDs.constrain);
+    glUniform1f(2, delta_t);
+    for (GLuint iteration = 0; iteration < options.constraint_iterations; iteration++)
+    {
+        glUniform1ui(1, iteration);
+        for (GLuint i = 0; i < 8; i++)
+        {
+            glUniform1ui(0, i);
+            dispatchItems(getBlockCount());
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        }
+    }
+}
+
+void Simulator::constrainJacobiGPU()
+{
+    // Same sweeps as CPUBackend::constrainJacobi(): one pass over the masses into the solver buffer,
+    // one applying the Chebyshev update back to the positions and multipliers, and the residual sum
+    XPBDConfig config;
+    config.spectral_radius = options.spectral_radius;
+    float omega = 1;
+    for (GLuint iteration = 0; iteration < options.constraint_iterations; iteration++)
+    {
+        omega = getChebyshevOmega(config, iteration, omega);
+
+        glUseProgram(programIDs.constrain_jacobi);
+        glUniform1f(0, delta_t);
+        glUniform1ui(1, iteration);
+        glUniform1f(2, config.relaxation);
+        glUniform1ui(3, adjacency_count);
+        dispatchItems(GPU_data.jello.position_count);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        glUseProgram(programIDs.constrain_residual);
+        glUniform1ui(0, iteration);
+        glUniform1ui(1, adjacency_count / 2);
+        glDispatchCompute(1, 1, 1);
+
+        glUseProgram(programIDs.constrain_chebyshev);
+        glUniform1f(0, omega);
+        glUniform1ui(1, adjacency_count);
+        dispatchItems(GPU_data.jello.position_count);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+}
+
+void Simulator::resizeConstraintResiduals()
+{
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.solver_scalars);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLfloat) * std::max(options.constraint_iterations, 1u), NULL, GL_DYNAMIC_READ);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 13, buffers.solver_scalars);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+size_t Simulator::scheduleSubsteps()
+{
+    size_t substeps = options.substeps;
+    if (options.real_time)
+    {
+        auto now = std::chrono::steady_clock::now();
+        if (frame_count)
+        {
+            // A long stall skips simulated time rather than stepping until the simulation catches up
+            accumulator += std::min(std::chrono::duration<double>(now - last_frame).count(), 0.25);
+        }
+        last_frame = now;
+
+        substeps = accumulator / delta_t;
+        accumulator -= substeps * delta_t;
+        render_alpha = accumulator / delta_t;
+    }
+
+    if (options.steps)
+        substeps = std::min(substeps, options.steps - step_count);
+
+    return substeps;
+}
+
+void Simulator::stepCPU(size_t steps)
+{
+    for (size_t i = 0; i < steps; i++)
+    {
+        if (options.adaptive_dt && i + 1 == steps)
+            cpu_backend.collectStepStats();
+        cpu_backend.step();
+    }
+
+    if (options.headless)
+        return;
+
+    // Rendering reads the positions SSBOs, as it does after GPU steps
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.positions);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(glm::vec4) * GPU_data.jello.position_count, cpu_backend.getPositions());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.last_positions);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(glm::vec4) * GPU_data.jello.position_count, cpu_backend.getLastPositions());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+int Simulator::initTimestep()
+{
+    if (!options.adaptive_dt)
+        return 0;
+
+    float stiffness, min_length;
+    getSpringBounds(getSimulationData(), physics_config, stiffness, min_length);
+    timestep.init(TimestepConfig(), physics_config, stiffness, min_length);
+    delta_t = timestep.getDeltaT();
+    printf("Adaptive dt: stiffness bound %g s\n", timestep.getStableDeltaT());
+
+    if (options.telemetry_path)
+    {
+        telemetry = fopen(options.telemetry_path, "w");
+        if (!telemetry)
+            return -23;
+        fprintf(telemetry, "frame,steps,time,dt,max_speed,max_acceleration\n");
+    }
+
+    return 0;
+}
+
+void Simulator::updateTimestep()
+{
+    StepStats stats;
+    if (options.backend == Backend::CPU)
+    {
+        stats = cpu_backend.getStepStats();
+    }
+    else
+    {
+        // Positive floats order like their bits, the shader keeps the maxima with atomicMax
+        GLuint bits[2];
+        GLuint zero[2]{0, 0};
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.step_stats);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(bits), bits);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zero), zero);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        memcpy(&stats, bits, sizeof(stats));
+    }
+
+    if (telemetry)
+        fprintf(telemetry, "%lu,%lu,%.6f,%g,%g,%g\n", frame_count, step_count, simulated_time, delta_t, stats.max_speed, stats.max_acceleration);
+
+    delta_t = timestep.update(stats);
+}
+
+void Simulator::validateStep(size_t steps)
+{
+    // Expects GPU_data.jello.positions to hold the GPU state, as left by updateNormals()
+    for (size_t i = 0; i < steps; i++)
+        cpu_backend.step();
+
+    float deviation = 0;
+    const glm::vec4 *cpu_positions = cpu_backend.getPositions();
+    for (size_t i = 0; i < GPU_data.jello.position_count; i++)
+        deviation = std::max(deviation, glm::distance(GPU_data.jello.positions[i], cpu_positions[i]));
+
+    if (frame_count % 100 == 0)
+        printf("Step %lu: max CPU/GPU deviation %g\n", step_count, deviation);
+}
+
+int Simulator::initModal()
+{
+    if (options.integrator != Integrator::Modal)
+        return 0;
+
+    // reconstruct.comp deforms the rest shape by at least one mode
+    if (options.modes == 0)
+        return -57;
+
+    ModalConfig config;
+    config.modes = options.modes;
+
+    // Every body gets its own modes from its own springs, which follow each other body by body like its masses. A body
+    // of the same size as an earlier one copies that one's modes and moves it over.
+    SimulationData data = getSimulationData();
+    modal_bodies.assign(bodies.size(), ModalBody());
+    size_t shapes = 0;
+    for (size_t body = 0; body < bodies.size(); body++)
+    {
+        const BodyRange &range = bodies[body];
+        const BodyConfig &body_config = body_configs[body];
+        size_t same = 0;
+        while (same < body && (body_configs[same].masses_x != body_config.masses_x || body_configs[same].masses_y != body_config.masses_y ||
+                               body_configs[same].masses_z != body_config.masses_z || body_configs[same].width != body_config.width ||
+                               body_configs[same].height != body_config.height || body_configs[same].depth != body_config.depth))
+            same++;
+        if (same < body)
+        {
+            modal_bodies[body] = modal_bodies[same];
+            modal_bodies[body].translate(glm::vec3(data.positions[range.first_mass] - data.positions[bodies[same].first_mass]));
+            continue;
+        }
+
+        std::vector<Spring> springs;
+        for (size_t i = data.spring_groups[range.first_block * 8]; i < data.spring_groups[(range.first_block + range.block_count) * 8]; i++)
+        {
+            Spring spring = data.springs[i];
+            if (spring.type == 0)
+                continue;
+            spring.point1 -= range.first_mass;
+            spring.point2 -= range.first_mass;
+            springs.push_back(spring);
+        }
+
+        SimulationData body_data = data;
+        body_data.positions = data.positions + range.first_mass;
+        body_data.position_count = range.mass_count;
+        body_data.springs = springs.data();
+        body_data.spring_count = springs.size();
+        int errorCode = modal_bodies[body].init(body_data, physics_config, config);
+        if (errorCode)
+            return errorCode;
+        shapes++;
+    }
+
+    const ModalBody &first = modal_bodies[0];
+    const std::vector<float> &frequencies = first.getFrequencies();
+    printf("Modal body: %lu modes from %.2f to %.2f Hz, found in %u iterations, %.3f s\n", first.getModeCount(),
+           frequencies.empty() ? 0.0 : frequencies.front() / (2 * M_PI), frequencies.empty() ? 0.0 : frequencies.back() / (2 * M_PI),
+           first.getSetupIterations(), first.getSetupTime());
+    if (bodies.size() > 1)
+        printf("%lu modal bodies, %lu of them with modes of their own\n", bodies.size(), shapes);
+
     return 0;
 }
 
-int Simulator::run()
+void Simulator::stepModal(size_t steps)
 {
-    // Clear screen
-    glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    for (size_t i = 0; i < steps; i++)
+        for (ModalBody &body : modal_bodies)
+            body.step(delta_t);
 
-    // Add gravity
-    glUseProgram(programIDs.gravity);
-    glDispatchCompute(GPU_data.jello.position_count, 1, 1);
-    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    if (!options.headless)
+        reconstructGPU();
+}
 
-    // Apply springs
-    glUseProgram(programIDs.springs);
-    for (GLuint i = 0; i < 8; i++)
+void Simulator::reconstructGPU()
+{
+    // The state of every body after the last step, then before it, behind the basis
+    size_t modes = getModalModeCount(), state_size = getModalStateSize(modes);
+    std::vector<glm::vec4> states(2 * bodies.size() * state_size, glm::vec4(0.0f));
+    for (bool last : {false, true})
     {
-        glUniform1ui(0, i);
-        glDispatchCompute(scene_config.jello.block_width * scene_config.jello.block_height * scene_config.jello.block_depth, 1, 1);
-        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        for (size_t body = 0; body < bodies.size(); body++)
+        {
+            const ModalBody &modal = modal_bodies[body];
+            glm::vec4 *state = &states[(last * bodies.size() + body) * state_size];
+            glm::mat3 rotation = modal.getRotation(last);
+            state[0] = glm::vec4(modal.getCenter(last), 0.0f);
+            for (int column = 0; column < 3; column++)
+                state[1 + column] = glm::vec4(rotation[column], 0.0f);
+            const std::vector<float> &coordinates = modal.getCoordinates(last);
+            for (size_t k = 0; k < coordinates.size(); k++)
+                state[4 + k / 4][k % 4] = coordinates[k];
+        }
     }
+    size_t first_state = (modes + 1) * GPU_data.jello.position_count;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.modal_basis);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(glm::vec4) * first_state, sizeof(glm::vec4) * states.size(), states.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
-    // Apply forces
-    glUseProgram(programIDs.integrate);
-    glDispatchCompute(GPU_data.jello.position_count, 1, 1);
-    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    glUseProgram(programIDs.reconstruct);
+    for (bool last : {true, false})
+    {
+        // The state before the last step only matters to the interpolation between the two
+        if (last && !options.real_time)
+            continue;
 
-    // Collide
-    glUseProgram(programIDs.collide);
-    glDispatchCompute(GPU_data.jello.position_count, 1, 1);
-    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, last ? buffers.last_positions : buffers.positions);
+        glUniform1ui(0, first_state + (last ? bodies.size() * state_size : 0));
+        dispatchItems(GPU_data.jello.position_count);
+    }
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, buffers.positions);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+}
 
-    // Apply corrections
-    glUseProgram(programIDs.correct);
-    glDispatchCompute(GPU_data.jello.position_count, 1, 1);
-    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+size_t Simulator::getModalModeCount() const
+{
+    // reconstruct.comp takes every body through as many modes as the one with the most, at least one
+    size_t modes = 1;
+    for (const ModalBody &body : modal_bodies)
+        modes = std::max(modes, body.getModeCount());
+    return modes;
+}
 
-    // Render
-    updateNormals();
+int Simulator::initBackend()
+{
+    if ((options.backend != Backend::CPU && !options.validate) || options.integrator == Integrator::Modal)
+        return 0;
+
+    CPUBackendConfig config;
+    config.threads = options.threads;
+    config.spring_isa = options.spring_isa;
+    config.accumulation = options.accumulation;
+    config.formulation = options.formulation;
+    config.integrator = options.integrator;
+    config.implicit = implicit_config;
+    config.xpbd.iterations = options.constraint_iterations;
+    config.xpbd.solver = options.constraint_solver;
+    config.xpbd.spectral_radius = options.spectral_radius;
+    config.projective.iterations = options.constraint_iterations;
+    config.body_contacts = options.body_contacts;
+    config.broad_phase = options.contact_broad_phase;
+    config.self_collisions = options.self_collisions;
+    config.self_collision = self_collision_config;
+    config.fused_update = options.fused_update;
+
+    int errorCode = cpu_backend.init(getSimulationData(), physics_config, config);
+    if (errorCode)
+        return errorCode;
 
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.positions);
-    glBindBuffer(GL_ARRAY_BUFFER, buffers.vertices);
-    glCopyBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_ARRAY_BUFFER, 0, 0, sizeof(glm::vec4) * GPU_data.jello.position_count);
-    glCopyBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_ARRAY_BUFFER, 0, sizeof(glm::vec4) * GPU_data.jello.position_count, sizeof(glm::vec4) * GPU_data.jello.position_count);
-    glCopyBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_ARRAY_BUFFER, 0, 2 * sizeof(glm::vec4) * GPU_data.jello.position_count, sizeof(glm::vec4) * GPU_data.jello.position_count);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    if (cpu_backend.getSpringFormulation() != SpringFormulation::Scatter)
+        printf("CPU backend: %u threads, %s springs, %s integration\n", cpu_backend.getThreadCount(), getSpringFormulationName(cpu_backend.getSpringFormulation()), getIntegratorName(options.integrator));
+    else
+        printf("CPU backend: %u threads, %s springs, %s accumulation, %s integration\n", cpu_backend.getThreadCount(), getSpringISAName(cpu_backend.getSpringISA()), getSpringAccumulationName(cpu_backend.getSpringAccumulation()), getIntegratorName(options.integrator));
 
-    glUseProgram(programIDs.render);
+    if (options.integrator == Integrator::Projective)
+    {
+        const SparseCholesky &system = cpu_backend.getProjectiveSystem();
+        printf("Projective system: %lu masses, factor of %lu entries (%.1f MB) in %lu supernodes, %.3f s\n", system.getSize(), system.getFactorNonzeros(),
+               system.getFactorNonzeros() * sizeof(double) / 1e6, system.getSupernodeCount(), cpu_backend.getFactorTime());
+    }
 
-    glUniform1f(0, scene_config.light_position.x);
-    glUniform1f(1, scene_config.light_position.y);
-    glUniform1f(2, scene_config.light_position.z);
-    glUniform1f(3, scene_config.light_position.w);
+    return 0;
+}
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers.faces);
-    glDrawElements(GL_TRIANGLES, sizeof(Face) * (GPU_data.jello.face_count + GPU_data.planes.face_count + GPU_data.spheres.face_count), GL_UNSIGNED_INT, 0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+const PhysicsConfig &Simulator::getPhysicsConfig() const
+{
+    return physics_config;
+}
 
-    // Update window
-    glfwSwapBuffers(window);
-    glfwPollEvents();
+const std::vector<GLuint> &Simulator::getMassRanks() const
+{
+    return mass_ranks;
+}
 
-    getErrors("Run");
+const std::vector<BodyRange> &Simulator::getBodies() const
+{
+    return bodies;
+}
 
-    return 0;
+unsigned Simulator::getBVHRebuilds() const
+{
+    if (options.backend == Backend::CPU)
+        return cpu_backend.getSelfCollisionStats().rebuilds;
+    return bvh_rebuilds;
+}
+
+SimulationData Simulator::getSimulationData() const
+{
+    SimulationData data;
+    data.positions = GPU_data.jello.positions;
+    data.position_count = GPU_data.jello.position_count;
+    data.springs = GPU_data.jello.springs;
+    data.spring_count = GPU_data.jello.spring_count;
+    data.spring_groups = GPU_data.jello.spring_groups;
+    data.block_count = getBlockCount();
+    data.planes = scene_config.planes;
+    data.planes_count = scene_config.planes_count;
+    data.spheres = scene_config.spheres;
+    data.spheres_count = scene_config.spheres_count;
+
+    float spring_lengths[6];
+    getSpringLengths(spring_lengths);
+    data.lattice = buildLatticeConfig(scene_config.jello.masses_x, scene_config.jello.masses_y, scene_config.jello.masses_z, spring_lengths,
+                                      scene_config.jello.block_length);
+    data.faces = contact_faces.data();
+    data.face_count = contact_faces.size();
+    data.mass_bodies = mass_bodies.data();
+    return data;
 }
 
 void Simulator::updateNormals()
@@ -171,9 +1143,154 @@ void Simulator::updateNormals()
 
 bool Simulator::running() const
 {
+    if (options.steps && step_count >= options.steps)
+        return false;
+
+    if (options.headless)
+        return true;
+
     return glfwGetKey(window, GLFW_KEY_ESCAPE) != GLFW_PRESS && !glfwWindowShouldClose(window);
 }
 
+void Simulator::wake()
+{
+    if (options.sleeping && !options.headless)
+        resetSleep();
+}
+
+size_t Simulator::getActiveMassCount()
+{
+    if (!options.sleeping || options.headless)
+        return GPU_data.jello.position_count;
+
+    GLuint count;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.active);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, (active_header - 2) * sizeof(GLuint), sizeof(count), &count);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    return count;
+}
+
+size_t Simulator::getStepCount() const
+{
+    return step_count;
+}
+
+size_t Simulator::getFrameCount() const
+{
+    return frame_count;
+}
+
+const glm::vec4 *Simulator::readPositions()
+{
+    if (options.integrator == Integrator::Modal && options.headless)
+    {
+        for (size_t body = 0; body < bodies.size(); body++)
+            modal_bodies[body].reconstruct(GPU_data.jello.positions + bodies[body].first_mass);
+        return GPU_data.jello.positions;
+    }
+
+    if (options.backend == Backend::CPU && options.integrator != Integrator::Modal)
+        return cpu_backend.getPositions();
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.positions);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(glm::vec4) * GPU_data.jello.position_count, GPU_data.jello.positions);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    return GPU_data.jello.positions;
+}
+
+double Simulator::getSimulatedTime() const
+{
+    return simulated_time;
+}
+
+float Simulator::getDeltaT() const
+{
+    return delta_t;
+}
+
+unsigned Simulator::getSolverIterations() const
+{
+    return cpu_backend.getSolverIterations();
+}
+
+const CPUBackend &Simulator::getCPUBackend() const
+{
+    return cpu_backend;
+}
+
+const std::vector<ModalBody> &Simulator::getModalBodies() const
+{
+    return modal_bodies;
+}
+
+void Simulator::setConstraintIterations(unsigned iterations)
+{
+    options.constraint_iterations = iterations;
+    cpu_backend.setConstraintIterations(iterations);
+    if (options.backend == Backend::GPU && options.integrator == Integrator::XPBD && options.constraint_solver == ConstraintSolver::Jacobi)
+        resizeConstraintResiduals();
+}
+
+std::vector<float> Simulator::getConstraintResiduals()
+{
+    if (options.backend == Backend::CPU)
+        return cpu_backend.getConstraintResiduals();
+
+    std::vector<float> residuals;
+    if (options.integrator != Integrator::XPBD || options.constraint_solver != ConstraintSolver::Jacobi)
+        return residuals;
+
+    residuals.resize(options.constraint_iterations);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.solver_scalars);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLfloat) * residuals.size(), residuals.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    return residuals;
+}
+
+double Simulator::timeSteps(size_t steps)
+{
+    if (options.integrator == Integrator::Modal)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < steps; i++)
+            for (ModalBody &body : modal_bodies)
+                body.step(delta_t);
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / steps;
+    }
+
+    if (options.backend == Backend::CPU)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < steps; i++)
+            cpu_backend.step();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / steps;
+    }
+
+    GLuint query;
+    GLuint64 elapsed;
+    glGenQueries(1, &query);
+    glBeginQuery(GL_TIME_ELAPSED, query);
+    if (options.persistent)
+    {
+        // A dispatch per frame of substeps, as run() takes them
+        size_t substeps = std::max(options.substeps, 1u);
+        for (size_t i = 0; i < steps; i += substeps)
+            stepPersistentGPU(std::min(substeps, steps - i));
+    }
+    else
+    {
+        for (size_t i = 0; i < steps; i++)
+            stepGPU();
+    }
+    glEndQuery(GL_TIME_ELAPSED);
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+    glDeleteQueries(1, &query);
+
+    getErrors("Timing");
+
+    return elapsed * 1e-9 / steps;
+}
+
 int Simulator::initGL()
 {
     if (!glfwInit())
@@ -196,24 +1313,123 @@ int Simulator::initGL()
     return 0;
 }
 
-int Simulator::makeCpuBuffers()
+void Simulator::setJello(const BodyConfig &body)
+{
+    scene_config.jello.x = body.x;
+    scene_config.jello.y = body.y;
+    scene_config.jello.z = body.z;
+    scene_config.jello.masses_x = body.masses_x;
+    scene_config.jello.masses_y = body.masses_y;
+    scene_config.jello.masses_z = body.masses_z;
+    scene_config.jello.width = body.width;
+    scene_config.jello.height = body.height;
+    scene_config.jello.depth = body.depth;
+    scene_config.jello.block_width = std::ceil((float)scene_config.jello.masses_x / scene_config.jello.block_length);
+    scene_config.jello.block_height = std::ceil((float)scene_config.jello.masses_y / scene_config.jello.block_length);
+    scene_config.jello.block_depth = std::ceil((float)scene_config.jello.masses_z / scene_config.jello.block_length);
+}
+
+int Simulator::constructBodies()
 {
-    GPU_data.position_count = cube_config.masses_x * cube_config.masses_y * cube_config.masses_z;
-    GPU_data.spring_count = cube_config.block_width * cube_config.block_height * cube_config.block_depth * cube_config.block_length * cube_config.block_length * cube_config.block_length * 12;    
-    GPU_data.face_count = ((cube_config.masses_x - 1) * (cube_config.masses_y - 1) + (cube_config.masses_y - 1) * (cube_config.masses_z - 1) + (cube_config.masses_z - 1) * (cube_config.masses_x - 1)) * 4; 
-    
-    // create lighting buffers 
-    if (light->createCpuBuffers(GPU_data.position_count, GPU_data.face_count)) return 1;
-    
-    // buffer allocation  
-    GPU_data.positions = light->pos;
-    if (!GPU_data.positions) return 1;
-    
-    GPU_data.faces = light->faces;
-    if (!GPU_data.faces) return 1;
+    size_t total = 0;
+    for (const BodyConfig &body : body_configs)
+        total += body.masses_x * body.masses_y * body.masses_z;
+
+    // Masses, springs and spring groups follow each other body by body, so every pass runs over all of them at once.
+    // Blocks of one color still share no masses across bodies, and faces keep indexing one of three copies of every mass.
+    std::vector<glm::vec4> positions, colors(total * 3);
+    std::vector<Spring> springs;
+    std::vector<GLuint> spring_groups{0};
+    std::vector<Face> faces;
+    bool spring_buffer = false;
+    bodies.clear();
+    for (const BodyConfig &body : body_configs)
+    {
+        setJello(body);
+        int errorCode = constructCube();
+        if (errorCode)
+            return errorCode;
+
+        BodyRange range;
+        range.first_mass = positions.size();
+        range.mass_count = GPU_data.jello.position_count;
+        range.first_block = bodies.empty() ? 0 : bodies.back().first_block + bodies.back().block_count;
+        range.block_count = scene_config.jello.block_width * scene_config.jello.block_height * scene_config.jello.block_depth;
+        range.first_face = faces.size();
+        range.face_count = GPU_data.jello.face_count;
+        bodies.push_back(range);
+
+        size_t count = range.mass_count;
+        positions.insert(positions.end(), GPU_data.jello.positions, GPU_data.jello.positions + count);
+        for (size_t copy = 0; copy < 3; copy++)
+            std::copy(GPU_data.jello.colors + copy * count, GPU_data.jello.colors + (copy + 1) * count, colors.begin() + copy * total + range.first_mass);
+
+        if (GPU_data.jello.spring_groups)
+        {
+            spring_buffer = true;
+            size_t first_spring = springs.size();
+            for (size_t i = 0; i < GPU_data.jello.spring_count; i++)
+            {
+                Spring spring = GPU_data.jello.springs[i];
+                spring.point1 += range.first_mass;
+                spring.point2 += range.first_mass;
+                springs.push_back(spring);
+            }
+            for (size_t i = 1; i <= GPU_data.jello.spring_group_count; i++)
+                spring_groups.push_back(first_spring + GPU_data.jello.spring_groups[i]);
+        }
+
+        auto remap = [&](GLuint index)
+        {
+            return (GLuint)(index / count * total + range.first_mass + index % count);
+        };
+        for (size_t i = 0; i < GPU_data.jello.face_count; i++)
+        {
+            Face face = GPU_data.jello.faces[i];
+            faces.push_back(Face(remap(face.index1), remap(face.index2), remap(face.index3)));
+        }
 
-    GPU_data.springs = (Spring *)malloc(sizeof(Spring) * GPU_data.spring_count);
-    if (!GPU_data.springs) return 1;
+        free(GPU_data.jello.positions);
+        free(GPU_data.jello.normals);
+        free(GPU_data.jello.colors);
+        free(GPU_data.jello.springs);
+        free(GPU_data.jello.spring_groups);
+        free(GPU_data.jello.faces);
+        GPU_data.jello.springs = nullptr;
+        GPU_data.jello.spring_groups = nullptr;
+    }
+    setJello(body_configs[0]);
+
+    GPU_data.jello.position_count = total;
+    GPU_data.jello.positions = (glm::vec4 *)malloc(sizeof(glm::vec4) * total);
+    std::copy(positions.begin(), positions.end(), GPU_data.jello.positions);
+    GPU_data.jello.vertex_count = total * 3;
+    GPU_data.jello.normal_count = total * 3;
+    GPU_data.jello.color_count = total * 3;
+    GPU_data.jello.normals = (glm::vec4 *)malloc(sizeof(glm::vec4) * total * 3);
+    GPU_data.jello.colors = (glm::vec4 *)malloc(sizeof(glm::vec4) * total * 3);
+    std::copy(colors.begin(), colors.end(), GPU_data.jello.colors);
+    GPU_data.jello.face_count = faces.size();
+    GPU_data.jello.faces = (Face *)malloc(sizeof(Face) * faces.size());
+    std::copy(faces.begin(), faces.end(), GPU_data.jello.faces);
+
+    // The same faces over the masses themselves, for contacts
+    contact_faces.resize(faces.size());
+    for (size_t i = 0; i < faces.size(); i++)
+        contact_faces[i] = Face(faces[i].index1 % total, faces[i].index2 % total, faces[i].index3 % total);
+    mass_bodies.resize(total);
+    for (size_t body = 0; body < bodies.size(); body++)
+        std::fill(mass_bodies.begin() + bodies[body].first_mass, mass_bodies.begin() + bodies[body].first_mass + bodies[body].mass_count, body);
+
+    GPU_data.jello.spring_count = springs.size();
+    GPU_data.jello.spring_group_count = spring_groups.size() - 1;
+    if (spring_buffer)
+    {
+        GPU_data.jello.springs = (Spring *)malloc(sizeof(Spring) * std::max<size_t>(springs.size(), 1));
+        std::copy(springs.begin(), springs.end(), GPU_data.jello.springs);
+        GPU_data.jello.spring_groups = (GLuint *)malloc(sizeof(GLuint) * spring_groups.size());
+        std::copy(spring_groups.begin(), spring_groups.end(), GPU_data.jello.spring_groups);
+    }
 
     return 0;
 }
@@ -228,24 +1444,23 @@ int Simulator::constructCube()
     GPU_data.jello.colors = (glm::vec4 *)malloc(sizeof(glm::vec4) * GPU_data.jello.color_count);
     GPU_data.jello.face_count = ((scene_config.jello.masses_x - 1) * (scene_config.jello.masses_y - 1) + (scene_config.jello.masses_y - 1) * (scene_config.jello.masses_z - 1) + (scene_config.jello.masses_z - 1) * (scene_config.jello.masses_x - 1)) * 4;
     GPU_data.jello.faces = (Face *)malloc(sizeof(Face) * GPU_data.jello.face_count);
-    GPU_data.jello.spring_count = scene_config.jello.block_width * scene_config.jello.block_height * scene_config.jello.block_depth * scene_config.jello.block_length * scene_config.jello.block_length * scene_config.jello.block_length * 12;
-    GPU_data.jello.springs = (Spring *)malloc(sizeof(Spring) * GPU_data.jello.spring_count);
 
-    for (int i = 0; i < GPU_data.jello.spring_count; i++)
+    // The lattice formulations derive everything from the grid indices, so no spring buffer is built
+    if (usesSpringBuffer(options.formulation))
     {
-        GPU_data.jello.springs[i] = Spring(0, 1, 0, 1);
+        GPU_data.jello.spring_count = scene_config.jello.block_width * scene_config.jello.block_height * scene_config.jello.block_depth * scene_config.jello.block_length * scene_config.jello.block_length * scene_config.jello.block_length * 12;
+        GPU_data.jello.springs = (Spring *)malloc(sizeof(Spring) * GPU_data.jello.spring_count);
+
+        for (int i = 0; i < GPU_data.jello.spring_count; i++)
+        {
+            GPU_data.jello.springs[i] = Spring(0, 1, 0, 1);
+        }
     }
 
     if (!scene_config.jello.sphere)
     {
-        float spring_lengths[12]{
-            scene_config.jello.width / (scene_config.jello.masses_x - 1),
-            scene_config.jello.height / (scene_config.jello.masses_y - 1),
-            scene_config.jello.depth / (scene_config.jello.masses_z - 1),
-            sqrt(scene_config.jello.width * scene_config.jello.width / ((scene_config.jello.masses_x - 1) * (scene_config.jello.masses_x - 1)) + scene_config.jello.height * scene_config.jello.height / ((scene_config.jello.masses_y - 1) * (scene_config.jello.masses_y - 1))),
-            sqrt(scene_config.jello.width * scene_config.jello.width / ((scene_config.jello.masses_x - 1) * (scene_config.jello.masses_x - 1)) + scene_config.jello.depth * scene_config.jello.depth / ((scene_config.jello.masses_z - 1) * (scene_config.jello.masses_z - 1))),
-            sqrt(scene_config.jello.height * scene_config.jello.height / ((scene_config.jello.masses_y - 1) * (scene_config.jello.masses_y - 1)) + scene_config.jello.depth * scene_config.jello.depth / ((scene_config.jello.masses_z - 1) * (scene_config.jello.masses_z - 1))),
-        };
+        float spring_lengths[6];
+        getSpringLengths(spring_lengths);
 
         for (int z = 0; z < scene_config.jello.masses_z; z++)
         {
@@ -261,6 +1476,9 @@ int Simulator::constructCube()
                     GPU_data.jello.colors[getPositionIndex(x, y, z) + GPU_data.jello.position_count] = glm::vec4(0.3, 1.0, 0.3, 1.0);
                     GPU_data.jello.colors[getPositionIndex(x, y, z) + GPU_data.jello.position_count * 2] = glm::vec4(0.3, 1.0, 0.3, 1.0);
 
+                    if (!GPU_data.jello.springs)
+                        continue;
+
                     unsigned spring_index = 12 * ((x % scene_config.jello.block_radius) + scene_config.jello.block_radius * ((y % scene_config.jello.block_radius) + scene_config.jello.block_radius * ((z % scene_config.jello.block_radius) + scene_config.jello.block_radius * (((x / scene_config.jello.block_radius) % 2) + 2 * (((y / scene_config.jello.block_radius) % 2) + 2 * (((z / scene_config.jello.block_radius) % 2) + 2 * ((x / scene_config.jello.block_length) + scene_config.jello.block_width * ((y / scene_config.jello.block_length) + scene_config.jello.block_height * ((z / scene_config.jello.block_length))))))))));
 
                     // (x, y, z) springs to: (x-1, y, z), (x, y-1, z), (x, y, z-1), (x-1, y-1, z), (x-1, y, z-1), (x, y-1, z-1), (x+1, y-1, z), (x-1, y, z+1), (x, y+1, z-1), (x-2, y, z), (x, y-2, z), (x, y, z-2)
@@ -425,6 +1643,25 @@ int Simulator::constructCube()
         }
     }
 
+    if (GPU_data.jello.springs)
+    {
+        unsigned block_size = scene_config.jello.block_radius * scene_config.jello.block_radius * scene_config.jello.block_radius * 12;
+        GPU_data.jello.spring_group_count = scene_config.jello.block_width * scene_config.jello.block_height * scene_config.jello.block_depth * 8;
+        GPU_data.jello.spring_groups = (GLuint *)malloc(sizeof(GLuint) * (GPU_data.jello.spring_group_count + 1));
+
+        if (options.compact_springs)
+        {
+            GPU_data.jello.spring_count = compactSpringGroups(GPU_data.jello.springs, GPU_data.jello.spring_group_count, block_size, GPU_data.jello.spring_groups);
+            if (GPU_data.jello.spring_count)
+                GPU_data.jello.springs = (Spring *)realloc(GPU_data.jello.springs, sizeof(Spring) * GPU_data.jello.spring_count);
+        }
+        else
+        {
+            for (size_t i = 0; i <= GPU_data.jello.spring_group_count; i++)
+                GPU_data.jello.spring_groups[i] = i * block_size;
+        }
+    }
+
     unsigned i = 0;
     unsigned l = 0;
     for (unsigned y = 0; y < scene_config.jello.masses_y - 1; y++)
@@ -463,6 +1700,79 @@ int Simulator::constructCube()
     return 0;
 }
 
+int Simulator::reorderMasses()
+{
+    // Several bodies keep their linear order, one after another
+    if (bodies.size() > 1)
+    {
+        mass_ranks.resize(GPU_data.jello.position_count);
+        for (size_t i = 0; i < mass_ranks.size(); i++)
+            mass_ranks[i] = i;
+        return 0;
+    }
+
+    buildMassOrder(options.mass_order, scene_config.jello.masses_x, scene_config.jello.masses_y, scene_config.jello.masses_z, mass_ranks);
+    if (options.mass_order == MassOrder::Linear)
+        return 0;
+
+    size_t count = GPU_data.jello.position_count;
+    std::vector<glm::vec4> positions(GPU_data.jello.positions, GPU_data.jello.positions + count);
+    std::vector<glm::vec4> colors(GPU_data.jello.colors, GPU_data.jello.colors + count * 3);
+    for (size_t i = 0; i < count; i++)
+    {
+        GPU_data.jello.positions[mass_ranks[i]] = positions[i];
+        for (size_t copy = 0; copy < 3; copy++)
+            GPU_data.jello.colors[mass_ranks[i] + copy * count] = colors[i + copy * count];
+    }
+
+    for (size_t i = 0; i < GPU_data.jello.spring_count; i++)
+    {
+        GPU_data.jello.springs[i].point1 = mass_ranks[GPU_data.jello.springs[i].point1];
+        GPU_data.jello.springs[i].point2 = mass_ranks[GPU_data.jello.springs[i].point2];
+    }
+
+    // Visit the blocks along the same curve, so each color pass walks the masses in memory order.
+    // Blocks of one color still share no masses, so any block order is safe.
+    if (GPU_data.jello.spring_groups)
+    {
+        std::vector<GLuint> block_ranks;
+        buildMassOrder(options.mass_order, scene_config.jello.block_width, scene_config.jello.block_height, scene_config.jello.block_depth, block_ranks);
+
+        std::vector<GLuint> blocks(block_ranks.size());
+        for (size_t i = 0; i < block_ranks.size(); i++)
+            blocks[block_ranks[i]] = i;
+
+        std::vector<Spring> springs(GPU_data.jello.springs, GPU_data.jello.springs + GPU_data.jello.spring_count);
+        std::vector<GLuint> groups(GPU_data.jello.spring_groups, GPU_data.jello.spring_groups + GPU_data.jello.spring_group_count + 1);
+        size_t spring = 0;
+        for (size_t rank = 0; rank < blocks.size(); rank++)
+        {
+            for (size_t color = 0; color < 8; color++)
+            {
+                size_t group = blocks[rank] * 8 + color;
+                GPU_data.jello.spring_groups[rank * 8 + color] = spring;
+                for (size_t i = groups[group]; i < groups[group + 1]; i++)
+                    GPU_data.jello.springs[spring++] = springs[i];
+            }
+        }
+    }
+
+    // Faces index one of three copies of the masses, keep the copy
+    auto remap = [&](GLuint index)
+    {
+        return (GLuint)(mass_ranks[index % count] + index / count * count);
+    };
+    for (size_t i = 0; i < GPU_data.jello.face_count; i++)
+    {
+        Face &face = GPU_data.jello.faces[i];
+        face = Face(remap(face.index1), remap(face.index2), remap(face.index3));
+    }
+    for (Face &face : contact_faces)
+        face = Face(mass_ranks[face.index1], mass_ranks[face.index2], mass_ranks[face.index3]);
+
+    return 0;
+}
+
 int Simulator::constructScene()
 {
     GPU_data.planes.vertex_count = scene_config.planes_count * 3;
@@ -565,14 +1875,110 @@ int Simulator::constructScene()
 
 int Simulator::loadShaders()
 {
-    char prelude[500];
-
-    snprintf(prelude, 500,
-             "#version 460\n#define NUM_POINTS %lu\n#define NUM_PLANES %lu\n#define NUM_SPHERES %lu\n#define BLOCK_SIZE %u\n",
+    // The lattice stencil's rest lengths, in lattice_stencil order
+    float spring_lengths[6];
+    getSpringLengths(spring_lengths);
+    LatticeConfig lattice = buildLatticeConfig(scene_config.jello.masses_x, scene_config.jello.masses_y, scene_config.jello.masses_z, spring_lengths,
+                                               scene_config.jello.block_length);
+    char rest_lengths[400];
+    int length = snprintf(rest_lengths, 400, "float[12](");
+    for (int i = 0; i < 12; i++)
+        length += snprintf(rest_lengths + length, 400 - length, i ? ", %#.9g" : "%#.9g", lattice.rest_lengths[i]);
+    snprintf(rest_lengths + length, 400 - length, ")");
+
+    char prelude[2000];
+
+    snprintf(prelude, 2000,
+             "#version 460\n#define NUM_POINTS %lu\n#define NUM_PLANES %lu\n#define NUM_SPHERES %lu\n#define BLOCK_SIZE %u\n"
+             "#define DELTA_T %#.9g\n#define MASS %#.9g\n#define DAMPING %#.9g\n#define GRAVITY %#.9g\n"
+             "#define STIFFNESS_STRUCTURAL %#.9g\n#define STIFFNESS_SHEARING %#.9g\n#define STIFFNESS_BENDING %#.9g\n"
+             "#define COLLISION_OFFSET %#.9g\n#define COLLISION_RESPONSE %#.9g\n"
+             "#define LATTICE_SIZE ivec3(%u, %u, %u)\n#define LATTICE_REST_LENGTHS %s\n#define MODE_COUNT %lu\n"
+             "#define CLUSTER_LENGTH %u\n#define SHAPE_ITERATIONS %u\n#define SHAPE_STIFFNESS %#.9g\n",
              GPU_data.jello.position_count,
              sizeof(scene_config.planes) / sizeof(glm::vec4),
              sizeof(scene_config.spheres) / sizeof(glm::vec4),
-             scene_config.jello.block_radius * scene_config.jello.block_radius * scene_config.jello.block_radius * 12);
+             scene_config.jello.block_radius * scene_config.jello.block_radius * scene_config.jello.block_radius * 12,
+             physics_config.delta_t, physics_config.mass, physics_config.damping, physics_config.gravity,
+             physics_config.stiffness[1], physics_config.stiffness[2], physics_config.stiffness[3],
+             physics_config.collision_offset, physics_config.collision_response,
+             lattice.masses_x, lattice.masses_y, lattice.masses_z, rest_lengths, getModalModeCount(),
+             lattice.cluster_length, lattice.shape_iterations, physics_config.shape_stiffness);
+
+    // The passes over masses, blocks, triangles and nodes run in workgroups of local_size, which the driver must support
+    GLint max_size = 0, max_invocations = 0;
+    glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_SIZE, 0, &max_size);
+    glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &max_invocations);
+    if (options.local_size == 0 || options.local_size > (unsigned)max_size || options.local_size > (unsigned)max_invocations)
+    {
+        printf("Local size %u is not within the driver's limit of %d\n", options.local_size, std::min(max_size, max_invocations));
+        return -13;
+    }
+
+    // ... and so must the tiled spring pass's block of invocations and the shared positions of the block and its halo
+    if (options.tiled_springs)
+    {
+        GLint max_shared = 0;
+        glGetIntegerv(GL_MAX_COMPUTE_SHARED_MEMORY_SIZE, &max_shared);
+        unsigned length = scene_config.jello.block_length, tile_length = length + 4;
+        size_t shared_size = sizeof(glm::vec4) * tile_length * tile_length * tile_length;
+        if (length * length * length > (unsigned)max_invocations || shared_size > (size_t)max_shared)
+        {
+            printf("Spring blocks of %u^3 masses are not within the driver's limits for tiles\n", length);
+            return -13;
+        }
+    }
+
+    // ... and the persistent pass's largest body, three floats of shared memory per mass
+    unsigned persistent_masses = 1, persistent_local_size = 1;
+    if (options.persistent)
+    {
+        for (const BodyRange &body : bodies)
+            persistent_masses = std::max<unsigned>(persistent_masses, body.mass_count);
+        // An invocation per mass in whole warps, the rest looped over
+        persistent_local_size = std::min<unsigned>((persistent_masses + 31) / 32 * 32, std::min(max_size, max_invocations));
+
+        GLint max_shared = 0;
+        glGetIntegerv(GL_MAX_COMPUTE_SHARED_MEMORY_SIZE, &max_shared);
+        if (3 * sizeof(GLfloat) * persistent_masses > (size_t)max_shared)
+        {
+            printf("Bodies of %u masses do not fit the driver's %d bytes of shared memory\n", persistent_masses, max_shared);
+            return -13;
+        }
+    }
+    for (GLuint i = 0; i < 3; i++)
+        glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, i, &max_work_groups[i]);
+
+    // Compute shaders also get the sleeping blocks and the active lists their per-mass passes are dispatched from.
+    // BLOCK_COUNT is over every body and BLOCK_GRID the first body's, the only one the lattice formulations take.
+    auto getEnergy = [&](float speed)
+    {
+        return 0.5f * physics_config.mass * speed * speed;
+    };
+    char compute_prelude[4000];
+    snprintf(compute_prelude, 4000,
+             "%s#define BLOCK_GRID ivec3(%u, %u, %u)\n#define BLOCK_COUNT %u\n#define BLOCK_LENGTH %u\n"
+             "#define SLEEPING %d\n#define SLEEP_STEPS %u\n#define SLEEP_ENERGY %#.9g\n#define WAKE_ENERGY %#.9g\n"
+             "layout(std430, binding = 19) buffer active_SSBO {\n"
+             "    uint active_dispatch[9];\n    uint active_counts[2];\n    uint active_masses[NUM_POINTS];\n    uint active_blocks[];\n};\n"
+             "#define LOCAL_SIZE %u\n#define MAX_WORK_GROUPS %u\n"
+             "uint getInvocationIndex()\n{\n"
+             "    return ((gl_WorkGroupID.z * gl_NumWorkGroups.y + gl_WorkGroupID.y) * gl_NumWorkGroups.x + gl_WorkGroupID.x) * LOCAL_SIZE + gl_LocalInvocationID.x;\n}\n"
+             "uint getInvocationCount()\n{\n    return gl_NumWorkGroups.x * gl_NumWorkGroups.y * gl_NumWorkGroups.z * LOCAL_SIZE;\n}\n"
+             "#define SPRING_BLOCKS %lu\n#define CONTACT_POINTS %lu\n#define CONTACT_TRIANGLES %lu\n"
+             "#define MASS_COUNT %s\n#define MASS_ID(i) %s\n#define SPRING_BLOCK_COUNT %s\n#define SPRING_BLOCK_ID(i) %s\n"
+             "#define CONTACT_CELL_SIZE %#.9g\n#define CONTACT_DEPTH %#.9g\n#define CONTACT_TABLE_SIZE %u\n#define SCAN_WIDTH %u\n"
+             "#define SELF_EXCLUSION %#.9g\n#define BVH_STACK %u\n#define BVH_NODE_COUNT %u\n"
+             "#define BODY_COUNT %lu\n#define PERSISTENT_MASSES %u\n#define PERSISTENT_LOCAL_SIZE %u\n",
+             prelude, scene_config.jello.block_width, scene_config.jello.block_height, scene_config.jello.block_depth,
+             (unsigned)getBlockCount(), scene_config.jello.block_length,
+             options.sleeping, options.sleep.steps, getEnergy(options.sleep.sleep_speed), getEnergy(options.sleep.wake_speed),
+             options.local_size, (unsigned)max_work_groups[0], getBlockCount(), contact_surface.points.size(), contact_surface.triangles.size(),
+             options.sleeping ? "active_counts[0]" : "NUM_POINTS", options.sleeping ? "active_masses[i]" : "(i)",
+             options.sleeping ? "active_counts[1]" : "SPRING_BLOCKS", options.sleeping ? "active_blocks[i]" : "(i)",
+             contact_surface.cell_size, contact_surface.max_depth, std::max(contact_surface.table_size, contact_scan_width), contact_scan_width,
+             self_collision_config.exclusion * contact_surface.edge_length, (unsigned)surface_bvh.level_offsets.size() + 1,
+             (unsigned)std::max<size_t>(surface_bvh.nodes.size(), 1), bodies.size(), persistent_masses, persistent_local_size);
 
     GLuint render;
     GLuint gravity;
@@ -584,31 +1990,147 @@ int Simulator::loadShaders()
     programIDs.render = glCreateProgram();
     programIDs.gravity = glCreateProgram();
     programIDs.springs = glCreateProgram();
+    programIDs.springs_gather = glCreateProgram();
+    programIDs.springs_lattice = glCreateProgram();
+    programIDs.springs_tiled = glCreateProgram();
+    programIDs.shape_clusters = glCreateProgram();
+    programIDs.shape_match = glCreateProgram();
+    programIDs.sleep_bodies = glCreateProgram();
+    programIDs.sleep_energy = glCreateProgram();
+    programIDs.sleep_update = glCreateProgram();
+    programIDs.sleep_compact = glCreateProgram();
+    programIDs.contact_count = glCreateProgram();
+    programIDs.contact_scan = glCreateProgram();
+    programIDs.contact_fill = glCreateProgram();
+    programIDs.contact_resolve = glCreateProgram();
+    programIDs.bvh_refit = glCreateProgram();
+    programIDs.self_collide = glCreateProgram();
     programIDs.integrate = glCreateProgram();
     programIDs.collide = glCreateProgram();
     programIDs.correct = glCreateProgram();
+    programIDs.update_masses = glCreateProgram();
+    programIDs.persistent_step = glCreateProgram();
+    programIDs.constrain = glCreateProgram();
+    programIDs.constrain_jacobi = glCreateProgram();
+    programIDs.constrain_chebyshev = glCreateProgram();
+    programIDs.constrain_residual = glCreateProgram();
+    programIDs.interpolate = glCreateProgram();
+    programIDs.reconstruct = glCreateProgram();
+    programIDs.implicit_setup = glCreateProgram();
+    programIDs.implicit_apply = glCreateProgram();
+    programIDs.implicit_dot = glCreateProgram();
+    programIDs.implicit_update = glCreateProgram();
+    programIDs.implicit_direction = glCreateProgram();
+    programIDs.implicit_finish = glCreateProgram();
 
     loadShader(shader_config.vertex.c_str(), GL_VERTEX_SHADER, programIDs.render, prelude);
     loadShader(shader_config.fragment.c_str(), GL_FRAGMENT_SHADER, programIDs.render, prelude);
-    loadShader(shader_config.gravity.c_str(), GL_COMPUTE_SHADER, programIDs.gravity, prelude);
-    loadShader(shader_config.springs.c_str(), GL_COMPUTE_SHADER, programIDs.springs, prelude);
-    loadShader(shader_config.integrate.c_str(), GL_COMPUTE_SHADER, programIDs.integrate, prelude);
-    loadShader(shader_config.collide.c_str(), GL_COMPUTE_SHADER, programIDs.collide, prelude);
-    loadShader(shader_config.correct.c_str(), GL_COMPUTE_SHADER, programIDs.correct, prelude);
+    loadShader(shader_config.gravity.c_str(), GL_COMPUTE_SHADER, programIDs.gravity, compute_prelude);
+    loadShader(shader_config.springs.c_str(), GL_COMPUTE_SHADER, programIDs.springs, compute_prelude);
+    loadShader(shader_config.springs_gather.c_str(), GL_COMPUTE_SHADER, programIDs.springs_gather, compute_prelude);
+    loadShader(shader_config.springs_lattice.c_str(), GL_COMPUTE_SHADER, programIDs.springs_lattice, compute_prelude);
+    loadShader(shader_config.springs_tiled.c_str(), GL_COMPUTE_SHADER, programIDs.springs_tiled, compute_prelude);
+    loadShader(shader_config.shape_clusters.c_str(), GL_COMPUTE_SHADER, programIDs.shape_clusters, compute_prelude);
+    loadShader(shader_config.shape_match.c_str(), GL_COMPUTE_SHADER, programIDs.shape_match, compute_prelude);
+    loadShader(shader_config.sleep_bodies.c_str(), GL_COMPUTE_SHADER, programIDs.sleep_bodies, compute_prelude);
+    loadShader(shader_config.sleep_energy.c_str(), GL_COMPUTE_SHADER, programIDs.sleep_energy, compute_prelude);
+    loadShader(shader_config.sleep_update.c_str(), GL_COMPUTE_SHADER, programIDs.sleep_update, compute_prelude);
+    loadShader(shader_config.sleep_compact.c_str(), GL_COMPUTE_SHADER, programIDs.sleep_compact, compute_prelude);
+    loadShader(shader_config.contact_count.c_str(), GL_COMPUTE_SHADER, programIDs.contact_count, compute_prelude);
+    loadShader(shader_config.contact_scan.c_str(), GL_COMPUTE_SHADER, programIDs.contact_scan, compute_prelude);
+    loadShader(shader_config.contact_fill.c_str(), GL_COMPUTE_SHADER, programIDs.contact_fill, compute_prelude);
+    loadShader(shader_config.contact_resolve.c_str(), GL_COMPUTE_SHADER, programIDs.contact_resolve, compute_prelude);
+    loadShader(shader_config.bvh_refit.c_str(), GL_COMPUTE_SHADER, programIDs.bvh_refit, compute_prelude);
+    loadShader(shader_config.self_collide.c_str(), GL_COMPUTE_SHADER, programIDs.self_collide, compute_prelude);
+    loadShader(shader_config.integrate.c_str(), GL_COMPUTE_SHADER, programIDs.integrate, compute_prelude);
+    loadShader(shader_config.collide.c_str(), GL_COMPUTE_SHADER, programIDs.collide, compute_prelude);
+    loadShader(shader_config.correct.c_str(), GL_COMPUTE_SHADER, programIDs.correct, compute_prelude);
+    loadShader(shader_config.update_masses.c_str(), GL_COMPUTE_SHADER, programIDs.update_masses, compute_prelude);
+    loadShader(shader_config.persistent_step.c_str(), GL_COMPUTE_SHADER, programIDs.persistent_step, compute_prelude);
+    loadShader(shader_config.constrain.c_str(), GL_COMPUTE_SHADER, programIDs.constrain, compute_prelude);
+    loadShader(shader_config.constrain_jacobi.c_str(), GL_COMPUTE_SHADER, programIDs.constrain_jacobi, compute_prelude);
+    loadShader(shader_config.constrain_chebyshev.c_str(), GL_COMPUTE_SHADER, programIDs.constrain_chebyshev, compute_prelude);
+    loadShader(shader_config.constrain_residual.c_str(), GL_COMPUTE_SHADER, programIDs.constrain_residual, compute_prelude);
+    loadShader(shader_config.interpolate.c_str(), GL_COMPUTE_SHADER, programIDs.interpolate, compute_prelude);
+    loadShader(shader_config.reconstruct.c_str(), GL_COMPUTE_SHADER, programIDs.reconstruct, compute_prelude);
+    loadShader(shader_config.implicit_setup.c_str(), GL_COMPUTE_SHADER, programIDs.implicit_setup, compute_prelude);
+    loadShader(shader_config.implicit_apply.c_str(), GL_COMPUTE_SHADER, programIDs.implicit_apply, compute_prelude);
+    loadShader(shader_config.implicit_dot.c_str(), GL_COMPUTE_SHADER, programIDs.implicit_dot, compute_prelude);
+    loadShader(shader_config.implicit_update.c_str(), GL_COMPUTE_SHADER, programIDs.implicit_update, compute_prelude);
+    loadShader(shader_config.implicit_direction.c_str(), GL_COMPUTE_SHADER, programIDs.implicit_direction, compute_prelude);
+    loadShader(shader_config.implicit_finish.c_str(), GL_COMPUTE_SHADER, programIDs.implicit_finish, compute_prelude);
 
     validateProgram(programIDs.render);
     validateProgram(programIDs.gravity);
     validateProgram(programIDs.springs);
+    validateProgram(programIDs.springs_gather);
+    validateProgram(programIDs.springs_lattice);
+    validateProgram(programIDs.springs_tiled);
+    validateProgram(programIDs.shape_clusters);
+    validateProgram(programIDs.shape_match);
+    validateProgram(programIDs.sleep_bodies);
+    validateProgram(programIDs.sleep_energy);
+    validateProgram(programIDs.sleep_update);
+    validateProgram(programIDs.sleep_compact);
+    validateProgram(programIDs.contact_count);
+    validateProgram(programIDs.contact_scan);
+    validateProgram(programIDs.contact_fill);
+    validateProgram(programIDs.contact_resolve);
+    validateProgram(programIDs.bvh_refit);
+    validateProgram(programIDs.self_collide);
     validateProgram(programIDs.integrate);
     validateProgram(programIDs.collide);
     validateProgram(programIDs.correct);
+    validateProgram(programIDs.update_masses);
+    validateProgram(programIDs.persistent_step);
+    validateProgram(programIDs.constrain);
+    validateProgram(programIDs.constrain_jacobi);
+    validateProgram(programIDs.constrain_chebyshev);
+    validateProgram(programIDs.constrain_residual);
+    validateProgram(programIDs.interpolate);
+    validateProgram(programIDs.reconstruct);
+    validateProgram(programIDs.implicit_setup);
+    validateProgram(programIDs.implicit_apply);
+    validateProgram(programIDs.implicit_dot);
+    validateProgram(programIDs.implicit_update);
+    validateProgram(programIDs.implicit_direction);
+    validateProgram(programIDs.implicit_finish);
 
     glLinkProgram(programIDs.render);
     glLinkProgram(programIDs.gravity);
     glLinkProgram(programIDs.springs);
+    glLinkProgram(programIDs.springs_gather);
+    glLinkProgram(programIDs.springs_lattice);
+    glLinkProgram(programIDs.springs_tiled);
+    glLinkProgram(programIDs.shape_clusters);
+    glLinkProgram(programIDs.shape_match);
+    glLinkProgram(programIDs.sleep_bodies);
+    glLinkProgram(programIDs.sleep_energy);
+    glLinkProgram(programIDs.sleep_update);
+    glLinkProgram(programIDs.sleep_compact);
+    glLinkProgram(programIDs.contact_count);
+    glLinkProgram(programIDs.contact_scan);
+    glLinkProgram(programIDs.contact_fill);
+    glLinkProgram(programIDs.contact_resolve);
+    glLinkProgram(programIDs.bvh_refit);
+    glLinkProgram(programIDs.self_collide);
     glLinkProgram(programIDs.integrate);
     glLinkProgram(programIDs.collide);
     glLinkProgram(programIDs.correct);
+    glLinkProgram(programIDs.update_masses);
+    glLinkProgram(programIDs.persistent_step);
+    glLinkProgram(programIDs.constrain);
+    glLinkProgram(programIDs.constrain_jacobi);
+    glLinkProgram(programIDs.constrain_chebyshev);
+    glLinkProgram(programIDs.constrain_residual);
+    glLinkProgram(programIDs.interpolate);
+    glLinkProgram(programIDs.reconstruct);
+    glLinkProgram(programIDs.implicit_setup);
+    glLinkProgram(programIDs.implicit_apply);
+    glLinkProgram(programIDs.implicit_dot);
+    glLinkProgram(programIDs.implicit_update);
+    glLinkProgram(programIDs.implicit_direction);
+    glLinkProgram(programIDs.implicit_finish);
 
     getErrors("Shaders");
 
@@ -617,7 +2139,7 @@ int Simulator::loadShaders()
 
 int Simulator::makeBuffers()
 {
-    glGenBuffers(10, (GLuint *)&buffers);
+    glGenBuffers(sizeof(buffers) / sizeof(GLuint), (GLuint *)&buffers);
 
     // SSBOs
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.positions);
@@ -640,6 +2162,184 @@ int Simulator::makeBuffers()
         glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(Spring) * GPU_data.jello.spring_count, GPU_data.jello.springs, GL_STATIC_DRAW);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, buffers.springs);
 
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.spring_groups);
+    if (GPU_data.jello.spring_group_count)
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * (GPU_data.jello.spring_group_count + 1), GPU_data.jello.spring_groups, GL_STATIC_DRAW);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, buffers.spring_groups);
+
+    GLuint step_stats[2]{0, 0};
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.step_stats);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(step_stats), step_stats, GL_DYNAMIC_READ);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, buffers.step_stats);
+
+    if (options.integrator == Integrator::Implicit)
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.solver);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(glm::vec4) * GPU_data.jello.position_count * 7, NULL, GL_DYNAMIC_COPY);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 12, buffers.solver);
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.solver_scalars);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLfloat) * 3, NULL, GL_DYNAMIC_COPY);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 13, buffers.solver_scalars);
+    }
+
+    bool jacobi = options.integrator == Integrator::XPBD && options.constraint_solver == ConstraintSolver::Jacobi;
+    if (options.integrator == Integrator::XPBD && !jacobi)
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.spring_lambdas);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLfloat) * std::max<size_t>(GPU_data.jello.spring_count, 1), NULL, GL_DYNAMIC_COPY);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 14, buffers.spring_lambdas);
+    }
+
+    if (options.integrator == Integrator::Modal)
+    {
+        // Every body's rest shape about its center, with the body in w, then every mode over all the masses, zero past a
+        // body's own modes, then room for the states reconstructGPU() uploads
+        size_t modes = getModalModeCount(), count = GPU_data.jello.position_count;
+        std::vector<glm::vec4> basis((modes + 1) * count + 2 * bodies.size() * getModalStateSize(modes), glm::vec4(0.0f));
+        for (size_t body = 0; body < bodies.size(); body++)
+        {
+            const std::vector<glm::vec4> &body_basis = modal_bodies[body].getBasis();
+            size_t first = bodies[body].first_mass, n = bodies[body].mass_count;
+            for (size_t k = 0; k <= modal_bodies[body].getModeCount(); k++)
+                std::copy(body_basis.begin() + k * n, body_basis.begin() + (k + 1) * n, basis.begin() + k * count + first);
+            for (size_t i = 0; i < n; i++)
+                basis[first + i].w = body;
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.modal_basis);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(glm::vec4) * basis.size(), basis.data(), GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 15, buffers.modal_basis);
+    }
+
+    if (options.formulation == SpringFormulation::ShapeMatching)
+    {
+        // Center and rotation of every cluster, starting unrotated
+        GLuint counts[3];
+        shape_cluster_count = getShapeClusterCounts(getSimulationData().lattice, counts);
+        std::vector<glm::vec4> clusters(shape_cluster_count * 2, glm::vec4(0.0f));
+        for (size_t c = 0; c < shape_cluster_count; c++)
+            clusters[2 * c + 1] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.shape_clusters);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(glm::vec4) * clusters.size(), clusters.data(), GL_DYNAMIC_COPY);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 16, buffers.shape_clusters);
+    }
+
+    if (options.sleeping)
+    {
+        // Masses of every block in buffer order behind an offset table, x-major within each body and body by body, then
+        // where each block's springs sit among the spring groups, which reorderMasses() visits along the mass order's curve,
+        // then the body of every block and the block of every mass. Each body's first block and block grid go to their own
+        // buffer.
+        size_t block_count = getBlockCount();
+        unsigned length = scene_config.jello.block_length;
+        std::vector<std::vector<GLuint>> block_masses(block_count);
+        std::vector<GLuint> block_ranks, block_bodies(block_count), mass_blocks(GPU_data.jello.position_count);
+        std::vector<glm::uvec4> body_grids;
+        for (size_t body = 0; body < bodies.size(); body++)
+        {
+            const BodyConfig &config = body_configs[body];
+            glm::uvec4 grid(bodies[body].first_block, (config.masses_x + length - 1) / length, (config.masses_y + length - 1) / length,
+                            (config.masses_z + length - 1) / length);
+            body_grids.push_back(grid);
+            for (unsigned z = 0; z < config.masses_z; z++)
+                for (unsigned y = 0; y < config.masses_y; y++)
+                    for (unsigned x = 0; x < config.masses_x; x++)
+                    {
+                        size_t block = grid.x + x / length + grid.y * (y / length + grid.z * (z / length));
+                        GLuint mass = mass_ranks[bodies[body].first_mass + x + config.masses_x * (y + config.masses_y * z)];
+                        block_masses[block].push_back(mass);
+                        mass_blocks[mass] = block;
+                    }
+
+            std::vector<GLuint> ranks;
+            buildMassOrder(options.mass_order, grid.y, grid.z, grid.w, ranks);
+            for (GLuint rank : ranks)
+                block_ranks.push_back(grid.x + rank);
+            std::fill(block_bodies.begin() + grid.x, block_bodies.begin() + grid.x + bodies[body].block_count, body);
+        }
+
+        std::vector<GLuint> sleep_blocks(block_count + 1);
+        for (size_t block = 0; block < block_count; block++)
+        {
+            sleep_blocks[block] = sleep_blocks.size();
+            sleep_blocks.insert(sleep_blocks.end(), block_masses[block].begin(), block_masses[block].end());
+        }
+        sleep_blocks[block_count] = sleep_blocks.size();
+        sleep_blocks.insert(sleep_blocks.end(), block_ranks.begin(), block_ranks.end());
+        sleep_blocks.insert(sleep_blocks.end(), block_bodies.begin(), block_bodies.end());
+        sleep_blocks.insert(sleep_blocks.end(), mass_blocks.begin(), mass_blocks.end());
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.sleep_blocks);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * sleep_blocks.size(), sleep_blocks.data(), GL_STATIC_DRAW);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 18, buffers.sleep_blocks);
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.sleep_bodies);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(glm::uvec4) * body_grids.size(), body_grids.data(), GL_STATIC_DRAW);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 30, buffers.sleep_bodies);
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.body_states);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * 4 * bodies.size(), NULL, GL_DYNAMIC_COPY);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 31, buffers.body_states);
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.block_states);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * 4 * block_count, NULL, GL_DYNAMIC_COPY);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 17, buffers.block_states);
+
+        // Stays bound as the dispatch indirect buffer for every step
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.active);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * (active_header + GPU_data.jello.position_count + block_count), NULL, GL_DYNAMIC_COPY);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 19, buffers.active);
+        glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, buffers.active);
+        resetSleep();
+    }
+
+    if (options.body_contacts || options.self_collisions)
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.contact_points);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(glm::uvec2) * contact_surface.points.size(), contact_surface.points.data(), GL_STATIC_DRAW);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 20, buffers.contact_points);
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.contact_triangles);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(glm::uvec4) * contact_surface.triangles.size(), contact_surface.triangles.data(), GL_STATIC_DRAW);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 21, buffers.contact_triangles);
+    }
+
+    if (options.body_contacts)
+    {
+        // Counts, their prefix sums (one more), and the sum of every scan workgroup
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.contact_cells);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * (2 * contact_surface.table_size + 1 + contact_surface.table_size / contact_scan_width), NULL, GL_DYNAMIC_COPY);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 22, buffers.contact_cells);
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.contact_entries);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * contact_surface.capacity, NULL, GL_DYNAMIC_COPY);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 23, buffers.contact_entries);
+    }
+
+    if (options.self_collisions)
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.bvh_nodes);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(BVHNode) * surface_bvh.nodes.size(), surface_bvh.nodes.data(), GL_DYNAMIC_COPY);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 24, buffers.bvh_nodes);
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.bvh_triangles);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * surface_bvh.triangles.size(), surface_bvh.triangles.data(), GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 25, buffers.bvh_triangles);
+
+        // The positions as constructed, which tell a mass's own neighbourhood from a fold
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.rest_positions);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(glm::vec4) * rest_positions.size(), rest_positions.data(), GL_STATIC_DRAW);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 26, buffers.rest_positions);
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.bvh_rest_spheres);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(glm::vec4) * surface_bvh.rest_spheres.size(), surface_bvh.rest_spheres.data(), GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 27, buffers.bvh_rest_spheres);
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.bvh_planes);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(glm::vec4) * surface_bvh.planes.size(), surface_bvh.planes.data(), GL_DYNAMIC_COPY);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 28, buffers.bvh_planes);
+    }
+
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.spheres);
     if (sizeof(scene_config.spheres))
         glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(glm::vec4) * sizeof(scene_config.spheres), scene_config.spheres, GL_STATIC_DRAW);
@@ -650,6 +2350,48 @@ int Simulator::makeBuffers()
         glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(glm::vec4) * sizeof(scene_config.planes), scene_config.planes, GL_STATIC_DRAW);
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, buffers.planes);
 
+    if (options.formulation == SpringFormulation::Gather || options.integrator == Integrator::Implicit || jacobi || options.persistent)
+    {
+        std::vector<GLuint> offsets;
+        std::vector<Spring> adjacency;
+        buildSpringAdjacency(GPU_data.jello.springs, GPU_data.jello.spring_count, GPU_data.jello.position_count, offsets, adjacency);
+        adjacency_count = adjacency.size();
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.spring_offsets);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * offsets.size(), offsets.data(), GL_STATIC_DRAW);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, buffers.spring_offsets);
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.spring_adjacency);
+        if (adjacency.size())
+            glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(Spring) * adjacency.size(), adjacency.data(), GL_STATIC_DRAW);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, buffers.spring_adjacency);
+    }
+
+    if (options.persistent)
+    {
+        // First mass and mass count of every body, a workgroup's share of the persistent pass
+        std::vector<glm::uvec2> ranges;
+        for (const BodyRange &body : bodies)
+            ranges.push_back(glm::uvec2(body.first_mass, body.mass_count));
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.body_ranges);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(glm::uvec2) * ranges.size(), ranges.data(), GL_STATIC_DRAW);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 29, buffers.body_ranges);
+    }
+
+    if (jacobi)
+    {
+        // Next and previous iterates and squared residual per mass, then current, next and previous multipliers per adjacency entry
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.solver);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(glm::vec4) * GPU_data.jello.position_count * 3, NULL, GL_DYNAMIC_COPY);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 12, buffers.solver);
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.spring_lambdas);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLfloat) * std::max<size_t>(adjacency_count * 3, 1), NULL, GL_DYNAMIC_COPY);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 14, buffers.spring_lambdas);
+
+        resizeConstraintResiduals();
+    }
+
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 
     // VAOs
@@ -696,11 +2438,37 @@ int Simulator::makeBuffers()
     }
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
+    // One draw per body over its own faces, then the planes and spheres behind them
+    std::vector<DrawCommand> draws;
+    for (const BodyRange &body : bodies)
+        draws.push_back(DrawCommand{body.face_count * 3, 1, body.first_face * 3, 0, 0});
+    draws.push_back(DrawCommand{(GLuint)(GPU_data.planes.face_count + GPU_data.spheres.face_count) * 3, 1, (GLuint)GPU_data.jello.face_count * 3, 0, 0});
+    draw_count = draws.size();
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffers.draw_commands);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(DrawCommand) * draws.size(), draws.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
     getErrors("Buffers");
 
     return 0;
 }
 
+void Simulator::getSpringLengths(float spring_lengths[6]) const
+{
+    // x, y, z structural, then the xy, xz, yz diagonals
+    spring_lengths[0] = scene_config.jello.width / (scene_config.jello.masses_x - 1);
+    spring_lengths[1] = scene_config.jello.height / (scene_config.jello.masses_y - 1);
+    spring_lengths[2] = scene_config.jello.depth / (scene_config.jello.masses_z - 1);
+    spring_lengths[3] = sqrt(scene_config.jello.width * scene_config.jello.width / ((scene_config.jello.masses_x - 1) * (scene_config.jello.masses_x - 1)) + scene_config.jello.height * scene_config.jello.height / ((scene_config.jello.masses_y - 1) * (scene_config.jello.masses_y - 1)));
+    spring_lengths[4] = sqrt(scene_config.jello.width * scene_config.jello.width / ((scene_config.jello.masses_x - 1) * (scene_config.jello.masses_x - 1)) + scene_config.jello.depth * scene_config.jello.depth / ((scene_config.jello.masses_z - 1) * (scene_config.jello.masses_z - 1)));
+    spring_lengths[5] = sqrt(scene_config.jello.height * scene_config.jello.height / ((scene_config.jello.masses_y - 1) * (scene_config.jello.masses_y - 1)) + scene_config.jello.depth * scene_config.jello.depth / ((scene_config.jello.masses_z - 1) * (scene_config.jello.masses_z - 1)));
+}
+
+size_t Simulator::getBlockCount() const
+{
+    return bodies.empty() ? 0 : bodies.back().first_block + bodies.back().block_count;
+}
+
 inline unsigned Simulator::getPositionIndex(unsigned x, unsigned y, unsigned z) const
 {
     return x + y * scene_config.jello.masses_x + z * scene_config.jello.masses_x * scene_config.jello.masses_y;
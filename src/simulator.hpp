@@ -3,14 +3,128 @@
 #include "includes.h"
 #include "utils.hpp"
 #include "constructs.h"
+#include "cpu_backend.hpp"
+#include "body_contacts.hpp"
+#include "surface_bvh.hpp"
+#include "mass_order.hpp"
+#include "modal_body.hpp"
+#include "timestep.hpp"
 
+#include <chrono>
 #include <math.h>
+#include <string.h>
 #ifdef _WIN32
 #include <io.h>
 #else
 #include <unistd.h>
 #endif
 
+enum class Backend
+{
+    GPU,
+    CPU
+};
+
+typedef struct
+{
+    // A block of masses falls asleep once it and its neighbours have moved slower than sleep_speed for steps
+    // steps in a row, and wakes when a neighbouring block moves faster than wake_speed (root mean square, m/s). A body
+    // with no awake block sleeps whole until a block of another body touches it faster than wake_speed.
+    unsigned steps = 60;
+    float sleep_speed = 0.02f;
+    float wake_speed = 0.05f;
+} SleepConfig;
+
+// One jello of a multi-body scene, centered at x, y, z
+typedef struct
+{
+    float x = 0, y = 0, z = 10;
+    size_t masses_x = 8, masses_y = 8, masses_z = 8;
+    float width = 2, height = 2, depth = 2;
+} BodyConfig;
+
+// Where one body's masses, spring blocks and faces sit in the shared buffers
+typedef struct
+{
+    GLuint first_mass, mass_count;
+    GLuint first_block, block_count;
+    GLuint first_face, face_count;
+} BodyRange;
+
+// count bodies of the given size, in square layers stacked up from where the single jello starts
+std::vector<BodyConfig> arrangeBodies(size_t count, size_t masses_x, size_t masses_y, size_t masses_z);
+
+struct SimulatorOptions
+{
+    Backend backend = Backend::GPU;
+    // Step without a window or GL context (CPU backend only)
+    bool headless = false;
+    // Stop after this many steps, 0 runs until the window closes
+    size_t steps = 0;
+    // Simulation steps per rendered frame
+    unsigned substeps = 1;
+    // Take as many steps per frame as keep simulated time in line with the wall clock instead,
+    // and render between the last two states
+    bool real_time = false;
+    // Simulation steps per simulated second, 0 keeps PhysicsConfig::delta_t
+    float step_rate = 0;
+    // Pick dt every frame from the spring stiffness and how fast the masses move
+    bool adaptive_dt = false;
+    // Implicit, XPBD and projective steps stay stable at step rates far below the explicit limit (fixed dt only),
+    // projective on the CPU backend only
+    Integrator integrator = Integrator::Verlet;
+    // Constraint sweeps per XPBD step or local/global iterations per projective one, see also Simulator::setConstraintIterations()
+    unsigned constraint_iterations = XPBDConfig().iterations;
+    ConstraintSolver constraint_solver = ConstraintSolver::GaussSeidel;
+    // Chebyshev acceleration of the Jacobi sweeps, 0 turns it off
+    float spectral_radius = XPBDConfig().spectral_radius;
+    // Vibration modes a modal body keeps
+    unsigned modes = ModalConfig().modes;
+    // CSV of dt and step statistics per frame, written while adaptive_dt
+    const char *telemetry_path = nullptr;
+    // CPU worker threads, 0 uses every core
+    unsigned threads = 0;
+    SpringISA spring_isa = SpringISA::Auto;
+    SpringAccumulation accumulation = SpringAccumulation::Colored;
+    SpringFormulation formulation = SpringFormulation::Scatter;
+    // Drop the null springs padding every block color, instead of evaluating and skipping them
+    bool compact_springs = true;
+    // Renumber the masses along a space filling curve so spring endpoints sit close in memory
+    MassOrder mass_order = MassOrder::Linear;
+    // Step the CPU backend alongside the GPU and report how far they drift apart
+    bool validate = false;
+    // Skip every pass over the spring blocks that have come to rest (GPU backend, Verlet only)
+    bool sleeping = false;
+    SleepConfig sleep;
+    size_t masses_x = 8, masses_y = 8, masses_z = 8;
+    // Jellies stepped and drawn together from one set of buffers, empty for the single jello of masses_x, y, z.
+    // Several bodies take the scatter or gather springs with linear mass order
+    std::vector<BodyConfig> bodies;
+    // Push the surface masses of every body out of the others, through a spatial hash of their triangles
+    bool body_contacts = false;
+    // Or a sweep and prune of the body bounds, on the CPU backend alone
+    ContactBroadPhase contact_broad_phase = ContactBroadPhase::SpatialHash;
+    // Push the surface masses of every body out of its own surface where it folds over, through a refit hierarchy of its
+    // triangles (not modal bodies)
+    bool self_collisions = false;
+    // Invocations per workgroup of the compute passes over masses, blocks, triangles and nodes, up to the driver's limit
+    unsigned local_size = 64;
+    // Spring blocks are 2 * block_radius masses on a side (at least 2), so every invocation of the scatter and XPBD
+    // passes walks up to block_radius^3 * 12 springs per color
+    unsigned block_radius = 2;
+    // Gravity, integration, plane and sphere collisions and corrections in one pass over the masses instead of four.
+    // Verlet only, and neither body contacts nor self collisions, which must see every integrated mass before the corrections.
+    bool fused_update = false;
+    // Lattice springs (GPU backend): each workgroup loads a spring block of masses and the 2 layers around it into shared
+    // memory once, and sums the springs of its masses from there
+    bool tiled_springs = false;
+    // Every substep of a frame in one dispatch (GPU backend): a workgroup per body holds all of its masses in shared memory
+    // and takes the gathered springs, Verlet step and plane and sphere collisions of each substep between barriers. Fixed
+    // dt, scatter or gather springs, and neither sleeping nor contacts, which need the other workgroups' masses. Bodies of
+    // up to about 4K masses fit in the shared memory of most drivers.
+    bool persistent = false;
+};
+
 class Simulator
 {
     // Constants
@@ -26,19 +140,48 @@ class Simulator
         std::string fragment = "./shaders/diffuse.frag";
         std::string gravity = "./shaders/gravity.comp";
         std::string springs = "./shaders/springs.comp";
+        std::string springs_gather = "./shaders/springs_gather.comp";
+        std::string springs_lattice = "./shaders/springs_lattice.comp";
+        std::string springs_tiled = "./shaders/springs_tiled.comp";
+        std::string shape_clusters = "./shaders/shape_clusters.comp";
+        std::string shape_match = "./shaders/shape_match.comp";
+        std::string sleep_bodies = "./shaders/sleep_bodies.comp";
+        std::string sleep_energy = "./shaders/sleep_energy.comp";
+        std::string sleep_update = "./shaders/sleep_update.comp";
+        std::string sleep_compact = "./shaders/sleep_compact.comp";
+        std::string contact_count = "./shaders/contact_count.comp";
+        std::string contact_scan = "./shaders/contact_scan.comp";
+        std::string contact_fill = "./shaders/contact_fill.comp";
+        std::string contact_resolve = "./shaders/contact_resolve.comp";
+        std::string bvh_refit = "./shaders/bvh_refit.comp";
+        std::string self_collide = "./shaders/self_collide.comp";
         std::string integrate = "./shaders/integrate.comp";
         std::string collide = "./shaders/collide.comp";
         std::string correct = "./shaders/correct.comp";
+        std::string update_masses = "./shaders/update_masses.comp";
+        std::string persistent_step = "./shaders/persistent_step.comp";
+        std::string constrain = "./shaders/constrain.comp";
+        std::string constrain_jacobi = "./shaders/constrain_jacobi.comp";
+        std::string constrain_chebyshev = "./shaders/constrain_chebyshev.comp";
+        std::string constrain_residual = "./shaders/constrain_residual.comp";
+        std::string interpolate = "./shaders/interpolate.comp";
+        std::string reconstruct = "./shaders/reconstruct.comp";
+        std::string implicit_setup = "./shaders/implicit_setup.comp";
+        std::string implicit_apply = "./shaders/implicit_apply.comp";
+        std::string implicit_dot = "./shaders/implicit_dot.comp";
+        std::string implicit_update = "./shaders/implicit_update.comp";
+        std::string implicit_direction = "./shaders/implicit_direction.comp";
+        std::string implicit_finish = "./shaders/implicit_finish.comp";
     } shader_config;
 
-    const struct
+    struct
     {
         struct
         {
             float x = 0, y = 0, z = 10;
             size_t masses_x = 8, masses_y = 8, masses_z = 8;
             float width = 2, height = 2, depth = 2;
-            // block_radius must be at least 2
+            // block_radius must be at least 2, set from SimulatorOptions::block_radius
             unsigned block_radius = 2;
             unsigned block_length = block_radius * 2;
             unsigned block_width = std::ceil((float)masses_x / block_length);
@@ -59,6 +202,54 @@ class Simulator
         glm::vec4 light_position = glm::vec4(2, 0, 9, 0);
     } scene_config;
 
+    const PhysicsConfig physics_config;
+    const ImplicitConfig implicit_config;
+    const SelfCollisionConfig self_collision_config;
+
+    SimulatorOptions options;
+    CPUBackend cpu_backend;
+    // One per body, each over its own range of masses
+    std::vector<ModalBody> modal_bodies;
+    size_t step_count = 0;
+    size_t frame_count = 0;
+    // Simulated time not yet stepped, and the wall clock it was last advanced at (real_time only)
+    double accumulator = 0;
+    std::chrono::steady_clock::time_point last_frame;
+    // Where the rendered positions sit between the last two states
+    float render_alpha = 1;
+
+    TimestepController timestep;
+    // dt of the coming steps and of the last one taken (on the GPU)
+    float delta_t;
+    float last_delta_t;
+    double simulated_time = 0;
+    FILE *telemetry = nullptr;
+    // Entries of the spring adjacency buffers (binding 7, 8), 0 when they are not built
+    size_t adjacency_count = 0;
+    // Shape matching clusters (binding 16), 0 for the other formulations
+    size_t shape_cluster_count = 0;
+    // GL_MAX_COMPUTE_WORK_GROUP_COUNT, past which the passes loop over what is left
+    GLint max_work_groups[3] = {65535, 65535, 65535};
+    // mass_ranks[getPositionIndex(x, y, z)] is where that mass lives in every per-mass buffer
+    std::vector<GLuint> mass_ranks;
+    // Every body, and where constructBodies() packed it; scene_config.jello describes the first one
+    std::vector<BodyConfig> body_configs;
+    std::vector<BodyRange> bodies;
+    // Indirect draws of the bodies and then the scene (buffers.draw_commands)
+    size_t draw_count = 0;
+    // Every body's faces over its masses rather than their vertex copies, and the body of every mass
+    std::vector<Face> contact_faces;
+    std::vector<GLuint> mass_bodies;
+    // Surface masses and triangles hashed every step when body_contacts (bindings 20 to 23)
+    ContactSurface contact_surface;
+    // Hierarchy over the same triangles when self_collisions (bindings 24, 25 and 27), as last built on the CPU, the
+    // positions it was first built from, and the GPU steps since its boxes were last read back to check how loose they
+    // have grown
+    SurfaceBVH surface_bvh;
+    std::vector<glm::vec4> rest_positions;
+    unsigned bvh_check_steps = 0;
+    unsigned bvh_rebuilds = 0;
+
     // Info
     struct
     {
@@ -72,6 +263,31 @@ class Simulator
         GLuint normals;
         GLuint colors;
         GLuint faces;
+        GLuint spring_offsets;
+        GLuint spring_adjacency;
+        GLuint spring_groups;
+        GLuint step_stats;
+        GLuint solver;
+        GLuint solver_scalars;
+        GLuint spring_lambdas;
+        GLuint modal_basis;
+        GLuint shape_clusters;
+        GLuint block_states;
+        GLuint sleep_blocks;
+        GLuint sleep_bodies;
+        GLuint body_states;
+        GLuint active;
+        GLuint draw_commands;
+        GLuint contact_points;
+        GLuint contact_triangles;
+        GLuint contact_cells;
+        GLuint contact_entries;
+        GLuint bvh_nodes;
+        GLuint bvh_triangles;
+        GLuint rest_positions;
+        GLuint bvh_rest_spheres;
+        GLuint bvh_planes;
+        GLuint body_ranges;
     } buffers;
 
     struct
@@ -79,9 +295,38 @@ class Simulator
         GLuint render;
         GLuint gravity;
         GLuint springs;
+        GLuint springs_gather;
+        GLuint springs_lattice;
+        GLuint springs_tiled;
+        GLuint shape_clusters;
+        GLuint shape_match;
+        GLuint sleep_bodies;
+        GLuint sleep_energy;
+        GLuint sleep_update;
+        GLuint sleep_compact;
+        GLuint contact_count;
+        GLuint contact_scan;
+        GLuint contact_fill;
+        GLuint contact_resolve;
+        GLuint bvh_refit;
+        GLuint self_collide;
         GLuint collide;
         GLuint integrate;
         GLuint correct;
+        GLuint update_masses;
+        GLuint persistent_step;
+        GLuint constrain;
+        GLuint constrain_jacobi;
+        GLuint constrain_chebyshev;
+        GLuint constrain_residual;
+        GLuint interpolate;
+        GLuint reconstruct;
+        GLuint implicit_setup;
+        GLuint implicit_apply;
+        GLuint implicit_dot;
+        GLuint implicit_update;
+        GLuint implicit_direction;
+        GLuint implicit_finish;
     } programIDs;
 
     GLFWwindow *window;
@@ -103,6 +348,9 @@ class Simulator
             };
             Spring *springs = nullptr;
             size_t spring_count = 0;
+            // Where each block color starts in springs, block count * 8 + 1 entries
+            GLuint *spring_groups = nullptr;
+            size_t spring_group_count = 0;
             Face *faces = nullptr;
             size_t face_count = 0;
         } jello;
@@ -143,22 +391,92 @@ class Simulator
     // Functions
     int initGL();
     int constructCube();
+    // Builds every body with constructCube() and packs them into GPU_data.jello one after another
+    int constructBodies();
+    void setJello(const BodyConfig &body);
+    int reorderMasses();
     int constructScene();
     int loadShaders();
     int makeBuffers();
+    int initBackend();
+    int initModal();
 
+    size_t scheduleSubsteps();
+    int initTimestep();
+    void updateTimestep();
+    void stepGPU(bool collect_stats = false);
+    // steps Verlet steps of every body in a single dispatch of the persistent pass
+    void stepPersistentGPU(size_t steps);
+    // Enough workgroups of options.local_size for count items of the current pass, spread over y and z beyond the
+    // driver's limit on x
+    void dispatchItems(size_t count);
+    // A per-mass pass over every mass, or only the awake ones when sleeping
+    void dispatchMasses();
+    // Updates which blocks sleep and rebuilds the active lists the next step is dispatched from
+    void sleepGPU();
+    // Every block awake with the active lists covering everything
+    void resetSleep();
+    // Sorts the surface triangles into the hashed grid and pushes surface masses out of other bodies, into the corrections
+    void collideBodiesGPU();
+    // Refits the hierarchy level by level, rebuilds it when it has grown too loose, and pushes surface masses out of
+    // their own body's surface, into the corrections
+    void collideSelfGPU();
+    void integrateImplicitGPU();
+    void constrainGPU();
+    void constrainJacobiGPU();
+    void resizeConstraintResiduals();
+    void stepCPU(size_t steps);
+    void stepModal(size_t steps);
+    // Rebuilds the positions (and the last positions, when rendering between them) from the modal state
+    void reconstructGPU();
+    size_t getModalModeCount() const;
     void updateNormals();
+    void validateStep(size_t steps);
 
     // Helper Functions
     inline unsigned getPositionIndex(unsigned x, unsigned y, unsigned z) const;
     inline unsigned getSphereIndex(unsigned x, unsigned y, unsigned z, unsigned i) const;
+    // Rest lengths of the x, y, z structural springs and the xy, xz, yz shearing springs
+    void getSpringLengths(float spring_lengths[6]) const;
+    // Spring blocks of every body together
+    size_t getBlockCount() const;
 
 public:
-    Simulator();
+    Simulator(const SimulatorOptions &options = SimulatorOptions());
     ~Simulator();
 
     // Core Functionality
     int init();
+    // Constructs the jello and scene data only, without GL or a backend
+    int build();
     int run();
     bool running() const;
+    size_t getStepCount() const;
+    size_t getFrameCount() const;
+    double getSimulatedTime() const;
+    // Current positions of whichever backend steps, reading them back from the GPU if needed
+    const glm::vec4 *readPositions();
+    float getDeltaT() const;
+    // Conjugate gradient iterations of the last implicit CPU step
+    unsigned getSolverIterations() const;
+    // For the projective factorization's statistics
+    const CPUBackend &getCPUBackend() const;
+    const std::vector<ModalBody> &getModalBodies() const;
+    // Constraint sweeps of the following XPBD steps on either backend, or local/global iterations of projective ones
+    void setConstraintIterations(unsigned iterations);
+    // Root mean square constraint residual before every sweep of the last Jacobi XPBD step
+    std::vector<float> getConstraintResiduals();
+    // Wakes every block, for changes the sleep test cannot see, like moved obstacles or new forces
+    void wake();
+    // Masses the next step runs on, read back from the GPU when sleeping
+    size_t getActiveMassCount();
+    // Average seconds per simulation step over steps steps, rendering excluded (GPU time for the GPU backend)
+    double timeSteps(size_t steps);
+    SimulationData getSimulationData() const;
+    const PhysicsConfig &getPhysicsConfig() const;
+    // Maps x-major lattice indices to buffer indices, for anything that needs the original mass order
+    const std::vector<GLuint> &getMassRanks() const;
+    const std::vector<BodyRange> &getBodies() const;
+    // Rebuilds of the self collision hierarchy on either backend
+    unsigned getBVHRebuilds() const;
 };
\ No newline at end of file
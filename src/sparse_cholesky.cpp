@@ -0,0 +1,502 @@
+#include "sparse_cholesky.hpp"
+
+#include <algorithm>
+#include <math.h>
+#include <numeric>
+
+static const GLuint none = ~0u;
+
+// Vertex sets at most this large are numbered as they come instead of split further
+static const size_t leaf_size = 64;
+
+// Update tiles, small enough to stay in registers
+static const size_t tile_columns = 4;
+static const size_t tile_rows = 8;
+
+// Numbers vertices so every separator comes after the two halves it separates:
+// split at the median of the longest axis, and move the vertices of the upper half that touch the lower one
+// into the separator. side marks the lower half with stamp.
+static void dissect(std::vector<GLuint> &vertices, const std::vector<std::vector<GLuint>> &graph, const glm::vec3 *coordinates,
+                    std::vector<GLuint> &side, GLuint &stamp, std::vector<GLuint> &perm)
+{
+    if (vertices.size() <= leaf_size)
+    {
+        perm.insert(perm.end(), vertices.begin(), vertices.end());
+        return;
+    }
+
+    glm::vec3 low = coordinates[vertices[0]], high = low;
+    for (GLuint v : vertices)
+    {
+        low = glm::min(low, coordinates[v]);
+        high = glm::max(high, coordinates[v]);
+    }
+    glm::vec3 extent = high - low;
+    int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : extent.y >= extent.z ? 1 : 2;
+
+    size_t middle = vertices.size() / 2;
+    std::nth_element(vertices.begin(), vertices.begin() + middle, vertices.end(), [&](GLuint a, GLuint b)
+    {
+        // Lattices put whole planes at one coordinate, so ties go by index to keep the selection linear
+        return coordinates[a][axis] < coordinates[b][axis] || (coordinates[a][axis] == coordinates[b][axis] && a < b);
+    });
+
+    stamp++;
+    std::vector<GLuint> lower(vertices.begin(), vertices.begin() + middle), upper, separator;
+    for (GLuint v : lower)
+        side[v] = stamp;
+    for (size_t i = middle; i < vertices.size(); i++)
+    {
+        GLuint v = vertices[i];
+        bool cut = std::any_of(graph[v].begin(), graph[v].end(), [&](GLuint u)
+        {
+            return side[u] == stamp;
+        });
+        (cut ? separator : upper).push_back(v);
+    }
+    std::vector<GLuint>().swap(vertices);
+
+    dissect(lower, graph, coordinates, side, stamp, perm);
+    dissect(upper, graph, coordinates, side, stamp, perm);
+    perm.insert(perm.end(), separator.begin(), separator.end());
+}
+
+int SparseCholesky::factor(size_t n, const GLuint *offsets, const GLuint *rows, const double *values, const glm::vec3 *coordinates)
+{
+    this->n = n;
+
+    // Symmetric adjacency for the ordering
+    std::vector<std::vector<GLuint>> graph(n);
+    for (size_t j = 0; j < n; j++)
+    {
+        for (GLuint p = offsets[j]; p < offsets[j + 1]; p++)
+        {
+            if (rows[p] == j)
+                continue;
+            graph[j].push_back(rows[p]);
+            graph[rows[p]].push_back(j);
+        }
+    }
+    order(graph, coordinates);
+    std::vector<std::vector<GLuint>>().swap(graph);
+
+    int errorCode = symbolic(offsets, rows, values);
+    if (errorCode)
+        return errorCode;
+
+    return numeric();
+}
+
+void SparseCholesky::order(const std::vector<std::vector<GLuint>> &graph, const glm::vec3 *coordinates)
+{
+    std::vector<GLuint> vertices(n), side(n, 0);
+    std::iota(vertices.begin(), vertices.end(), 0);
+    GLuint stamp = 0;
+
+    perm.clear();
+    perm.reserve(n);
+    dissect(vertices, graph, coordinates, side, stamp, perm);
+
+    inverse.resize(n);
+    for (size_t i = 0; i < n; i++)
+        inverse[perm[i]] = i;
+}
+
+int SparseCholesky::symbolic(const GLuint *offsets, const GLuint *rows, const double *values)
+{
+    // Permuted lower triangle, by counting sort on the new column
+    a_offsets.assign(n + 1, 0);
+    for (size_t j = 0; j < n; j++)
+    {
+        for (GLuint p = offsets[j]; p < offsets[j + 1]; p++)
+            a_offsets[std::min(inverse[j], inverse[rows[p]]) + 1]++;
+    }
+    for (size_t j = 0; j < n; j++)
+        a_offsets[j + 1] += a_offsets[j];
+
+    a_rows.resize(a_offsets[n]);
+    a_values.resize(a_offsets[n]);
+    std::vector<GLuint> next(a_offsets.begin(), a_offsets.end() - 1);
+    for (size_t j = 0; j < n; j++)
+    {
+        for (GLuint p = offsets[j]; p < offsets[j + 1]; p++)
+        {
+            GLuint a = inverse[j], b = inverse[rows[p]];
+            GLuint q = next[std::min(a, b)]++;
+            a_rows[q] = std::max(a, b);
+            a_values[q] = values[p];
+        }
+    }
+
+    // Row k of the lower triangle, the columns i < k it has entries in
+    std::vector<GLuint> upper_offsets(n + 1, 0);
+    for (size_t j = 0; j < n; j++)
+    {
+        for (GLuint q = a_offsets[j]; q < a_offsets[j + 1]; q++)
+        {
+            if (a_rows[q] != j)
+                upper_offsets[a_rows[q] + 1]++;
+        }
+    }
+    for (size_t k = 0; k < n; k++)
+        upper_offsets[k + 1] += upper_offsets[k];
+    std::vector<GLuint> upper(upper_offsets[n]);
+    next.assign(upper_offsets.begin(), upper_offsets.end() - 1);
+    for (size_t j = 0; j < n; j++)
+    {
+        for (GLuint q = a_offsets[j]; q < a_offsets[j + 1]; q++)
+        {
+            if (a_rows[q] != j)
+                upper[next[a_rows[q]]++] = j;
+        }
+    }
+
+    // Elimination tree, with path compression through ancestor
+    std::vector<GLuint> parent(n, none), ancestor(n, none);
+    for (size_t k = 0; k < n; k++)
+    {
+        for (GLuint q = upper_offsets[k]; q < upper_offsets[k + 1]; q++)
+        {
+            for (GLuint i = upper[q], i_next; i != none && i < k; i = i_next)
+            {
+                i_next = ancestor[i];
+                ancestor[i] = k;
+                if (i_next == none)
+                    parent[i] = k;
+            }
+        }
+    }
+
+    // Column counts of L: row k has an entry in every column on the tree paths from its entries up to k
+    std::vector<GLuint> counts(n, 1), mark(n, none);
+    for (size_t k = 0; k < n; k++)
+    {
+        mark[k] = k;
+        for (GLuint q = upper_offsets[k]; q < upper_offsets[k + 1]; q++)
+        {
+            for (GLuint j = upper[q]; mark[j] != k; j = parent[j])
+            {
+                counts[j]++;
+                mark[j] = k;
+            }
+        }
+    }
+
+    // Fundamental supernodes: chains of single children whose patterns only lose the diagonal
+    std::vector<GLuint> children(n, 0);
+    for (size_t j = 0; j < n; j++)
+    {
+        if (parent[j] != none)
+            children[parent[j]]++;
+    }
+    std::vector<GLuint> fundamental;
+    for (size_t j = 0; j < n; j++)
+    {
+        if (j == 0 || parent[j - 1] != j || counts[j - 1] != counts[j] + 1 || children[j] != 1 ||
+            j - fundamental.back() >= max_supernode_width)
+            fundamental.push_back(j);
+    }
+    fundamental.push_back(n);
+
+    // Relaxed supernodes: fold a supernode into the next one when that holds its parent and the merged panel
+    // stores few explicit zeros, since a few zeros cost less than the updates between two thin panels
+    super_start.assign(1, 0);
+    size_t entries = 0;
+    for (size_t f = 0; f + 1 < fundamental.size(); f++)
+    {
+        size_t f_entries = 0;
+        for (size_t j = fundamental[f]; j < fundamental[f + 1]; j++)
+            f_entries += counts[j];
+
+        GLuint up = f > 0 ? parent[fundamental[f] - 1] : none;
+        size_t width = fundamental[f + 1] - super_start.back();
+        if (up != none && up >= fundamental[f] && up < fundamental[f + 1] && width <= max_supernode_width)
+        {
+            size_t rows = width + counts[fundamental[f + 1] - 1] - 1;
+            double zeros = 1.0 - (double)(entries + f_entries) / (width * rows - width * (width - 1) / 2);
+            if (width <= 4 || (width <= 16 && zeros < 0.8) || (width <= 48 && zeros < 0.1) || zeros < 0.05)
+            {
+                entries += f_entries;
+                continue;
+            }
+        }
+        if (f > 0)
+            super_start.push_back(fundamental[f]);
+        entries = f_entries;
+    }
+    super_start.push_back(n);
+    size_t super_count = super_start.size() - 1;
+
+    super_of_column.resize(n);
+    row_offsets.assign(super_count + 1, 0);
+    value_offsets.assign(super_count + 1, 0);
+    for (size_t s = 0; s < super_count; s++)
+    {
+        size_t columns = super_start[s + 1] - super_start[s];
+        for (size_t j = super_start[s]; j < super_start[s + 1]; j++)
+            super_of_column[j] = s;
+        size_t rows = columns + counts[super_start[s + 1] - 1] - 1;
+        row_offsets[s + 1] = row_offsets[s] + rows;
+        value_offsets[s + 1] = value_offsets[s] + rows * columns;
+    }
+
+    // Rows of every supernode: its own columns, A's entries below them and the rows its children pass up
+    std::vector<GLuint> first_child(super_count, none), next_sibling(super_count, none);
+    for (size_t s = 0; s < super_count; s++)
+    {
+        GLuint up = parent[super_start[s + 1] - 1];
+        if (up == none)
+            continue;
+        GLuint p = super_of_column[up];
+        next_sibling[s] = first_child[p];
+        first_child[p] = s;
+    }
+
+    super_rows.resize(row_offsets[super_count]);
+    std::fill(mark.begin(), mark.end(), none);
+    for (size_t s = 0; s < super_count; s++)
+    {
+        GLuint first = super_start[s], last = super_start[s + 1] - 1;
+        GLuint *out = &super_rows[row_offsets[s]];
+        size_t count = 0;
+        for (GLuint j = first; j <= last; j++)
+        {
+            out[count++] = j;
+            mark[j] = s;
+        }
+
+        for (GLuint j = first; j <= last; j++)
+        {
+            for (GLuint q = a_offsets[j]; q < a_offsets[j + 1]; q++)
+            {
+                if (mark[a_rows[q]] != s)
+                {
+                    mark[a_rows[q]] = s;
+                    out[count++] = a_rows[q];
+                }
+            }
+        }
+        for (GLuint c = first_child[s]; c != none; c = next_sibling[c])
+        {
+            for (size_t q = row_offsets[c]; q < row_offsets[c + 1]; q++)
+            {
+                GLuint row = super_rows[q];
+                if (row > last && mark[row] != s)
+                {
+                    mark[row] = s;
+                    out[count++] = row;
+                }
+            }
+        }
+
+        if (count != row_offsets[s + 1] - row_offsets[s])
+            return 2;
+        std::sort(out + (last - first + 1), out + count);
+    }
+
+    return 0;
+}
+
+int SparseCholesky::numeric()
+{
+    size_t super_count = super_start.size() - 1;
+    values.assign(value_offsets[super_count], 0.0);
+    next_row.assign(super_count, 0);
+
+    // Descendants waiting to update each supernode, as linked lists
+    std::vector<GLuint> head(super_count, none), next(super_count, none);
+    std::vector<GLuint> position(n);
+
+    for (size_t s = 0; s < super_count; s++)
+    {
+        GLuint first = super_start[s];
+        size_t columns = super_start[s + 1] - first;
+        size_t row_count = row_offsets[s + 1] - row_offsets[s];
+        const GLuint *super = &super_rows[row_offsets[s]];
+        double *panel = &values[value_offsets[s]];
+
+        for (size_t r = 0; r < row_count; r++)
+            position[super[r]] = r;
+
+        for (size_t j = 0; j < columns; j++)
+        {
+            for (GLuint q = a_offsets[first + j]; q < a_offsets[first + j + 1]; q++)
+                panel[position[a_rows[q]] + j * row_count] += a_values[q];
+        }
+
+        // Left looking: subtract every earlier supernode with rows among these columns
+        for (GLuint d = head[s], d_next; d != none; d = d_next)
+        {
+            d_next = next[d];
+            const GLuint *rows = &super_rows[row_offsets[d]];
+            size_t d_row_count = row_offsets[d + 1] - row_offsets[d];
+            size_t m1 = 0;
+            while (next_row[d] + m1 < d_row_count && rows[next_row[d] + m1] < first + columns)
+                m1++;
+
+            update(s, d, m1, position);
+
+            next_row[d] += m1;
+            if (next_row[d] < d_row_count)
+            {
+                GLuint target = super_of_column[rows[next_row[d]]];
+                next[d] = head[target];
+                head[target] = d;
+            }
+        }
+
+        // Dense left looking Cholesky of the panel, which also solves the rows below the diagonal block
+        for (size_t j = 0; j < columns; j++)
+        {
+            double *column = panel + j * row_count;
+            for (size_t k = 0; k < j; k++)
+            {
+                double a = panel[k * row_count + j];
+                const double *source = panel + k * row_count;
+                for (size_t r = j; r < row_count; r++)
+                    column[r] -= source[r] * a;
+            }
+
+            if (!(column[j] > 0))
+                return 1;
+            double diagonal = sqrt(column[j]);
+            column[j] = diagonal;
+            for (size_t r = j + 1; r < row_count; r++)
+                column[r] /= diagonal;
+        }
+
+        if (row_count > columns)
+        {
+            next_row[s] = columns;
+            GLuint target = super_of_column[super[columns]];
+            next[s] = head[target];
+            head[target] = s;
+        }
+    }
+
+    return 0;
+}
+
+void SparseCholesky::update(size_t target, size_t descendant, size_t m1, const std::vector<GLuint> &position)
+{
+    // target -= L_d[rows p.., :] * L_d[rows p..p + m1, :]^T, in register tiles of tile_columns by tile_rows
+    // that are scattered straight into the target panel
+    const GLuint *rows = &super_rows[row_offsets[descendant]] + next_row[descendant];
+    size_t d_row_count = row_offsets[descendant + 1] - row_offsets[descendant];
+    size_t d_columns = super_start[descendant + 1] - super_start[descendant];
+    size_t m2 = d_row_count - next_row[descendant];
+    const double *source = &values[value_offsets[descendant]] + next_row[descendant];
+
+    GLuint first = super_start[target];
+    size_t row_count = row_offsets[target + 1] - row_offsets[target];
+    double *panel = &values[value_offsets[target]];
+
+    for (size_t c0 = 0; c0 < m1; c0 += tile_columns)
+    {
+        size_t width = std::min(tile_columns, m1 - c0);
+        double *columns[tile_columns];
+        for (size_t c = 0; c < width; c++)
+            columns[c] = panel + (rows[c0 + c] - first) * row_count;
+
+        for (size_t r0 = c0; r0 < m2; r0 += tile_rows)
+        {
+            size_t height = std::min(tile_rows, m2 - r0);
+            double sums[tile_columns][tile_rows] = {};
+            if (width == tile_columns && height == tile_rows)
+            {
+                for (size_t k = 0; k < d_columns; k++)
+                {
+                    const double *column = source + k * d_row_count;
+                    for (size_t c = 0; c < tile_columns; c++)
+                    {
+                        for (size_t r = 0; r < tile_rows; r++)
+                            sums[c][r] += column[r0 + r] * column[c0 + c];
+                    }
+                }
+            }
+            else
+            {
+                for (size_t k = 0; k < d_columns; k++)
+                {
+                    const double *column = source + k * d_row_count;
+                    for (size_t c = 0; c < width; c++)
+                    {
+                        for (size_t r = 0; r < height; r++)
+                            sums[c][r] += column[r0 + r] * column[c0 + c];
+                    }
+                }
+            }
+
+            // Rows above the diagonal of the first tile are never read
+            for (size_t c = 0; c < width; c++)
+            {
+                for (size_t r = r0 < c0 + c ? c0 + c - r0 : 0; r < height; r++)
+                    columns[c][position[rows[r0 + r]]] -= sums[c][r];
+            }
+        }
+    }
+}
+
+void SparseCholesky::solve(glm::dvec3 *b)
+{
+    permuted.resize(n);
+    for (size_t i = 0; i < n; i++)
+        permuted[inverse[i]] = b[i];
+
+    size_t super_count = super_start.size() - 1;
+
+    // L y = b
+    for (size_t s = 0; s < super_count; s++)
+    {
+        GLuint first = super_start[s];
+        size_t columns = super_start[s + 1] - first;
+        size_t row_count = row_offsets[s + 1] - row_offsets[s];
+        const GLuint *rows = &super_rows[row_offsets[s]];
+        const double *panel = &values[value_offsets[s]];
+
+        for (size_t j = 0; j < columns; j++)
+        {
+            const double *column = panel + j * row_count;
+            glm::dvec3 y = permuted[first + j] /= column[j];
+            for (size_t r = j + 1; r < row_count; r++)
+                permuted[rows[r]] -= column[r] * y;
+        }
+    }
+
+    // L^T x = y
+    for (size_t s = super_count; s-- > 0;)
+    {
+        GLuint first = super_start[s];
+        size_t columns = super_start[s + 1] - first;
+        size_t row_count = row_offsets[s + 1] - row_offsets[s];
+        const GLuint *rows = &super_rows[row_offsets[s]];
+        const double *panel = &values[value_offsets[s]];
+
+        for (size_t j = columns; j-- > 0;)
+        {
+            const double *column = panel + j * row_count;
+            glm::dvec3 x = permuted[first + j];
+            for (size_t r = j + 1; r < row_count; r++)
+                x -= column[r] * permuted[rows[r]];
+            permuted[first + j] = x / column[j];
+        }
+    }
+
+    for (size_t i = 0; i < n; i++)
+        b[i] = permuted[inverse[i]];
+}
+
+size_t SparseCholesky::getSize() const
+{
+    return n;
+}
+
+size_t SparseCholesky::getFactorNonzeros() const
+{
+    return values.size();
+}
+
+size_t SparseCholesky::getSupernodeCount() const
+{
+    return super_start.empty() ? 0 : super_start.size() - 1;
+}
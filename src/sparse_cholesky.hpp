@@ -0,0 +1,54 @@
+#pragma once
+
+#include "includes.h"
+
+#include <vector>
+
+// Supernodal Cholesky factorization A = L L^T of a sparse symmetric positive definite matrix,
+// factored once and then solved against any number of right hand sides.
+// Rows are renumbered by geometric nested dissection to keep the fill low, and the columns of L are
+// grouped into supernodes of at most max_supernode_width columns sharing one row pattern, stored as
+// dense column-major panels so that both the factorization and the solves stream through contiguous memory.
+class SparseCholesky
+{
+public:
+    // A's lower triangle by column: column j holds rows[offsets[j], offsets[j + 1]) >= j with values.
+    // coordinates[i] is where row i sits in space, for the ordering.
+    // Returns nonzero if A is not positive definite.
+    int factor(size_t n, const GLuint *offsets, const GLuint *rows, const double *values, const glm::vec3 *coordinates);
+    // Solves A x = b in place, for the x, y and z columns at once
+    void solve(glm::dvec3 *b);
+
+    size_t getSize() const;
+    // Stored entries of L, including the explicit zeros of the dense panels
+    size_t getFactorNonzeros() const;
+    size_t getSupernodeCount() const;
+
+    static const size_t max_supernode_width = 128;
+
+private:
+    void order(const std::vector<std::vector<GLuint>> &graph, const glm::vec3 *coordinates);
+    int symbolic(const GLuint *offsets, const GLuint *rows, const double *values);
+    int numeric();
+    void update(size_t target, size_t descendant, size_t m1, const std::vector<GLuint> &position);
+
+    size_t n = 0;
+    // perm[new] = old, inverse[old] = new
+    std::vector<GLuint> perm, inverse;
+
+    // A permuted, lower triangle by column
+    std::vector<GLuint> a_offsets, a_rows;
+    std::vector<double> a_values;
+
+    // Supernode s covers columns [super_start[s], super_start[s + 1]), its rows (own columns first) are
+    // super_rows[row_offsets[s], row_offsets[s + 1]) and its panel is values[value_offsets[s]...] column-major
+    std::vector<GLuint> super_start, super_of_column;
+    std::vector<size_t> row_offsets, value_offsets;
+    std::vector<GLuint> super_rows;
+    std::vector<double> values;
+
+    // Where each descendant's next block of rows starts while factoring
+    std::vector<size_t> next_row;
+    // Right hand side in the factor's numbering
+    std::vector<glm::dvec3> permuted;
+};
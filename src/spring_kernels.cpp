@@ -0,0 +1,511 @@
+#include "spring_kernels.hpp"
+
+#include "glm/gtc/quaternion.hpp"
+
+#include <algorithm>
+#include <math.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SPRING_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+// Keeps the rest length division finite for null springs, whose k of 0 then zeroes the force
+static const float min_length = 1e-12f;
+
+void buildSpringsSoA(const Spring *springs, size_t spring_count, const PhysicsConfig &physics, SpringsSoA &soa)
+{
+    soa.point1.resize(spring_count);
+    soa.point2.resize(spring_count);
+    soa.len.resize(spring_count);
+    soa.k.resize(spring_count);
+
+    for (size_t i = 0; i < spring_count; i++)
+    {
+        soa.point1[i] = springs[i].point1;
+        soa.point2[i] = springs[i].point2;
+        soa.len[i] = springs[i].len;
+        soa.k[i] = springs[i].type ? physics.stiffness[springs[i].type] : 0.0f;
+    }
+}
+
+void computeSpringForces(const Spring *springs, size_t begin, size_t end, const PhysicsConfig &physics,
+                         const glm::vec4 *positions, glm::vec4 *forces)
+{
+    for (size_t i = begin; i < end; i++)
+    {
+        const Spring &spring = springs[i];
+        if (spring.type == 0)
+            continue;
+
+        glm::vec4 force = positions[spring.point2] - positions[spring.point1];
+        force *= (1 - spring.len / glm::length(force)) * physics.stiffness[spring.type];
+
+        forces[spring.point1] += force;
+        forces[spring.point2] -= force;
+    }
+}
+
+void projectSpringConstraints(const Spring *springs, size_t begin, size_t end, const PhysicsConfig &physics, float delta_t,
+                              float *lambdas, glm::vec4 *positions)
+{
+    // Every mass weighs the same, so both inverse masses are 1 / mass
+    float weight = 1 / physics.mass;
+    for (size_t i = begin; i < end; i++)
+    {
+        const Spring &spring = springs[i];
+        if (spring.type == 0)
+            continue;
+
+        glm::vec4 difference = positions[spring.point2] - positions[spring.point1];
+        float length = glm::length(difference);
+        if (length < 1e-12f)
+            continue;
+
+        float compliance = 1 / (physics.stiffness[spring.type] * delta_t * delta_t);
+        float delta_lambda = (spring.len - length - compliance * lambdas[i]) / (2 * weight + compliance);
+        lambdas[i] += delta_lambda;
+
+        glm::vec4 correction = difference * (weight * delta_lambda / length);
+        positions[spring.point1] -= correction;
+        positions[spring.point2] += correction;
+    }
+}
+
+void projectSprings(const Spring *springs, size_t begin, size_t end, const PhysicsConfig &physics,
+                    const glm::vec4 *positions, glm::dvec3 *projections)
+{
+    for (size_t i = begin; i < end; i++)
+    {
+        const Spring &spring = springs[i];
+        if (spring.type == 0)
+            continue;
+
+        glm::vec3 difference = glm::vec3(positions[spring.point2] - positions[spring.point1]);
+        float length = glm::length(difference);
+        if (length < 1e-12f)
+            continue;
+
+        // The spring term is k / 2 |(x2 - x1) - d|^2, contributing k d to x2 and -k d to x1
+        glm::dvec3 projection = glm::dvec3(difference * (physics.stiffness[spring.type] * spring.len / length));
+        projections[spring.point1] -= projection;
+        projections[spring.point2] += projection;
+    }
+}
+
+double projectSpringConstraintsJacobi(const GLuint *offsets, const Spring *adjacency, size_t begin, size_t end, const PhysicsConfig &physics,
+                                      float delta_t, float relaxation, bool first, const float *lambdas, const glm::vec4 *positions,
+                                      float *next_lambdas, glm::vec4 *next_positions)
+{
+    float weight = 1 / physics.mass;
+    double residual = 0;
+    for (size_t i = begin; i < end; i++)
+    {
+        glm::vec4 position = positions[i];
+        glm::vec4 total = glm::vec4(0.0f);
+        GLuint count = offsets[i + 1] - offsets[i];
+        for (GLuint j = offsets[i]; j < offsets[i + 1]; j++)
+        {
+            GLuint other = adjacency[j].point2;
+            glm::vec4 difference = positions[other] - position;
+            float length = std::max(glm::length(difference), 1e-12f);
+            float lambda = first ? 0.0f : lambdas[j];
+
+            float compliance = 1 / (physics.stiffness[adjacency[j].type] * delta_t * delta_t);
+            float constraint = adjacency[j].len - length - compliance * lambda;
+            // Scaled down by the busier end so that the corrections summed at either mass cannot overshoot,
+            // the same at both ends so the two copies of the multiplier stay equal
+            float delta_lambda = constraint / (2 * weight + compliance) * relaxation / std::max(count, offsets[other + 1] - offsets[other]);
+            next_lambdas[j] = lambda + delta_lambda;
+            total -= difference * (weight * delta_lambda / length);
+            residual += 0.5 * constraint * constraint;
+        }
+
+        next_positions[i] = position + total;
+    }
+    return residual;
+}
+
+void computeSpringForcesGather(const GLuint *offsets, const Spring *adjacency, size_t begin, size_t end, const PhysicsConfig &physics,
+                               const glm::vec4 *positions, glm::vec4 *forces)
+{
+    for (size_t i = begin; i < end; i++)
+    {
+        glm::vec4 position = positions[i];
+        glm::vec4 total = glm::vec4(0.0f);
+        for (GLuint j = offsets[i]; j < offsets[i + 1]; j++)
+        {
+            glm::vec4 force = positions[adjacency[j].point2] - position;
+            total += force * ((1 - adjacency[j].len / glm::length(force)) * physics.stiffness[adjacency[j].type]);
+        }
+        forces[i] += total;
+    }
+}
+
+void computeSpringForcesLattice(const LatticeConfig &lattice, size_t begin, size_t end, const PhysicsConfig &physics,
+                                const glm::vec4 *positions, glm::vec4 *forces)
+{
+    const int size[3]{(int)lattice.masses_x, (int)lattice.masses_y, (int)lattice.masses_z};
+
+    // Masses at least 2 from every face have all their springs except the edge diagonals,
+    // so they skip the bounds checks and use flat index deltas
+    int deltas[12];
+    float k[12];
+    for (int j = 0; j < 12; j++)
+    {
+        const LatticeStencil &stencil = lattice_stencil[j];
+        deltas[j] = stencil.offset[0] + size[0] * (stencil.offset[1] + size[1] * stencil.offset[2]);
+        k[j] = physics.stiffness[stencil.type];
+    }
+
+    int mass[3]{(int)(begin % size[0]), (int)(begin / size[0] % size[1]), (int)(begin / size[0] / size[1])};
+    for (size_t i = begin; i < end; i++)
+    {
+        glm::vec4 position = positions[i];
+        glm::vec4 total = glm::vec4(0.0f);
+
+        bool interior = true;
+        for (int axis = 0; axis < 3; axis++)
+            interior &= mass[axis] >= 2 && mass[axis] < size[axis] - 2;
+
+        if (interior)
+        {
+            for (int j = 0; j < 12; j++)
+            {
+                if (lattice_stencil[j].edge_axis >= 0)
+                    continue;
+
+                glm::vec4 owned = positions[i + deltas[j]] - position;
+                glm::vec4 incoming = positions[i - deltas[j]] - position;
+                total += owned * ((1 - lattice.rest_lengths[j] / glm::length(owned)) * k[j]);
+                total += incoming * ((1 - lattice.rest_lengths[j] / glm::length(incoming)) * k[j]);
+            }
+        }
+        else
+        {
+            for (int j = 0; j < 12; j++)
+            {
+                const LatticeStencil &stencil = lattice_stencil[j];
+                // sign 1: this mass owns the spring, sign -1: it is the far end
+                for (int sign = 1; sign >= -1; sign -= 2)
+                {
+                    int other[3];
+                    bool inside = true;
+                    for (int axis = 0; axis < 3; axis++)
+                    {
+                        other[axis] = mass[axis] + sign * stencil.offset[axis];
+                        inside &= other[axis] >= 0 && other[axis] < size[axis];
+                    }
+                    if (!inside)
+                        continue;
+
+                    const int *owner = sign == 1 ? mass : other;
+                    if (stencil.edge_axis >= 0 && owner[stencil.edge_axis] != 0)
+                        continue;
+
+                    glm::vec4 force = positions[i + sign * deltas[j]] - position;
+                    total += force * ((1 - lattice.rest_lengths[j] / glm::length(force)) * k[j]);
+                }
+            }
+        }
+        forces[i] += total;
+
+        if (++mass[0] == size[0])
+        {
+            mass[0] = 0;
+            if (++mass[1] == size[1])
+            {
+                mass[1] = 0;
+                mass[2]++;
+            }
+        }
+    }
+}
+
+void matchShapeClusters(const LatticeConfig &lattice, size_t begin, size_t end, const glm::vec4 *positions, glm::vec4 *clusters)
+{
+    GLuint counts[3];
+    getShapeClusterCounts(lattice, counts);
+    const int size[3]{(int)lattice.masses_x, (int)lattice.masses_y, (int)lattice.masses_z};
+    const int length = (int)lattice.cluster_length;
+    const glm::vec3 spacing(lattice.rest_lengths[0], lattice.rest_lengths[1], lattice.rest_lengths[2]);
+
+    for (size_t c = begin; c < end; c++)
+    {
+        const size_t cell[3]{c % counts[0], c / counts[0] % counts[1], c / counts[0] / counts[1]};
+        int first[3], last[3];
+        for (int axis = 0; axis < 3; axis++)
+        {
+            first[axis] = (int)cell[axis] * length;
+            last[axis] = std::min(first[axis] + length, size[axis] - 1);
+        }
+        glm::vec3 rest_center = glm::vec3(first[0] + last[0], first[1] + last[1], first[2] + last[2]) * 0.5f * spacing;
+
+        glm::vec3 center(0.0f);
+        for (int z = first[2]; z <= last[2]; z++)
+            for (int y = first[1]; y <= last[1]; y++)
+                for (int x = first[0]; x <= last[0]; x++)
+                    center += glm::vec3(positions[x + size[0] * (y + size[1] * z)]);
+        center /= (float)((last[0] - first[0] + 1) * (last[1] - first[1] + 1) * (last[2] - first[2] + 1));
+
+        // Covariance of the current offsets from the center with the rest ones, A = sum p q^T
+        glm::mat3 covariance(0.0f);
+        for (int z = first[2]; z <= last[2]; z++)
+            for (int y = first[1]; y <= last[1]; y++)
+                for (int x = first[0]; x <= last[0]; x++)
+                {
+                    glm::vec3 offset = glm::vec3(positions[x + size[0] * (y + size[1] * z)]) - center;
+                    covariance += glm::outerProduct(offset, glm::vec3(x, y, z) * spacing - rest_center);
+                }
+
+        // Rotational part of A, by Mueller et al. 2016: turn R about the axis that best aligns its columns with A's
+        glm::vec4 stored = clusters[2 * c + 1];
+        glm::quat rotation(stored.w, stored.x, stored.y, stored.z);
+        for (unsigned iteration = 0; iteration < lattice.shape_iterations; iteration++)
+        {
+            glm::mat3 r = glm::mat3_cast(rotation);
+            glm::vec3 omega = glm::cross(r[0], covariance[0]) + glm::cross(r[1], covariance[1]) + glm::cross(r[2], covariance[2]);
+            omega /= fabsf(glm::dot(r[0], covariance[0]) + glm::dot(r[1], covariance[1]) + glm::dot(r[2], covariance[2])) + 1e-9f;
+            float angle = glm::length(omega);
+            if (angle < 1e-9f)
+                break;
+            rotation = glm::normalize(glm::angleAxis(angle, omega / angle) * rotation);
+        }
+
+        clusters[2 * c] = glm::vec4(center, 0.0f);
+        clusters[2 * c + 1] = glm::vec4(rotation.x, rotation.y, rotation.z, rotation.w);
+    }
+}
+
+void computeShapeMatchingForces(const LatticeConfig &lattice, size_t begin, size_t end, const PhysicsConfig &physics, float force_scale,
+                                const glm::vec4 *positions, const glm::vec4 *clusters, glm::vec4 *forces)
+{
+    GLuint counts[3];
+    getShapeClusterCounts(lattice, counts);
+    const int size[3]{(int)lattice.masses_x, (int)lattice.masses_y, (int)lattice.masses_z};
+    const int length = (int)lattice.cluster_length;
+    const glm::vec3 spacing(lattice.rest_lengths[0], lattice.rest_lengths[1], lattice.rest_lengths[2]);
+    const float scale = physics.shape_stiffness * physics.mass / force_scale;
+
+    for (size_t i = begin; i < end; i++)
+    {
+        const int mass[3]{(int)(i % size[0]), (int)(i / size[0] % size[1]), (int)(i / size[0] / size[1])};
+
+        // A mass on a boundary layer belongs to the clusters on both sides of it, so up to 2 along each axis
+        int candidates[3][2], candidate_counts[3]{0, 0, 0};
+        for (int axis = 0; axis < 3; axis++)
+        {
+            for (int cell = mass[axis] / length - 1; cell <= mass[axis] / length; cell++)
+            {
+                if (cell >= 0 && cell < (int)counts[axis] && mass[axis] <= std::min((cell + 1) * length, size[axis] - 1))
+                    candidates[axis][candidate_counts[axis]++] = cell;
+            }
+        }
+
+        glm::vec3 goal(0.0f);
+        int goals = 0;
+        for (int a = 0; a < candidate_counts[0]; a++)
+            for (int b = 0; b < candidate_counts[1]; b++)
+                for (int d = 0; d < candidate_counts[2]; d++)
+                {
+                    const int cell[3]{candidates[0][a], candidates[1][b], candidates[2][d]};
+                    glm::vec3 rest_center;
+                    for (int axis = 0; axis < 3; axis++)
+                    {
+                        int first = cell[axis] * length;
+                        rest_center[axis] = (first + std::min(first + length, size[axis] - 1)) * 0.5f * spacing[axis];
+                    }
+
+                    size_t c = cell[0] + counts[0] * (cell[1] + (size_t)counts[1] * cell[2]);
+                    glm::vec4 stored = clusters[2 * c + 1];
+                    glm::quat rotation(stored.w, stored.x, stored.y, stored.z);
+                    goal += glm::vec3(clusters[2 * c]) + rotation * (glm::vec3(mass[0], mass[1], mass[2]) * spacing - rest_center);
+                    goals++;
+                }
+
+        glm::vec3 position = glm::vec3(positions[i]);
+        forces[i] += glm::vec4((goal / (float)goals - position) * scale, 0.0f);
+    }
+}
+
+static void scalarSpringForces(const SpringsSoA &springs, size_t begin, size_t end,
+                               const float *x, const float *y, const float *z, glm::vec4 *forces)
+{
+    for (size_t i = begin; i < end; i++)
+    {
+        if (springs.k[i] == 0.0f)
+            continue;
+
+        uint32_t p1 = springs.point1[i], p2 = springs.point2[i];
+        float dx = x[p2] - x[p1], dy = y[p2] - y[p1], dz = z[p2] - z[p1];
+        float length = std::max(sqrtf(dx * dx + dy * dy + dz * dz), min_length);
+        float s = (1 - springs.len[i] / length) * springs.k[i];
+
+        glm::vec4 force = glm::vec4(dx * s, dy * s, dz * s, 0.0f);
+        forces[p1] += force;
+        forces[p2] -= force;
+    }
+}
+
+#ifdef SPRING_KERNELS_X86
+
+// The vector part only evaluates forces; two springs in one vector can share a mass,
+// so accumulation goes through this per-spring scatter, one vec4 read-modify-write per end.
+// live has a bit set for every non-null spring, the rest are skipped
+static inline void scatterSpringForces(const uint32_t *p1, const uint32_t *p2, const float *sx, const float *sy, const float *sz, unsigned live,
+                                       glm::vec4 *forces)
+{
+    for (; live; live &= live - 1)
+    {
+        unsigned j = __builtin_ctz(live);
+        __m128 force = _mm_setr_ps(sx[j], sy[j], sz[j], 0.0f);
+        float *f1 = &forces[p1[j]].x, *f2 = &forces[p2[j]].x;
+        _mm_storeu_ps(f1, _mm_add_ps(_mm_loadu_ps(f1), force));
+        _mm_storeu_ps(f2, _mm_sub_ps(_mm_loadu_ps(f2), force));
+    }
+}
+
+__attribute__((target("sse4.1"))) static void sse4SpringForces(const SpringsSoA &springs, size_t begin, size_t end,
+                                                               const float *x, const float *y, const float *z, glm::vec4 *forces)
+{
+    alignas(16) float sx[4], sy[4], sz[4];
+    size_t i = begin;
+    for (; i + 4 <= end; i += 4)
+    {
+        const uint32_t *p1 = &springs.point1[i], *p2 = &springs.point2[i];
+        // No gather before AVX2
+        __m128 dx = _mm_sub_ps(_mm_setr_ps(x[p2[0]], x[p2[1]], x[p2[2]], x[p2[3]]), _mm_setr_ps(x[p1[0]], x[p1[1]], x[p1[2]], x[p1[3]]));
+        __m128 dy = _mm_sub_ps(_mm_setr_ps(y[p2[0]], y[p2[1]], y[p2[2]], y[p2[3]]), _mm_setr_ps(y[p1[0]], y[p1[1]], y[p1[2]], y[p1[3]]));
+        __m128 dz = _mm_sub_ps(_mm_setr_ps(z[p2[0]], z[p2[1]], z[p2[2]], z[p2[3]]), _mm_setr_ps(z[p1[0]], z[p1[1]], z[p1[2]], z[p1[3]]));
+
+        __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+        length = _mm_max_ps(length, _mm_set1_ps(min_length));
+        __m128 k = _mm_loadu_ps(&springs.k[i]);
+        __m128 s = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(1.0f), _mm_div_ps(_mm_loadu_ps(&springs.len[i]), length)), k);
+
+        _mm_store_ps(sx, _mm_mul_ps(dx, s));
+        _mm_store_ps(sy, _mm_mul_ps(dy, s));
+        _mm_store_ps(sz, _mm_mul_ps(dz, s));
+        scatterSpringForces(p1, p2, sx, sy, sz, _mm_movemask_ps(_mm_cmpneq_ps(k, _mm_setzero_ps())), forces);
+    }
+    scalarSpringForces(springs, i, end, x, y, z, forces);
+}
+
+__attribute__((target("avx2,fma"))) static void avx2SpringForces(const SpringsSoA &springs, size_t begin, size_t end,
+                                                                 const float *x, const float *y, const float *z, glm::vec4 *forces)
+{
+    alignas(32) float sx[8], sy[8], sz[8];
+    size_t i = begin;
+    for (; i + 8 <= end; i += 8)
+    {
+        __m256i p1 = _mm256_loadu_si256((const __m256i *)&springs.point1[i]);
+        __m256i p2 = _mm256_loadu_si256((const __m256i *)&springs.point2[i]);
+
+        __m256 dx = _mm256_sub_ps(_mm256_i32gather_ps(x, p2, 4), _mm256_i32gather_ps(x, p1, 4));
+        __m256 dy = _mm256_sub_ps(_mm256_i32gather_ps(y, p2, 4), _mm256_i32gather_ps(y, p1, 4));
+        __m256 dz = _mm256_sub_ps(_mm256_i32gather_ps(z, p2, 4), _mm256_i32gather_ps(z, p1, 4));
+
+        __m256 length = _mm256_sqrt_ps(_mm256_fmadd_ps(dz, dz, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx))));
+        length = _mm256_max_ps(length, _mm256_set1_ps(min_length));
+        __m256 k = _mm256_loadu_ps(&springs.k[i]);
+        __m256 s = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(1.0f), _mm256_div_ps(_mm256_loadu_ps(&springs.len[i]), length)), k);
+
+        _mm256_store_ps(sx, _mm256_mul_ps(dx, s));
+        _mm256_store_ps(sy, _mm256_mul_ps(dy, s));
+        _mm256_store_ps(sz, _mm256_mul_ps(dz, s));
+        scatterSpringForces(&springs.point1[i], &springs.point2[i], sx, sy, sz, _mm256_movemask_ps(_mm256_cmp_ps(k, _mm256_setzero_ps(), _CMP_NEQ_OQ)), forces);
+    }
+    scalarSpringForces(springs, i, end, x, y, z, forces);
+}
+
+__attribute__((target("avx512f"))) static void avx512SpringForces(const SpringsSoA &springs, size_t begin, size_t end,
+                                                                  const float *x, const float *y, const float *z, glm::vec4 *forces)
+{
+    alignas(64) float sx[16], sy[16], sz[16];
+    size_t i = begin;
+    for (; i + 16 <= end; i += 16)
+    {
+        __m512i p1 = _mm512_loadu_si512(&springs.point1[i]);
+        __m512i p2 = _mm512_loadu_si512(&springs.point2[i]);
+
+        __m512 dx = _mm512_sub_ps(_mm512_i32gather_ps(p2, x, 4), _mm512_i32gather_ps(p1, x, 4));
+        __m512 dy = _mm512_sub_ps(_mm512_i32gather_ps(p2, y, 4), _mm512_i32gather_ps(p1, y, 4));
+        __m512 dz = _mm512_sub_ps(_mm512_i32gather_ps(p2, z, 4), _mm512_i32gather_ps(p1, z, 4));
+
+        __m512 length = _mm512_sqrt_ps(_mm512_fmadd_ps(dz, dz, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dx, dx))));
+        length = _mm512_max_ps(length, _mm512_set1_ps(min_length));
+        __m512 k = _mm512_loadu_ps(&springs.k[i]);
+        __m512 s = _mm512_mul_ps(_mm512_sub_ps(_mm512_set1_ps(1.0f), _mm512_div_ps(_mm512_loadu_ps(&springs.len[i]), length)), k);
+
+        _mm512_store_ps(sx, _mm512_mul_ps(dx, s));
+        _mm512_store_ps(sy, _mm512_mul_ps(dy, s));
+        _mm512_store_ps(sz, _mm512_mul_ps(dz, s));
+        scatterSpringForces(&springs.point1[i], &springs.point2[i], sx, sy, sz, _mm512_cmp_ps_mask(k, _mm512_setzero_ps(), _CMP_NEQ_OQ), forces);
+    }
+    scalarSpringForces(springs, i, end, x, y, z, forces);
+}
+
+#endif
+
+SpringISA detectSpringISA()
+{
+#ifdef SPRING_KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return SpringISA::AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return SpringISA::AVX2;
+    if (__builtin_cpu_supports("sse4.1"))
+        return SpringISA::SSE4;
+#endif
+    return SpringISA::Scalar;
+}
+
+SpringISA resolveSpringISA(SpringISA isa)
+{
+    SpringISA detected = detectSpringISA();
+    if (isa == SpringISA::Auto || (isa != SpringISA::Reference && isa > detected))
+        return detected;
+    return isa;
+}
+
+const char *getSpringISAName(SpringISA isa)
+{
+    switch (isa)
+    {
+    case SpringISA::Reference:
+        return "reference";
+    case SpringISA::Scalar:
+        return "scalar";
+    case SpringISA::SSE4:
+        return "sse4";
+    case SpringISA::AVX2:
+        return "avx2";
+    case SpringISA::AVX512:
+        return "avx512";
+    default:
+        return "auto";
+    }
+}
+
+void computeSpringForces(SpringISA isa, const SpringsSoA &springs, size_t begin, size_t end,
+                         const float *x, const float *y, const float *z, glm::vec4 *forces)
+{
+    switch (isa)
+    {
+#ifdef SPRING_KERNELS_X86
+    case SpringISA::SSE4:
+        sse4SpringForces(springs, begin, end, x, y, z, forces);
+        break;
+    case SpringISA::AVX2:
+        avx2SpringForces(springs, begin, end, x, y, z, forces);
+        break;
+    case SpringISA::AVX512:
+        avx512SpringForces(springs, begin, end, x, y, z, forces);
+        break;
+#endif
+    default:
+        scalarSpringForces(springs, begin, end, x, y, z, forces);
+        break;
+    }
+}
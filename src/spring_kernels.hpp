@@ -0,0 +1,85 @@
+#pragma once
+
+#include "constructs.h"
+#include "spring_layout.hpp"
+
+#include <stdint.h>
+#include <vector>
+
+// Instruction sets the SoA spring kernel is compiled for, picked at runtime by detectSpringISA()
+enum class SpringISA
+{
+    Reference, // glm over the AoS Spring array, as springs.comp does it
+    Scalar,
+    SSE4,
+    AVX2,
+    AVX512,
+    Auto
+};
+
+// Structure-of-arrays copy of the Spring buffer, slot for slot
+typedef struct
+{
+    std::vector<uint32_t> point1;
+    std::vector<uint32_t> point2;
+    std::vector<float> len;
+    // physics.stiffness[type], 0 for null springs
+    std::vector<float> k;
+} SpringsSoA;
+
+void buildSpringsSoA(const Spring *springs, size_t spring_count, const PhysicsConfig &physics, SpringsSoA &soa);
+
+SpringISA detectSpringISA();
+SpringISA resolveSpringISA(SpringISA isa);
+const char *getSpringISAName(SpringISA isa);
+
+// SpringISA::Reference: adds the forces of springs [begin, end) into forces, exactly as springs.comp does
+void computeSpringForces(const Spring *springs, size_t begin, size_t end, const PhysicsConfig &physics,
+                         const glm::vec4 *positions, glm::vec4 *forces);
+
+// XPBD: projects springs [begin, end) in order as distance constraints with compliance 1 / stiffness,
+// accumulating each spring's Lagrange multiplier in lambdas (zeroed at the start of every step).
+// Springs in the range may share masses; ranges run concurrently must not.
+void projectSpringConstraints(const Spring *springs, size_t begin, size_t end, const PhysicsConfig &physics, float delta_t,
+                              float *lambdas, glm::vec4 *positions);
+
+// Projective dynamics local step: snaps springs [begin, end) to their rest length along their current direction
+// and adds each projection, weighted by its stiffness, into the right hand side of the global step.
+// Springs in the range may share masses; ranges run concurrently must not.
+void projectSprings(const Spring *springs, size_t begin, size_t end, const PhysicsConfig &physics,
+                    const glm::vec4 *positions, glm::dvec3 *projections);
+
+// Jacobi form of projectSpringConstraints() over a buildSpringAdjacency() layout, for the masses in [begin, end):
+// reads positions and lambdas (one per adjacency entry, both ends keep an identical copy) and writes the
+// projected position and multipliers to next_positions and next_lambdas, so any split of the masses can run
+// concurrently. first ignores lambdas as the zero of a new step. Returns the sum of the squared constraint
+// residuals at the incident springs, halved since every spring is seen from both ends.
+double projectSpringConstraintsJacobi(const GLuint *offsets, const Spring *adjacency, size_t begin, size_t end, const PhysicsConfig &physics,
+                                      float delta_t, float relaxation, bool first, const float *lambdas, const glm::vec4 *positions,
+                                      float *next_lambdas, glm::vec4 *next_positions);
+
+// Gather form over a buildSpringAdjacency() layout: each mass in [begin, end) sums its own incident
+// springs and writes only its own force, so any split of the masses can run concurrently
+void computeSpringForcesGather(const GLuint *offsets, const Spring *adjacency, size_t begin, size_t end, const PhysicsConfig &physics,
+                               const glm::vec4 *positions, glm::vec4 *forces);
+
+// Gather form straight off the lattice_stencil: each mass in [begin, end) visits the 12 springs it owns
+// and the 12 it could be the far end of, with no spring data read at all
+void computeSpringForcesLattice(const LatticeConfig &lattice, size_t begin, size_t end, const PhysicsConfig &physics,
+                                const glm::vec4 *positions, glm::vec4 *forces);
+
+// Shape matching, first pass: for the getShapeClusterCounts() clusters [begin, end), finds the center of their
+// masses and the rotation that best maps their rest shape onto them, by the polar decomposition of the
+// deformation. clusters holds 2 entries per cluster, the center and the rotation as an x, y, z, w quaternion,
+// which starts the iteration from the last step's.
+void matchShapeClusters(const LatticeConfig &lattice, size_t begin, size_t end, const glm::vec4 *positions, glm::vec4 *clusters);
+
+// Shape matching, second pass: each mass in [begin, end) averages its goal positions in the clusters it belongs
+// to and adds the force that moves it physics.shape_stiffness of the way there under integrate()'s force_scale
+void computeShapeMatchingForces(const LatticeConfig &lattice, size_t begin, size_t end, const PhysicsConfig &physics, float force_scale,
+                                const glm::vec4 *positions, const glm::vec4 *clusters, glm::vec4 *forces);
+
+// Adds the forces of springs [begin, end) into forces, reading positions from the x/y/z arrays.
+// Springs in the range may share masses; ranges run concurrently must not.
+void computeSpringForces(SpringISA isa, const SpringsSoA &springs, size_t begin, size_t end,
+                         const float *x, const float *y, const float *z, glm::vec4 *forces);
@@ -0,0 +1,106 @@
+#include "spring_layout.hpp"
+
+#include <algorithm>
+
+const char *getSpringFormulationName(SpringFormulation formulation)
+{
+    switch (formulation)
+    {
+    case SpringFormulation::Scatter:
+        return "scatter";
+    case SpringFormulation::Gather:
+        return "gather";
+    case SpringFormulation::Lattice:
+        return "lattice";
+    case SpringFormulation::ShapeMatching:
+        return "shape-matching";
+    default:
+        return "unknown";
+    }
+}
+
+bool usesSpringBuffer(SpringFormulation formulation)
+{
+    return formulation == SpringFormulation::Scatter || formulation == SpringFormulation::Gather;
+}
+
+// Same order as the spring slots in constructCube(), including its choice of rest length per diagonal
+const LatticeStencil lattice_stencil[12]{
+    {{-1, 0, 0}, 1, 0, -1},
+    {{0, -1, 0}, 1, 1, -1},
+    {{0, 0, -1}, 1, 2, -1},
+    {{-1, -1, 0}, 2, 4, -1},
+    {{-1, 0, -1}, 2, 3, -1},
+    {{0, -1, -1}, 2, 5, -1},
+    {{1, -1, 0}, 2, 4, 0},
+    {{-1, 0, 1}, 2, 3, 2},
+    {{0, 1, -1}, 2, 5, 1},
+    {{-2, 0, 0}, 3, 0, -1},
+    {{0, -2, 0}, 3, 1, -1},
+    {{0, 0, -2}, 3, 2, -1}};
+
+LatticeConfig buildLatticeConfig(GLuint masses_x, GLuint masses_y, GLuint masses_z, const float spring_lengths[6], GLuint cluster_length)
+{
+    LatticeConfig lattice;
+    lattice.masses_x = masses_x;
+    lattice.masses_y = masses_y;
+    lattice.masses_z = masses_z;
+    for (int i = 0; i < 12; i++)
+        lattice.rest_lengths[i] = spring_lengths[lattice_stencil[i].length] * (lattice_stencil[i].type == 3 ? 2 : 1);
+    lattice.cluster_length = cluster_length;
+    return lattice;
+}
+
+size_t getShapeClusterCounts(const LatticeConfig &lattice, GLuint counts[3])
+{
+    const GLuint size[3]{lattice.masses_x, lattice.masses_y, lattice.masses_z};
+    for (int axis = 0; axis < 3; axis++)
+        counts[axis] = std::max<GLuint>((size[axis] + lattice.cluster_length - 2) / lattice.cluster_length, 1);
+    return (size_t)counts[0] * counts[1] * counts[2];
+}
+
+size_t compactSpringGroups(Spring *springs, size_t group_count, size_t group_size, GLuint *offsets)
+{
+    size_t count = 0;
+    for (size_t group = 0; group < group_count; group++)
+    {
+        offsets[group] = count;
+        for (size_t i = group * group_size; i < (group + 1) * group_size; i++)
+        {
+            if (springs[i].type != 0)
+                springs[count++] = springs[i];
+        }
+    }
+    offsets[group_count] = count;
+    return count;
+}
+
+void buildSpringAdjacency(const Spring *springs, size_t spring_count, size_t position_count,
+                          std::vector<GLuint> &offsets, std::vector<Spring> &adjacency)
+{
+    // Counting sort by mass
+    offsets.assign(position_count + 1, 0);
+    for (size_t i = 0; i < spring_count; i++)
+    {
+        if (springs[i].type == 0)
+            continue;
+
+        offsets[springs[i].point1 + 1]++;
+        offsets[springs[i].point2 + 1]++;
+    }
+
+    for (size_t i = 0; i < position_count; i++)
+        offsets[i + 1] += offsets[i];
+
+    adjacency.resize(offsets[position_count]);
+    std::vector<GLuint> next(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < spring_count; i++)
+    {
+        const Spring &spring = springs[i];
+        if (spring.type == 0)
+            continue;
+
+        adjacency[next[spring.point1]++] = Spring(spring.point1, spring.point2, spring.type, spring.len);
+        adjacency[next[spring.point2]++] = Spring(spring.point2, spring.point1, spring.type, spring.len);
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "constructs.h"
+
+#include <vector>
+
+// How the spring pass is organized, on both backends
+enum class SpringFormulation
+{
+    // Each spring adds to both of its masses, in 8 colored passes (springs.comp)
+    Scatter,
+    // Each mass sums its incident springs in one pass (springs_gather.comp), computing every spring twice
+    Gather,
+    // Like Gather, but the springs are derived from the cube lattice by index math (springs_lattice.comp),
+    // so no spring or adjacency buffer exists at all
+    Lattice,
+    // No springs: blocks of the lattice are matched to their rest shape, rotated by the polar decomposition of
+    // their deformation, and every mass is pulled towards its goal there (shape_clusters.comp, shape_match.comp)
+    ShapeMatching
+};
+
+const char *getSpringFormulationName(SpringFormulation formulation);
+// Scatter and Gather read the spring buffer, Lattice and ShapeMatching only the cube's grid indices
+bool usesSpringBuffer(SpringFormulation formulation);
+
+// Drops the null springs from group_count groups of group_size slots, in place and keeping their order,
+// and writes where each group now starts to offsets (group_count + 1 entries). Returns the new spring count.
+size_t compactSpringGroups(Spring *springs, size_t group_count, size_t group_size, GLuint *offsets);
+
+// Compressed sparse row adjacency: the springs touching mass i are
+// adjacency[offsets[i]] to adjacency[offsets[i + 1]], each stored with point1 = i.
+// Every spring appears twice, once from each end; null springs are dropped.
+void buildSpringAdjacency(const Spring *springs, size_t spring_count, size_t position_count,
+                          std::vector<GLuint> &offsets, std::vector<Spring> &adjacency);
+
+// One of the 12 springs a mass (the owner) has towards owner + offset in constructCube().
+// The spring exists when the other end is inside the lattice and, for the three diagonals that only
+// run along one face, when the owner sits at 0 on edge_axis.
+typedef struct
+{
+    int offset[3];
+    GLuint type;
+    // Index into the constructCube() rest lengths, doubled for bending springs
+    unsigned length;
+    // -1 for none
+    int edge_axis;
+} LatticeStencil;
+
+extern const LatticeStencil lattice_stencil[12];
+
+// spring_lengths are the x, y, z structural and xy, xz, yz shearing rest lengths
+LatticeConfig buildLatticeConfig(GLuint masses_x, GLuint masses_y, GLuint masses_z, const float spring_lengths[6], GLuint cluster_length);
+
+// Shape matching clusters tile the lattice cluster_length springs apiece along each axis, cluster c covering
+// masses c * cluster_length to (c + 1) * cluster_length, so neighbours share their boundary layer and
+// the last one along an axis may be shorter. Writes how many there are along each axis, and returns their total.
+size_t getShapeClusterCounts(const LatticeConfig &lattice, GLuint counts[3]);
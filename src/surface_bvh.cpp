@@ -0,0 +1,373 @@
+#include "surface_bvh.hpp"
+
+#include <algorithm>
+#include <numeric>
+
+// Surface points that walk the hierarchy together
+static const size_t point_packet = 4;
+
+static double getBoxArea(const glm::vec3 &lower, const glm::vec3 &upper)
+{
+    glm::vec3 size = glm::max(upper - lower, glm::vec3(0.0f));
+    return 2.0 * ((double)size.x * size.y + (double)size.y * size.z + (double)size.z * size.x);
+}
+
+// Whether every triangle under node n came within exclusion of every point [first, last) of SurfaceBVH::points at rest,
+// which sphere holds. If not, the highest nodes below n that did go to SurfaceBVH::packet_skips.
+static bool collectExcluded(SurfaceBVH &bvh, const std::vector<float> &rest_reach, GLuint n, size_t first, size_t last, const glm::vec4 &sphere,
+                            float exclusion)
+{
+    const BVHNode &node = bvh.nodes[n];
+    float dist = glm::distance(glm::vec3(bvh.rest_spheres[n]), glm::vec3(sphere));
+    if (dist + sphere.w + bvh.rest_spheres[n].w < exclusion)
+        return true;
+
+    // Nothing under it within exclusion of any of the points
+    if (dist - sphere.w - rest_reach[n] >= exclusion)
+        return false;
+
+    if (node.count)
+    {
+        // As the queries test its triangles
+        const glm::vec4 *entry_spheres = bvh.rest_spheres.data() + bvh.nodes.size();
+        for (GLuint e = node.first; e < node.first + node.count; e++)
+        {
+            for (size_t i = first; i < last; i++)
+            {
+                if (glm::distance(glm::vec3(entry_spheres[e]), glm::vec3(bvh.point_rest[i])) - entry_spheres[e].w >= exclusion)
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    GLuint left = node.first, right = node.first + 1;
+    bool left_excluded = collectExcluded(bvh, rest_reach, left, first, last, sphere, exclusion);
+    bool right_excluded = collectExcluded(bvh, rest_reach, right, first, last, sphere, exclusion);
+    if (left_excluded && right_excluded)
+        return true;
+    if (left_excluded)
+        bvh.packet_skips.push_back(left);
+    if (right_excluded)
+        bvh.packet_skips.push_back(right);
+    return false;
+}
+
+void buildSurfaceBVH(const ContactSurface &surface, const PhysicsConfig &physics, const glm::vec4 *rest_positions, const glm::vec4 *positions,
+                     unsigned leaf_size, float exclusion, SurfaceBVH &bvh)
+{
+    size_t count = surface.triangles.size();
+    leaf_size = std::max(leaf_size, 1u);
+
+    std::vector<glm::vec3> centroids(count);
+    for (size_t t = 0; t < count; t++)
+    {
+        glm::uvec4 triangle = surface.triangles[t];
+        centroids[t] = glm::vec3(positions[triangle.x] + positions[triangle.y] + positions[triangle.z]) / 3.0f;
+    }
+
+    bvh.triangles.resize(count);
+    std::iota(bvh.triangles.begin(), bvh.triangles.end(), 0);
+    bvh.margin = surface.max_depth + physics.collision_offset;
+
+    // Splitting the nodes in the order they were added lays the tree out breadth first
+    bvh.nodes.assign(1, BVHNode{});
+    std::vector<glm::uvec2> ranges{glm::uvec2(0, count)};
+    std::vector<GLuint> levels{0};
+    for (size_t n = 0; n < bvh.nodes.size(); n++)
+    {
+        GLuint begin = ranges[n].x, end = ranges[n].y;
+        if (end - begin <= leaf_size)
+        {
+            bvh.nodes[n].first = begin;
+            bvh.nodes[n].count = end - begin;
+            continue;
+        }
+
+        glm::vec3 lower(INFINITY), upper(-INFINITY);
+        for (GLuint i = begin; i < end; i++)
+        {
+            lower = glm::min(lower, centroids[bvh.triangles[i]]);
+            upper = glm::max(upper, centroids[bvh.triangles[i]]);
+        }
+        glm::vec3 size = upper - lower;
+        int axis = size.x >= size.y && size.x >= size.z ? 0 : size.y >= size.z ? 1 : 2;
+
+        GLuint middle = begin + (end - begin) / 2;
+        std::nth_element(bvh.triangles.begin() + begin, bvh.triangles.begin() + middle, bvh.triangles.begin() + end, [&](GLuint a, GLuint b)
+        {
+            return centroids[a][axis] < centroids[b][axis];
+        });
+
+        bvh.nodes[n].first = bvh.nodes.size();
+        bvh.nodes[n].count = 0;
+        bvh.nodes.resize(bvh.nodes.size() + 2, BVHNode{});
+        ranges.push_back(glm::uvec2(begin, middle));
+        ranges.push_back(glm::uvec2(middle, end));
+        levels.push_back(levels[n] + 1);
+        levels.push_back(levels[n] + 1);
+    }
+
+    bvh.level_offsets.clear();
+    for (size_t n = 0; n < levels.size(); n++)
+    {
+        if (n == 0 || levels[n] != levels[n - 1])
+            bvh.level_offsets.push_back(n);
+    }
+    bvh.level_offsets.push_back(bvh.nodes.size());
+
+    // Rest spheres from the rest boxes, bottom up like a refit
+    size_t node_count = bvh.nodes.size();
+    std::vector<glm::vec3> rest_lower(node_count), rest_upper(node_count);
+    bvh.rest_spheres.resize(node_count + count);
+    bvh.planes.resize(count);
+    for (size_t n = node_count; n-- > 0;)
+    {
+        const BVHNode &node = bvh.nodes[n];
+        if (node.count)
+        {
+            rest_lower[n] = glm::vec3(INFINITY);
+            rest_upper[n] = glm::vec3(-INFINITY);
+            for (GLuint i = node.first; i < node.first + node.count; i++)
+            {
+                glm::uvec4 triangle = surface.triangles[bvh.triangles[i]];
+                glm::vec3 a = rest_positions[triangle.x], b = rest_positions[triangle.y], c = rest_positions[triangle.z];
+                glm::vec3 center = (glm::min(glm::min(a, b), c) + glm::max(glm::max(a, b), c)) * 0.5f;
+                bvh.rest_spheres[node_count + i] = glm::vec4(center, std::sqrt(std::max({glm::dot(a - center, a - center), glm::dot(b - center, b - center),
+                                                                                         glm::dot(c - center, c - center)})));
+                rest_lower[n] = glm::min(rest_lower[n], glm::min(glm::min(a, b), c));
+                rest_upper[n] = glm::max(rest_upper[n], glm::max(glm::max(a, b), c));
+            }
+        }
+        else
+        {
+            rest_lower[n] = glm::min(rest_lower[node.first], rest_lower[node.first + 1]);
+            rest_upper[n] = glm::max(rest_upper[node.first], rest_upper[node.first + 1]);
+        }
+        bvh.rest_spheres[n] = glm::vec4((rest_lower[n] + rest_upper[n]) * 0.5f, glm::distance(rest_lower[n], rest_upper[n]) * 0.5f);
+    }
+
+    // Surface points in the order the tree first reaches them through their triangles, so that the points of a packet
+    // lie close together
+    std::vector<GLuint> point_of(surface.points.empty() ? 0 : std::max_element(surface.points.begin(), surface.points.end(), [](glm::uvec2 a, glm::uvec2 b)
+    {
+        return a.x < b.x;
+    })->x + 1, ~0u);
+    for (size_t i = 0; i < surface.points.size(); i++)
+        point_of[surface.points[i].x] = i;
+    bvh.points.clear();
+    bvh.point_rest.clear();
+    for (GLuint t : bvh.triangles)
+    {
+        glm::uvec4 triangle = surface.triangles[t];
+        for (GLuint mass : {triangle.x, triangle.y, triangle.z})
+        {
+            if (mass < point_of.size() && point_of[mass] != ~0u)
+            {
+                bvh.points.push_back(point_of[mass]);
+                bvh.point_rest.push_back(rest_positions[mass]);
+                point_of[mass] = ~0u;
+            }
+        }
+    }
+
+    // Radius about every node's rest center that holds the rest spheres of all its entries, which may reach past its own
+    std::vector<float> rest_reach(node_count);
+    const glm::vec4 *entry_spheres = bvh.rest_spheres.data() + node_count;
+    for (size_t n = node_count; n-- > 0;)
+    {
+        const BVHNode &node = bvh.nodes[n];
+        glm::vec3 center = bvh.rest_spheres[n];
+        rest_reach[n] = 0;
+        if (node.count)
+        {
+            for (GLuint i = node.first; i < node.first + node.count; i++)
+                rest_reach[n] = std::max(rest_reach[n], glm::distance(center, glm::vec3(entry_spheres[i])) + entry_spheres[i].w);
+        }
+        else
+        {
+            for (GLuint child = node.first; child < node.first + 2; child++)
+                rest_reach[n] = std::max(rest_reach[n], glm::distance(center, glm::vec3(bvh.rest_spheres[child])) + rest_reach[child]);
+        }
+    }
+
+    // The subtrees every packet skips, from the sphere around its points at rest
+    bvh.packet_offsets.assign(1, 0);
+    bvh.packet_skips.clear();
+    for (size_t first = 0; first < bvh.points.size(); first += point_packet)
+    {
+        size_t last_point = std::min(first + point_packet, bvh.points.size());
+        glm::vec3 lower(INFINITY), upper(-INFINITY);
+        for (size_t i = first; i < last_point; i++)
+        {
+            lower = glm::min(lower, glm::vec3(bvh.point_rest[i]));
+            upper = glm::max(upper, glm::vec3(bvh.point_rest[i]));
+        }
+        glm::vec4 sphere((lower + upper) * 0.5f, glm::distance(lower, upper) * 0.5f);
+        if (collectExcluded(bvh, rest_reach, 0, first, last_point, sphere, exclusion))
+            bvh.packet_skips.push_back(0);
+        bvh.packet_offsets.push_back(bvh.packet_skips.size());
+    }
+
+    bvh.build_cost = 0;
+    for (size_t level = bvh.level_offsets.size() - 1; level-- > 0;)
+        bvh.build_cost += refitSurfaceBVH(surface, bvh.level_offsets[level], bvh.level_offsets[level + 1], positions, bvh);
+}
+
+double refitSurfaceBVH(const ContactSurface &surface, size_t begin, size_t end, const glm::vec4 *positions, SurfaceBVH &bvh)
+{
+    double cost = 0;
+    for (size_t n = begin; n < end; n++)
+    {
+        BVHNode &node = bvh.nodes[n];
+        if (node.count)
+        {
+            glm::vec3 lower(INFINITY), upper(-INFINITY);
+            for (GLuint i = node.first; i < node.first + node.count; i++)
+            {
+                glm::uvec4 triangle = surface.triangles[bvh.triangles[i]];
+                glm::vec3 a = positions[triangle.x], b = positions[triangle.y], c = positions[triangle.z];
+                lower = glm::min(lower, glm::min(glm::min(a, b), c));
+                upper = glm::max(upper, glm::max(glm::max(a, b), c));
+
+                // Degenerate triangles keep a zero normal, which only the full test turns away
+                glm::vec3 normal = glm::cross(b - a, c - a);
+                float area = glm::length(normal);
+                normal = area > 0 ? normal / area : glm::vec3(0.0f);
+                bvh.planes[i] = glm::vec4(normal, glm::dot(normal, a));
+            }
+            node.lower = lower - bvh.margin;
+            node.upper = upper + bvh.margin;
+        }
+        else
+        {
+            const BVHNode &left = bvh.nodes[node.first], &right = bvh.nodes[node.first + 1];
+            node.lower = glm::min(left.lower, right.lower);
+            node.upper = glm::max(left.upper, right.upper);
+        }
+        cost += getBoxArea(node.lower, node.upper);
+    }
+    return cost;
+}
+
+double getSurfaceBVHCost(const BVHNode *nodes, size_t node_count)
+{
+    double cost = 0;
+    for (size_t n = 0; n < node_count; n++)
+        cost += getBoxArea(nodes[n].lower, nodes[n].upper);
+    return cost;
+}
+
+size_t getSurfaceBVHPackets(const SurfaceBVH &bvh)
+{
+    return bvh.packet_offsets.empty() ? 0 : bvh.packet_offsets.size() - 1;
+}
+
+// Whether the box of node n reaches the box [lower, upper]
+static inline bool reachesBox(const SurfaceBVH &bvh, GLuint n, const glm::vec3 &lower, const glm::vec3 &upper)
+{
+    // Every comparison is evaluated, since which way these go is close to random and a mispredicted branch costs more
+    // than the rest of the test
+    const BVHNode &node = bvh.nodes[n];
+    return (upper.x >= node.lower.x) & (upper.y >= node.lower.y) & (upper.z >= node.lower.z) & (lower.x <= node.upper.x) &
+           (lower.y <= node.upper.y) & (lower.z <= node.upper.z);
+}
+
+// Whether the box of leaf n holds point p, and the leaf reaches beyond exclusion of the point at rest
+static inline bool reachesPoint(const SurfaceBVH &bvh, GLuint n, const glm::vec3 &p, const glm::vec3 &rest, float exclusion)
+{
+    // The sphere is compared squared, to keep the square root out of it
+    glm::vec4 sphere = bvh.rest_spheres[n];
+    glm::vec3 offset = glm::vec3(sphere) - rest;
+    float reach = std::max(exclusion - sphere.w, 0.0f);
+    return reachesBox(bvh, n, p, p) & (glm::dot(offset, offset) >= reach * reach);
+}
+
+size_t resolveSelfContacts(const ContactSurface &surface, const SurfaceBVH &bvh, const PhysicsConfig &physics, float exclusion, size_t begin, size_t end,
+                           const glm::vec4 *last_positions, const glm::vec4 *positions, glm::vec4 *corrections)
+{
+    const glm::vec4 *entry_spheres = bvh.rest_spheres.data() + bvh.nodes.size();
+    // Deep enough for any tree of up to 2^63 leaves
+    GLuint stack[64];
+    std::vector<GLuint> leaves;
+    size_t tested = 0;
+    for (size_t packet = begin; packet < end; packet++)
+    {
+        size_t first = packet * point_packet, last_point = std::min(first + point_packet, bvh.points.size());
+
+        // The packet walks the tree once with the box around its points, around the subtrees it skips
+        glm::vec3 lower(INFINITY), upper(-INFINITY);
+        for (size_t i = first; i < last_point; i++)
+        {
+            GLuint mass = surface.points[bvh.points[i]].x;
+            lower = glm::min(lower, glm::vec3(positions[mass]));
+            upper = glm::max(upper, glm::vec3(positions[mass]));
+        }
+        const GLuint *skips = bvh.packet_skips.data() + bvh.packet_offsets[packet];
+        const GLuint *skips_end = bvh.packet_skips.data() + bvh.packet_offsets[packet + 1];
+
+        // Nodes are tested before they are pushed, so that both children are tested from the one cache line they share
+        leaves.clear();
+        size_t depth = 0;
+        if (reachesBox(bvh, 0, lower, upper) && std::find(skips, skips_end, 0u) == skips_end)
+            stack[depth++] = 0;
+        while (depth)
+        {
+            GLuint n = stack[--depth];
+            const BVHNode &node = bvh.nodes[n];
+            if (node.count)
+            {
+                leaves.push_back(n);
+                continue;
+            }
+            for (GLuint child = node.first; child < node.first + 2; child++)
+            {
+                stack[depth] = child;
+                depth += reachesBox(bvh, child, lower, upper) & (std::find(skips, skips_end, child) == skips_end);
+            }
+        }
+
+        for (size_t i = first; i < last_point; i++)
+        {
+            glm::uvec2 point = surface.points[bvh.points[i]];
+            glm::vec3 p = positions[point.x], rest = bvh.point_rest[i];
+
+            bool found = false;
+            float best = 0;
+            glm::vec3 best_normal(0.0f);
+            for (GLuint n : leaves)
+            {
+                if (!reachesPoint(bvh, n, p, rest, exclusion))
+                    continue;
+
+                const BVHNode &node = bvh.nodes[n];
+                for (GLuint e = node.first; e < node.first + node.count; e++)
+                {
+                    glm::vec4 plane = bvh.planes[e];
+                    float dist = glm::dot(p, glm::vec3(plane)) - plane.w;
+                    if (dist >= physics.collision_offset || dist < -surface.max_depth || (found && dist <= best))
+                        continue;
+
+                    if (glm::distance(glm::vec3(entry_spheres[e]), rest) - entry_spheres[e].w < exclusion)
+                        continue;
+
+                    glm::uvec4 triangle = surface.triangles[bvh.triangles[e]];
+                    if (triangle.w != point.y)
+                        continue;
+
+                    glm::vec3 last = last_positions[point.x];
+                    glm::vec3 a = last_positions[triangle.x], b = last_positions[triangle.y], c = last_positions[triangle.z];
+                    if (glm::dot(last - a, glm::cross(b - a, c - a)) < 0)
+                        continue;
+
+                    tested++;
+                    testContactTriangle(surface, physics, p, triangle, positions, found, best, best_normal);
+                }
+            }
+
+            if (found)
+                corrections[point.x] += glm::vec4(best_normal * (physics.collision_offset - best), 0) * physics.collision_response;
+        }
+    }
+    return tested;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "includes.h"
+#include "constructs.h"
+#include "body_contacts.hpp"
+
+#include <vector>
+
+typedef struct
+{
+    // A surface mass is never pushed out of a triangle that came within exclusion longest edges of it at rest, which
+    // covers its own neighbourhood and the faces meeting it at the edges of the cube
+    float exclusion = 2.0f;
+    // Triangles per leaf at most
+    unsigned leaf_size = 4;
+    // Rebuild once the summed area of the refit boxes grows past rebuild_ratio times what it was right after the last build
+    float rebuild_ratio = 1.5f;
+    // GPU: steps between reading the boxes back to check that
+    unsigned check_interval = 32;
+} SelfCollisionConfig;
+
+// std430 layout of bvh_nodes in self_collide.comp
+typedef struct
+{
+    glm::vec3 lower;
+    // Internal nodes: the first of their two children, side by side. Leaves: their first entry in SurfaceBVH::triangles
+    GLuint first;
+    glm::vec3 upper;
+    // Triangles of a leaf, 0 for internal nodes
+    GLuint count;
+} BVHNode;
+
+// Bounding volume hierarchy over the triangles of a ContactSurface, split at the median of the longest axis.
+// Nodes are stored breadth first, so every level is one contiguous run of them and a refit is one parallel pass per
+// level, deepest first, with the same tree order the build left it in.
+typedef struct
+{
+    std::vector<BVHNode> nodes;
+    // Index into ContactSurface::triangles of every leaf entry
+    std::vector<GLuint> triangles;
+    // Bounding spheres at rest (xyz = center, w = radius) of every node and then of every leaf entry. A query skips
+    // whatever lies within exclusion of the point at rest as a whole.
+    std::vector<glm::vec4> rest_spheres;
+    // Plane of every leaf entry as of the last refit (xyz = unit normal, w = its offset), so that queries turn most
+    // triangles away without reading their corners
+    std::vector<glm::vec4> planes;
+    // Index into ContactSurface::points of every surface point, in the order queries take them, and its rest position
+    // alongside, so that the queries do not have to find it among all the masses
+    std::vector<GLuint> points;
+    std::vector<glm::vec4> point_rest;
+    // The subtrees every packet of points skips, packets + 1 offsets into packet_skips: the highest nodes all of whose
+    // triangles came within exclusion of every point of the packet at rest. The rest shape never changes, so the
+    // neighbourhood a packet is never pushed out of is cut out of the tree once per build, instead of walked down to and
+    // turned away triangle by triangle every step.
+    std::vector<GLuint> packet_offsets;
+    std::vector<GLuint> packet_skips;
+    // Where every level of nodes starts, levels + 1 entries
+    std::vector<GLuint> level_offsets;
+    // Boxes are grown by this much, so that a point that may be pushed out of a triangle sits inside its leaf's box
+    float margin = 0;
+    // Summed area of the boxes right after the last build
+    double build_cost = 0;
+} SurfaceBVH;
+
+// What the last self collision pass did
+typedef struct
+{
+    // Seconds spent on refitting (and rebuilding) the hierarchy and on the point queries
+    double refit_time = 0, query_time = 0;
+    // Point-triangle pairs tested
+    size_t tested = 0;
+    // Rebuilds since init
+    unsigned rebuilds = 0;
+} SelfCollisionStats;
+
+void buildSurfaceBVH(const ContactSurface &surface, const PhysicsConfig &physics, const glm::vec4 *rest_positions, const glm::vec4 *positions,
+                     unsigned leaf_size, float exclusion, SurfaceBVH &bvh);
+
+// Bounds of the nodes [begin, end) of one level from their triangles or their children, which must have been refit
+// already, and the planes of the leaves' triangles. Returns the summed area of the new boxes.
+double refitSurfaceBVH(const ContactSurface &surface, size_t begin, size_t end, const glm::vec4 *positions, SurfaceBVH &bvh);
+
+// Summed area of every box
+double getSurfaceBVHCost(const BVHNode *nodes, size_t node_count);
+
+// Packets of surface points in SurfaceBVH::points
+size_t getSurfaceBVHPackets(const SurfaceBVH &bvh);
+
+// The packets [begin, end) of surface points walk the hierarchy, around the subtrees they skip, down to the leaves that
+// may hold them, and each point is pushed out of the nearest triangle of its own body it sits behind, as resolveContacts()
+// does. Triangles that came within exclusion of the point at rest are its own neighbourhood and skipped, and so are
+// those it was already behind before the step, which it reached around a thin part of the body rather than through
+// them. exclusion must be the one the hierarchy was built with. Returns the point-triangle pairs tested.
+size_t resolveSelfContacts(const ContactSurface &surface, const SurfaceBVH &bvh, const PhysicsConfig &physics, float exclusion, size_t begin, size_t end,
+                           const glm::vec4 *last_positions, const glm::vec4 *positions, glm::vec4 *corrections);
@@ -0,0 +1,214 @@
+#include "sweep_prune.hpp"
+
+#include <algorithm>
+#include <numeric>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SWEEP_PRUNE_X86
+#include <immintrin.h>
+#endif
+
+// Boxes sorted by lower x, one array per bound
+typedef struct
+{
+    const GLuint *order;
+    const float *min_x, *max_x, *min_y, *max_y, *min_z, *max_z;
+    size_t count;
+} SortedBoxes;
+
+static void addPair(const SortedBoxes &boxes, size_t i, size_t j, std::vector<glm::uvec2> &pairs)
+{
+    GLuint a = boxes.order[i], b = boxes.order[j];
+    pairs.push_back(a < b ? glm::uvec2(a, b) : glm::uvec2(b, a));
+}
+
+static bool overlapsYZ(const SortedBoxes &boxes, size_t i, size_t j)
+{
+    return boxes.min_y[j] <= boxes.max_y[i] && boxes.max_y[j] >= boxes.min_y[i] && boxes.min_z[j] <= boxes.max_z[i] &&
+           boxes.max_z[j] >= boxes.min_z[i];
+}
+
+// The boxes from j on that start within box i's reach along x
+static void scalarSweep(const SortedBoxes &boxes, size_t i, size_t j, std::vector<glm::uvec2> &pairs)
+{
+    for (; j < boxes.count && boxes.min_x[j] <= boxes.max_x[i]; j++)
+    {
+        if (overlapsYZ(boxes, i, j))
+            addPair(boxes, i, j, pairs);
+    }
+}
+
+static void scalarSweep(const SortedBoxes &boxes, std::vector<glm::uvec2> &pairs)
+{
+    for (size_t i = 0; i < boxes.count; i++)
+        scalarSweep(boxes, i, i + 1, pairs);
+}
+
+#ifdef SWEEP_PRUNE_X86
+
+// Every vector of boxes is tested whole, and the sweep of box i stops at the first one with a box beyond its reach,
+// since all after it start even further along x
+
+__attribute__((target("sse4.1"))) static void sse4Sweep(const SortedBoxes &boxes, std::vector<glm::uvec2> &pairs)
+{
+    for (size_t i = 0; i < boxes.count; i++)
+    {
+        __m128 reach = _mm_set1_ps(boxes.max_x[i]);
+        __m128 min_y = _mm_set1_ps(boxes.min_y[i]), max_y = _mm_set1_ps(boxes.max_y[i]);
+        __m128 min_z = _mm_set1_ps(boxes.min_z[i]), max_z = _mm_set1_ps(boxes.max_z[i]);
+        size_t j = i + 1;
+        for (; j + 4 <= boxes.count; j += 4)
+        {
+            __m128 in_x = _mm_cmple_ps(_mm_loadu_ps(&boxes.min_x[j]), reach);
+            __m128 overlap = _mm_and_ps(_mm_and_ps(in_x, _mm_cmple_ps(_mm_loadu_ps(&boxes.min_y[j]), max_y)),
+                                        _mm_and_ps(_mm_cmpge_ps(_mm_loadu_ps(&boxes.max_y[j]), min_y),
+                                                   _mm_and_ps(_mm_cmple_ps(_mm_loadu_ps(&boxes.min_z[j]), max_z),
+                                                              _mm_cmpge_ps(_mm_loadu_ps(&boxes.max_z[j]), min_z))));
+            for (unsigned mask = _mm_movemask_ps(overlap); mask; mask &= mask - 1)
+                addPair(boxes, i, j + __builtin_ctz(mask), pairs);
+            if (_mm_movemask_ps(in_x) != 0xf)
+                break;
+        }
+        if (j + 4 > boxes.count)
+            scalarSweep(boxes, i, j, pairs);
+    }
+}
+
+__attribute__((target("avx2,fma"))) static void avx2Sweep(const SortedBoxes &boxes, std::vector<glm::uvec2> &pairs)
+{
+    for (size_t i = 0; i < boxes.count; i++)
+    {
+        __m256 reach = _mm256_set1_ps(boxes.max_x[i]);
+        __m256 min_y = _mm256_set1_ps(boxes.min_y[i]), max_y = _mm256_set1_ps(boxes.max_y[i]);
+        __m256 min_z = _mm256_set1_ps(boxes.min_z[i]), max_z = _mm256_set1_ps(boxes.max_z[i]);
+        size_t j = i + 1;
+        for (; j + 8 <= boxes.count; j += 8)
+        {
+            __m256 in_x = _mm256_cmp_ps(_mm256_loadu_ps(&boxes.min_x[j]), reach, _CMP_LE_OQ);
+            __m256 overlap = _mm256_and_ps(_mm256_and_ps(in_x, _mm256_cmp_ps(_mm256_loadu_ps(&boxes.min_y[j]), max_y, _CMP_LE_OQ)),
+                                           _mm256_and_ps(_mm256_cmp_ps(_mm256_loadu_ps(&boxes.max_y[j]), min_y, _CMP_GE_OQ),
+                                                         _mm256_and_ps(_mm256_cmp_ps(_mm256_loadu_ps(&boxes.min_z[j]), max_z, _CMP_LE_OQ),
+                                                                       _mm256_cmp_ps(_mm256_loadu_ps(&boxes.max_z[j]), min_z, _CMP_GE_OQ))));
+            for (unsigned mask = _mm256_movemask_ps(overlap); mask; mask &= mask - 1)
+                addPair(boxes, i, j + __builtin_ctz(mask), pairs);
+            if (_mm256_movemask_ps(in_x) != 0xff)
+                break;
+        }
+        if (j + 8 > boxes.count)
+            scalarSweep(boxes, i, j, pairs);
+    }
+}
+
+__attribute__((target("avx512f"))) static void avx512Sweep(const SortedBoxes &boxes, std::vector<glm::uvec2> &pairs)
+{
+    for (size_t i = 0; i < boxes.count; i++)
+    {
+        __m512 reach = _mm512_set1_ps(boxes.max_x[i]);
+        __m512 min_y = _mm512_set1_ps(boxes.min_y[i]), max_y = _mm512_set1_ps(boxes.max_y[i]);
+        __m512 min_z = _mm512_set1_ps(boxes.min_z[i]), max_z = _mm512_set1_ps(boxes.max_z[i]);
+        size_t j = i + 1;
+        for (; j + 16 <= boxes.count; j += 16)
+        {
+            __mmask16 in_x = _mm512_cmp_ps_mask(_mm512_loadu_ps(&boxes.min_x[j]), reach, _CMP_LE_OQ);
+            __mmask16 overlap = _mm512_mask_cmp_ps_mask(in_x, _mm512_loadu_ps(&boxes.min_y[j]), max_y, _CMP_LE_OQ);
+            overlap = _mm512_mask_cmp_ps_mask(overlap, _mm512_loadu_ps(&boxes.max_y[j]), min_y, _CMP_GE_OQ);
+            overlap = _mm512_mask_cmp_ps_mask(overlap, _mm512_loadu_ps(&boxes.min_z[j]), max_z, _CMP_LE_OQ);
+            overlap = _mm512_mask_cmp_ps_mask(overlap, _mm512_loadu_ps(&boxes.max_z[j]), min_z, _CMP_GE_OQ);
+            for (unsigned mask = overlap; mask; mask &= mask - 1)
+                addPair(boxes, i, j + __builtin_ctz(mask), pairs);
+            if (in_x != 0xffff)
+                break;
+        }
+        if (j + 16 > boxes.count)
+            scalarSweep(boxes, i, j, pairs);
+    }
+}
+
+#endif
+
+void SweepAndPrune::setISA(SpringISA isa)
+{
+    this->isa = resolveSpringISA(isa);
+}
+
+SpringISA SweepAndPrune::getISA() const
+{
+    return isa;
+}
+
+void SweepAndPrune::sort(const glm::vec4 *bounds, size_t count)
+{
+    swaps = 0;
+    min_x.resize(count);
+    if (order.size() != count)
+    {
+        // Nothing to be coherent with
+        order.resize(count);
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](GLuint a, GLuint b)
+        {
+            return bounds[a * 2].x < bounds[b * 2].x;
+        });
+        for (size_t i = 0; i < count; i++)
+            min_x[i] = bounds[order[i] * 2].x;
+        return;
+    }
+
+    // Insertion sort from the last order, keys alongside so the inner loop stays in one array
+    for (size_t i = 0; i < count; i++)
+    {
+        GLuint box = order[i];
+        float key = bounds[box * 2].x;
+        size_t j = i;
+        for (; j > 0 && min_x[j - 1] > key; j--)
+        {
+            min_x[j] = min_x[j - 1];
+            order[j] = order[j - 1];
+        }
+        min_x[j] = key;
+        order[j] = box;
+        swaps += i - j;
+    }
+}
+
+void SweepAndPrune::update(const glm::vec4 *bounds, size_t count, std::vector<glm::uvec2> &pairs)
+{
+    pairs.clear();
+    sort(bounds, count);
+
+    for (std::vector<float> *bound : {&max_x, &min_y, &max_y, &min_z, &max_z})
+        bound->resize(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        glm::vec4 lower = bounds[order[i] * 2], upper = bounds[order[i] * 2 + 1];
+        max_x[i] = upper.x;
+        min_y[i] = lower.y;
+        max_y[i] = upper.y;
+        min_z[i] = lower.z;
+        max_z[i] = upper.z;
+    }
+
+    SortedBoxes boxes{order.data(), min_x.data(), max_x.data(), min_y.data(), max_y.data(), min_z.data(), max_z.data(), count};
+    switch (isa)
+    {
+#ifdef SWEEP_PRUNE_X86
+    case SpringISA::SSE4:
+        sse4Sweep(boxes, pairs);
+        break;
+    case SpringISA::AVX2:
+        avx2Sweep(boxes, pairs);
+        break;
+    case SpringISA::AVX512:
+        avx512Sweep(boxes, pairs);
+        break;
+#endif
+    default:
+        scalarSweep(boxes, pairs);
+        break;
+    }
+}
+
+size_t SweepAndPrune::getSwapCount() const
+{
+    return swaps;
+}
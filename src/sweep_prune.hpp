@@ -0,0 +1,33 @@
+#pragma once
+
+#include "includes.h"
+#include "spring_kernels.hpp"
+
+#include <vector>
+
+// Incremental sweep and prune over axis aligned boxes. The boxes stay sorted by their lower x from one update to the
+// next, so the insertion sort only has to undo how far they moved since. The sweep then tests every box against the
+// ones starting within its x reach for y and z overlap, a vector of them at a time.
+class SweepAndPrune
+{
+public:
+    // Instruction set of the overlap tests, the same ones as the spring kernels
+    void setISA(SpringISA isa);
+    SpringISA getISA() const;
+
+    // bounds holds the lower and upper corner of every box, 2 * count entries. Writes every overlapping pair of boxes
+    // into pairs, lower index first. A count other than the last one's sorts from scratch.
+    void update(const glm::vec4 *bounds, size_t count, std::vector<glm::uvec2> &pairs);
+    // Swaps the insertion sort of the last update took
+    size_t getSwapCount() const;
+
+private:
+    void sort(const glm::vec4 *bounds, size_t count);
+
+    SpringISA isa = detectSpringISA();
+    // Box indices by lower x, as of the last update
+    std::vector<GLuint> order;
+    // The boxes in that order, one array per bound
+    std::vector<float> min_x, max_x, min_y, max_y, min_z, max_z;
+    size_t swaps = 0;
+};
@@ -0,0 +1,88 @@
+#include "thread_pool.hpp"
+
+ThreadPool::ThreadPool(unsigned threads)
+{
+    if (!threads)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    for (unsigned i = 1; i < threads; i++)
+        workers.emplace_back(&ThreadPool::work, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    start.notify_all();
+
+    for (std::thread &worker : workers)
+        worker.join();
+}
+
+unsigned ThreadPool::size() const
+{
+    return workers.size() + 1;
+}
+
+void ThreadPool::parallelFor(size_t count, const Body &body, size_t grain)
+{
+    if (!count)
+        return;
+
+    // Hand out several chunks per thread so uneven chunks balance out
+    size_t chunk = std::max(grain, count / (size() * 4));
+    if (workers.empty() || chunk >= count)
+    {
+        body(0, count, 0);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->body = &body;
+        this->count = count;
+        this->chunk = chunk;
+        next.store(0, std::memory_order_relaxed);
+        pending = workers.size();
+        generation++;
+    }
+    start.notify_all();
+
+    runChunks(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return pending == 0; });
+    this->body = nullptr;
+}
+
+void ThreadPool::work(unsigned thread)
+{
+    size_t seen = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            start.wait(lock, [this, seen] { return stopping || generation != seen; });
+            if (stopping)
+                return;
+            seen = generation;
+        }
+
+        runChunks(thread);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending--;
+        }
+        done.notify_one();
+    }
+}
+
+void ThreadPool::runChunks(unsigned thread)
+{
+    size_t begin;
+    while ((begin = next.fetch_add(chunk, std::memory_order_relaxed)) < count)
+        (*body)(begin, std::min(begin + chunk, count), thread);
+}
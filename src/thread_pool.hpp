@@ -0,0 +1,44 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads that split index ranges between them.
+// The calling thread takes part in every parallelFor, so a pool of size 1 runs inline.
+class ThreadPool
+{
+public:
+    // body(begin, end, thread) handles indices [begin, end); thread is in [0, size())
+    typedef std::function<void(size_t, size_t, unsigned)> Body;
+
+    ThreadPool(unsigned threads = 0);
+    ~ThreadPool();
+
+    unsigned size() const;
+
+    // Runs body over [0, count) and returns once every index has been visited
+    void parallelFor(size_t count, const Body &body, size_t grain = 1);
+
+private:
+    void work(unsigned thread);
+    void runChunks(unsigned thread);
+
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable start;
+    std::condition_variable done;
+    size_t generation = 0;
+    unsigned pending = 0;
+    bool stopping = false;
+
+    // Current job
+    const Body *body = nullptr;
+    size_t count = 0;
+    size_t chunk = 1;
+    std::atomic<size_t> next{0};
+};
@@ -0,0 +1,129 @@
+#include "timestep.hpp"
+#include "spring_layout.hpp"
+
+#include <algorithm>
+#include <math.h>
+#include <vector>
+
+const char *getIntegratorName(Integrator integrator)
+{
+    switch (integrator)
+    {
+    case Integrator::Verlet:
+        return "verlet";
+    case Integrator::Implicit:
+        return "implicit";
+    case Integrator::XPBD:
+        return "xpbd";
+    case Integrator::Projective:
+        return "projective";
+    case Integrator::Modal:
+        return "modal";
+    default:
+        return "unknown";
+    }
+}
+
+const char *getConstraintSolverName(ConstraintSolver solver)
+{
+    switch (solver)
+    {
+    case ConstraintSolver::GaussSeidel:
+        return "gauss-seidel";
+    case ConstraintSolver::Jacobi:
+        return "jacobi";
+    default:
+        return "unknown";
+    }
+}
+
+float getChebyshevOmega(const XPBDConfig &config, unsigned iteration, float last_omega)
+{
+    float rho = config.spectral_radius;
+    // The multipliers before the first sweep are left over from the last step (the sweep reads them as zero),
+    // so the second sweep has no valid previous iterate to extrapolate from
+    unsigned delay = std::max(config.chebyshev_delay, 2u);
+    if (iteration < delay || rho <= 0)
+        return 1;
+    if (iteration == delay)
+        return 2 / (2 - rho * rho);
+    return 4 / (4 - rho * rho * last_omega);
+}
+
+float getDamping(const PhysicsConfig &physics, float delta_t)
+{
+    return delta_t == physics.delta_t ? physics.damping : powf(physics.damping, delta_t / physics.delta_t);
+}
+
+void getVerletScales(const PhysicsConfig &physics, float delta_t, float last_delta_t, float &velocity_scale, float &force_scale)
+{
+    float damping = getDamping(physics, delta_t);
+    velocity_scale = delta_t == last_delta_t ? damping : damping * delta_t / last_delta_t;
+    force_scale = delta_t * (delta_t + last_delta_t) * 0.5f;
+}
+
+void getSpringBounds(const SimulationData &data, const PhysicsConfig &physics, float &stiffness, float &min_length)
+{
+    stiffness = 0;
+    min_length = INFINITY;
+
+    if (!data.springs)
+    {
+        // An interior mass has every stencil spring but the face-only diagonals, from both ends
+        for (int i = 0; i < 12; i++)
+        {
+            if (lattice_stencil[i].edge_axis >= 0)
+                continue;
+
+            stiffness += 2 * physics.stiffness[lattice_stencil[i].type];
+            min_length = std::min(min_length, data.lattice.rest_lengths[i]);
+        }
+        return;
+    }
+
+    std::vector<float> sums(data.position_count, 0.0f);
+    for (size_t i = 0; i < data.spring_count; i++)
+    {
+        const Spring &spring = data.springs[i];
+        if (spring.type == 0)
+            continue;
+
+        sums[spring.point1] += physics.stiffness[spring.type];
+        sums[spring.point2] += physics.stiffness[spring.type];
+        min_length = std::min(min_length, spring.len);
+    }
+    stiffness = *std::max_element(sums.begin(), sums.end());
+}
+
+void TimestepController::init(const TimestepConfig &config, const PhysicsConfig &physics, float stiffness, float min_length)
+{
+    this->config = config;
+    this->min_length = min_length;
+
+    // Explicit integration of a mass on springs is stable while dt < 2 / omega, omega^2 = k / m
+    stable_delta_t = config.safety * 2 / sqrtf(stiffness / physics.mass);
+    stable_delta_t = std::clamp(stable_delta_t, config.min_delta_t, config.max_delta_t);
+    delta_t = std::min(physics.delta_t, stable_delta_t);
+}
+
+float TimestepController::update(const StepStats &stats)
+{
+    float target = stable_delta_t;
+    if (stats.max_speed > 0)
+        target = std::min(target, config.cfl * min_length / stats.max_speed);
+    if (stats.max_acceleration > 0)
+        target = std::min(target, sqrtf(config.cfl * min_length / stats.max_acceleration));
+
+    delta_t = std::clamp(std::min(target, delta_t * config.growth), config.min_delta_t, config.max_delta_t);
+    return delta_t;
+}
+
+float TimestepController::getDeltaT() const
+{
+    return delta_t;
+}
+
+float TimestepController::getStableDeltaT() const
+{
+    return stable_delta_t;
+}
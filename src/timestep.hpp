@@ -0,0 +1,120 @@
+#pragma once
+
+#include "constructs.h"
+
+// Maxima over the masses of one step, for the timestep controller.
+// Laid out as the two uints of the step_stats SSBO (binding 11).
+typedef struct
+{
+    float max_speed;
+    float max_acceleration;
+} StepStats;
+
+// How positions advance from the forces of a step, on both backends
+enum class Integrator
+{
+    // Explicit position Verlet (integrate.comp)
+    Verlet,
+    // Backward Euler, linearized once per step and solved with Jacobi preconditioned conjugate gradient
+    // over the springs' force Jacobian, which is applied matrix-free (implicit_*.comp)
+    Implicit,
+    // Extended position based dynamics: Verlet with gravity alone predicts the positions, then every spring
+    // is projected as a compliant distance constraint, see ConstraintSolver
+    XPBD,
+    // Projective dynamics (CPU only): the same prediction, then alternating a local step that snaps every spring
+    // to its rest length with a global solve against a constant matrix, Cholesky factored once up front
+    Projective,
+    // Reduced order: rigid motion plus the lowest vibration modes of the springs, see ModalBody. Stepped on
+    // the CPU whatever the backend, the GPU only rebuilds the masses from the modes for rendering (reconstruct.comp).
+    Modal
+};
+
+const char *getIntegratorName(Integrator integrator);
+
+// How XPBD sweeps over the springs
+enum class ConstraintSolver
+{
+    // Springs in order within a block, the 8 block colors one after another (constrain.comp)
+    GaussSeidel,
+    // Every mass sums the corrections of its incident springs from the last iterate, one pass per sweep,
+    // with Chebyshev semi-iterative acceleration (constrain_jacobi.comp, constrain_chebyshev.comp)
+    Jacobi
+};
+
+const char *getConstraintSolverName(ConstraintSolver solver);
+
+typedef struct
+{
+    // The GPU always runs max_iterations, the CPU stops once the residual drops below
+    // tolerance times the right hand side
+    unsigned max_iterations = 20;
+    float tolerance = 1e-3f;
+} ImplicitConfig;
+
+typedef struct
+{
+    // Sweeps over the springs per step, more converge closer to the full spring stiffness
+    unsigned iterations = 10;
+    ConstraintSolver solver = ConstraintSolver::GaussSeidel;
+    // Jacobi only. Each spring corrects by relaxation / (most springs at either end) of its full projection.
+    float relaxation = 4.0f;
+    // Estimated spectral radius of the Jacobi iteration, 0 turns the Chebyshev acceleration off,
+    // which also waits for chebyshev_delay (at least 2) plain sweeps first
+    float spectral_radius = 0.95f;
+    unsigned chebyshev_delay = 2;
+} XPBDConfig;
+
+typedef struct
+{
+    // Local/global iterations per step
+    unsigned iterations = 10;
+} ProjectiveConfig;
+
+// Chebyshev weight of Jacobi sweep iteration (Wang 2015): x = omega * (jacobi(x) - x_prev) + x_prev,
+// given the weight of the sweep before
+float getChebyshevOmega(const XPBDConfig &config, unsigned iteration, float last_omega);
+
+typedef struct
+{
+    // Fraction of the explicit stability limit 2 / omega_max to step at. omega_max comes from the summed
+    // stiffness at a mass, which never underestimates it, so 1 still leaves a margin.
+    float safety = 1.0f;
+    // Largest fraction of the shortest rest length a mass may travel in one step,
+    // from its velocity or from its acceleration alone
+    float cfl = 0.5f;
+    // Largest factor dt grows by per update, shrinking takes effect at once
+    float growth = 1.05f;
+    float min_delta_t = 1e-5f;
+    float max_delta_t = 0.05f;
+} TimestepConfig;
+
+// Variable step Verlet with damping per unit time (PhysicsConfig::damping per PhysicsConfig::delta_t):
+// x' = x + velocity_scale * (x - x_last) + force / mass * force_scale.
+// Gives exactly damping and delta_t^2 at a constant PhysicsConfig::delta_t.
+void getVerletScales(const PhysicsConfig &physics, float delta_t, float last_delta_t, float &velocity_scale, float &force_scale);
+
+// Per-time damping of PhysicsConfig::damping over a step of delta_t
+float getDamping(const PhysicsConfig &physics, float delta_t);
+
+// Largest summed stiffness of the springs at any one mass, and the shortest rest length,
+// from data.springs, or from the lattice stencil when there are none
+void getSpringBounds(const SimulationData &data, const PhysicsConfig &physics, float &stiffness, float &min_length);
+
+// Picks each frame's dt from a fixed stiffness bound and the step statistics of the previous frame
+class TimestepController
+{
+public:
+    void init(const TimestepConfig &config, const PhysicsConfig &physics, float stiffness, float min_length);
+    // Returns the dt for the next frame
+    float update(const StepStats &stats);
+
+    float getDeltaT() const;
+    // The stiffness bound alone, what a calm body steps at
+    float getStableDeltaT() const;
+
+private:
+    TimestepConfig config;
+    float min_length = 0;
+    float stable_delta_t = 0;
+    float delta_t = 0;
+};